@@ -0,0 +1,62 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Runs Monitor::refresh_projects against a local mock Jenkins and reports how long every refresh
+// took, how many requests it made and how many bytes Jenkins had to send.
+//
+// Run with: cargo bench --bench crawl
+// The size of the Jenkins server can be changed with the BENCH_DEPTH, BENCH_FOLDERS, BENCH_JOBS,
+// BENCH_LATENCY_MS, BENCH_PADDING and BENCH_CONCURRENCY environment variables.
+
+use build_monitor::monitor::{CrawlMode, Monitor};
+use mock_jenkins::{MockJenkins, MockJenkinsConfig};
+
+use futures::executor::block_on;
+use std::time::{Duration, Instant};
+
+fn env_or<T: std::str::FromStr>(name: &str, default: T) -> T {
+    std::env::var(name).ok().and_then(|value| value.parse::<T>().ok()).unwrap_or(default)
+}
+
+fn refresh(name: &str, monitor: &mut Monitor, jenkins: &MockJenkins) {
+    jenkins.reset_statistics();
+    let start = Instant::now();
+    let result = block_on(monitor.refresh_projects());
+    let elapsed = start.elapsed();
+    let statistics = jenkins.statistics();
+    match result {
+        Ok(_) => println!("  {:<6} {:>10.1} ms {:>8} requests {:>8} not modified {:>12} bytes {:>6} projects",
+            name,
+            elapsed.as_secs_f64() * 1000.0,
+            statistics.requests,
+            statistics.not_modified,
+            statistics.bytes_sent,
+            monitor.get_projects().read().unwrap().len()),
+        Err(e) => println!("  {:<6} failed: {}", name, e),
+    }
+}
+
+fn main() {
+    let config = MockJenkinsConfig {
+        folder_depth: env_or("BENCH_DEPTH", 2),
+        folders_per_folder: env_or("BENCH_FOLDERS", 4),
+        jobs_per_folder: env_or("BENCH_JOBS", 25),
+        latency: Duration::from_millis(env_or("BENCH_LATENCY_MS", 5)),
+        build_padding: env_or("BENCH_PADDING", 2048),
+        ..MockJenkinsConfig::default()
+    };
+    let concurrency: usize = env_or("BENCH_CONCURRENCY", 8);
+
+    for (mode_name, crawl_mode) in [("per-project", CrawlMode::PerProject), ("bulk", CrawlMode::Bulk)] {
+        let jenkins = MockJenkins::start("127.0.0.1:0", config.clone()).expect("Failed to start mock Jenkins.");
+        println!("Crawl mode {}, {} projects, {} ms latency, concurrency {}",
+            mode_name, jenkins.project_count(), config.latency.as_millis(), concurrency);
+
+        let mut monitor = Monitor::new(jenkins.url());
+        monitor.set_crawl_mode(crawl_mode);
+        monitor.set_max_concurrent_requests(concurrency);
+        refresh("cold", &mut monitor, &jenkins);
+        refresh("warm", &mut monitor, &jenkins);
+        monitor.invalidate_topology();
+        refresh("search", &mut monitor, &jenkins);
+    }
+}
@@ -0,0 +1,147 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Compares handing the projects of a ProjectUpdate to the C++ client the way bm_acquire_projects does,
+// with a malloc for every string that bm_release_projects frees again, to laying them out in a flat
+// snapshot that the client reads in place. Both start from the update the client received, so the
+// times include decoding it, and report how many heap operations the handover takes.
+//
+// Run with: cargo bench --bench flat_snapshot
+// The projects are crawled from a local mock Jenkins with 10k projects, whose size can be changed with
+// the BENCH_FOLDERS and BENCH_JOBS environment variables.
+
+use build_monitor::flat_snapshot::encode_flat_snapshot;
+use build_monitor::monitor::{CrawlMode, Monitor};
+use build_monitor::project::Project;
+use mock_jenkins::{MockJenkins, MockJenkinsConfig};
+
+use futures::executor::block_on;
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::ffi::CString;
+use std::hint::black_box;
+use std::os::raw::c_char;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::{Duration, Instant};
+
+const ITERATIONS: u32 = 20;
+
+// Counts the heap operations of Rust, the malloc and free calls of the C API are counted by hand.
+struct CountingAllocator;
+
+static HEAP_OPERATIONS: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        HEAP_OPERATIONS.fetch_add(1, Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        HEAP_OPERATIONS.fetch_add(1, Ordering::Relaxed);
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        HEAP_OPERATIONS.fetch_add(1, Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAllocator = CountingAllocator;
+
+fn env_or<T: std::str::FromStr>(name: &str, default: T) -> T {
+    std::env::var(name).ok().and_then(|value| value.parse::<T>().ok()).unwrap_or(default)
+}
+
+fn load_projects() -> Vec<Project> {
+    let config = MockJenkinsConfig {
+        folder_depth: 1,
+        folders_per_folder: env_or("BENCH_FOLDERS", 100),
+        jobs_per_folder: env_or("BENCH_JOBS", 100),
+        ..MockJenkinsConfig::default()
+    };
+    let jenkins = MockJenkins::start("127.0.0.1:0", config).expect("Failed to start mock Jenkins.");
+    let mut monitor = Monitor::new(jenkins.url());
+    monitor.set_crawl_mode(CrawlMode::Bulk);
+    block_on(monitor.refresh_projects()).expect("Failed to crawl mock Jenkins.");
+    let projects = monitor.get_projects().read().unwrap().clone();
+    projects
+}
+
+// The strings of ProjectsFFI in the C API, the numbers are copied the same way in both paths.
+struct ProjectStrings {
+    folder_name: *mut c_char,
+    project_name: *mut c_char,
+    url: *mut c_char,
+    culprits: Vec<*mut c_char>,
+    volunteer: *mut c_char,
+}
+
+fn malloc_string(value: &str) -> *mut c_char {
+    let value = CString::new(value).unwrap();
+    let bytes = value.as_bytes_with_nul();
+    HEAP_OPERATIONS.fetch_add(1, Ordering::Relaxed);
+    unsafe {
+        let copy = libc::malloc(bytes.len()) as *mut c_char;
+        std::ptr::copy_nonoverlapping(bytes.as_ptr() as *const c_char, copy, bytes.len());
+        copy
+    }
+}
+
+fn free_string(value: *mut c_char) {
+    HEAP_OPERATIONS.fetch_add(1, Ordering::Relaxed);
+    unsafe { libc::free(value as *mut libc::c_void) };
+}
+
+// What bm_acquire_projects and bm_release_projects do.
+fn acquire_and_release(projects: &[Project]) {
+    let acquired: Vec<ProjectStrings> = projects
+        .iter()
+        .map(|project| ProjectStrings {
+            folder_name: malloc_string(project.folder()),
+            project_name: malloc_string(project.name()),
+            url: malloc_string(project.url()),
+            culprits: project.culprits().iter().map(|culprit| malloc_string(culprit)).collect(),
+            volunteer: malloc_string(project.volunteer()),
+        })
+        .collect();
+    for project in black_box(acquired).into_iter() {
+        free_string(project.folder_name);
+        free_string(project.project_name);
+        free_string(project.url);
+        for culprit in project.culprits.into_iter() {
+            free_string(culprit);
+        }
+        free_string(project.volunteer);
+    }
+}
+
+// The average time and heap operations of running the function ITERATIONS times.
+fn measure(function: impl Fn()) -> (Duration, usize) {
+    let heap_operations = HEAP_OPERATIONS.load(Ordering::Relaxed);
+    let start = Instant::now();
+    for _ in 0..ITERATIONS {
+        function();
+    }
+    (start.elapsed() / ITERATIONS, (HEAP_OPERATIONS.load(Ordering::Relaxed) - heap_operations) / ITERATIONS as usize)
+}
+
+fn report(name: &str, (time, heap_operations): (Duration, usize)) {
+    println!("  {:<22} {:>9.2} ms {:>9} heap operations", name, time.as_secs_f64() * 1000.0, heap_operations);
+}
+
+fn main() {
+    let projects = load_projects();
+    let update = bincode::serialize(&projects).unwrap();
+    println!("{} projects, {} culprits", projects.len(), projects.iter().map(|project| project.culprits().len()).sum::<usize>());
+
+    let decode = || bincode::deserialize::<Vec<Project>>(&update).unwrap();
+    report("decode", measure(|| { black_box(decode()); }));
+    report("decode + ProjectsFFI", measure(|| acquire_and_release(&decode())));
+    report("decode + flat snapshot", measure(|| { black_box(encode_flat_snapshot(&decode())); }));
+
+    let decoded = decode();
+    report("ProjectsFFI", measure(|| acquire_and_release(&decoded)));
+    report("flat snapshot", measure(|| { black_box(encode_flat_snapshot(&decoded)); }));
+    println!("  {} bytes in the flat snapshot", encode_flat_snapshot(&decoded).len());
+}
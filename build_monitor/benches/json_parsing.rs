@@ -0,0 +1,140 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Compares building a json::JsonValue tree and reading the fields from it, which is how responses used to
+// be handled, against parsing straight into the jenkins_api types.
+//
+// Run with: cargo bench --bench json_parsing
+// Recorded responses can be used instead of the generated ones by pointing BUILD_MONITOR_FOLDER_PAYLOAD
+// at a folder listing (api/json?tree=jobs[...]) and BUILD_MONITOR_BUILD_PAYLOAD at a lastBuild/api/json.
+
+use build_monitor::jenkins_api::{self, Build, JobList};
+
+use std::hint::black_box;
+use std::time::{Duration, Instant};
+
+fn generate_build(number: u64, culprits: usize) -> String {
+    let culprits: Vec<String> = (0..culprits)
+        .map(|index| format!(
+            r#"{{"absoluteUrl":"https://jenkins/user/user{0}","fullName":"User Number {0}"}}"#, index))
+        .collect();
+    format!(concat!(r#"{{"_class":"hudson.model.FreeStyleBuild","actions":[{{"_class":"hudson.model.CauseAction","#,
+        r#""causes":[{{"_class":"hudson.triggers.SCMTrigger$SCMTriggerCause","shortDescription":"Started by an SCM change"}}]}},"#,
+        r#"{{}},{{"_class":"hudson.plugins.git.util.BuildData","buildsByBranchName":{{}},"lastBuiltRevision":{{"SHA1":"0123456789abcdef"}}}}],"#,
+        r##""artifacts":[],"building":false,"description":null,"displayName":"#{0}","duration":{1},"estimatedDuration":{2},"##,
+        r##""executor":null,"fullDisplayName":"Project #{0}","id":"{0}","keepLog":false,"number":{0},"queueId":{3},"##,
+        r#""result":"SUCCESS","timestamp":{4},"url":"https://jenkins/job/Folder/job/Project/{0}/","builtOn":"agent-01","#,
+        r#""changeSet":{{"_class":"hudson.plugins.git.GitChangeSetList","items":[],"kind":"git"}},"culprits":[{5}]}}"#),
+        number, 120000 + number, 118000 + number, 5000 + number, 1600000000000u64 + number, culprits.join(","))
+}
+
+fn generate_folder(jobs: usize) -> String {
+    let jobs: Vec<String> = (0..jobs)
+        .map(|index| format!(
+            concat!(r#"{{"_class":"hudson.model.FreeStyleProject","name":"Project{0}","#,
+                r#""url":"https://jenkins/job/Folder/job/Project{0}/","buildable":true,"lastBuild":{1},"#,
+                r#""lastSuccessfulBuild":{{"_class":"hudson.model.FreeStyleBuild","timestamp":1600000000000}},"#,
+                r#""lastCompletedBuild":{{"_class":"hudson.model.FreeStyleBuild","result":"SUCCESS"}}}}"#),
+            index, generate_build(index as u64, index % 4)))
+        .collect();
+    format!(r#"{{"_class":"com.cloudbees.hudson.plugins.folder.Folder","jobs":[{}]}}"#, jobs.join(","))
+}
+
+fn load_or_generate(variable: &str, generate: impl Fn() -> String) -> (String, Vec<u8>) {
+    match std::env::var(variable) {
+        Ok(path) => (path.clone(), std::fs::read(&path).expect("Failed to read the recorded payload.")),
+        Err(_) => ("generated".to_string(), generate().into_bytes()),
+    }
+}
+
+// Reads the same fields as the crawler does for every job in a folder.
+fn read_folder_json(body: &[u8]) -> usize {
+    let text = String::from_utf8(body.to_vec()).unwrap();
+    let json = json::parse(&text).unwrap();
+    let mut fields = 0;
+    for job in json["jobs"].members() {
+        fields += job["_class"].as_str().map_or(0, |_| 1);
+        fields += job["url"].as_str().map_or(0, |_| 1);
+        fields += job["name"].as_str().map_or(0, |_| 1);
+        fields += job["buildable"].as_bool().map_or(0, |_| 1);
+        fields += read_build_json(&job["lastBuild"]);
+        fields += job["lastSuccessfulBuild"]["timestamp"].as_u64().map_or(0, |_| 1);
+        fields += job["lastCompletedBuild"]["result"].as_str().map_or(0, |_| 1);
+    }
+    fields
+}
+
+fn read_build_json(build: &json::JsonValue) -> usize {
+    let mut fields = 0;
+    fields += build["number"].as_u64().map_or(0, |_| 1);
+    fields += build["building"].as_bool().map_or(0, |_| 1);
+    fields += build["result"].as_str().map_or(0, |_| 1);
+    fields += build["duration"].as_u64().map_or(0, |_| 1);
+    fields += build["estimatedDuration"].as_i64().map_or(0, |_| 1);
+    fields += build["timestamp"].as_u64().map_or(0, |_| 1);
+    for culprit in build["culprits"].members() {
+        fields += culprit["fullName"].as_str().map_or(0, |_| 1);
+    }
+    fields
+}
+
+fn read_folder_typed(body: &[u8]) -> usize {
+    let job_list: JobList = jenkins_api::parse(body).unwrap();
+    let mut fields = 0;
+    for job in job_list.jobs.iter() {
+        fields += 1;
+        fields += job.url.as_ref().map_or(0, |_| 1);
+        fields += job.name.as_ref().map_or(0, |_| 1);
+        fields += job.buildable.map_or(0, |_| 1);
+        fields += job.last_build.as_ref().map_or(0, read_build_typed);
+        fields += job.last_successful_build.as_ref().and_then(|build| build.timestamp).map_or(0, |_| 1);
+        fields += job.last_completed_build.as_ref().and_then(|build| build.result.as_ref()).map_or(0, |_| 1);
+    }
+    fields
+}
+
+fn read_build_typed(build: &Build) -> usize {
+    let mut fields = 0;
+    fields += build.number.map_or(0, |_| 1);
+    fields += build.building.map_or(0, |_| 1);
+    fields += build.result.as_ref().map_or(0, |_| 1);
+    fields += build.duration.map_or(0, |_| 1);
+    fields += build.estimated_duration.map_or(0, |_| 1);
+    fields += build.timestamp.map_or(0, |_| 1);
+    fields += build.culprits.len();
+    fields
+}
+
+fn measure(name: &str, body: &[u8], read: impl Fn(&[u8]) -> usize) -> Duration {
+    // Warm up, and make sure both paths agree on the amount of fields that were found.
+    let fields = read(body);
+
+    let start = Instant::now();
+    let mut iterations = 0u32;
+    while start.elapsed() < Duration::from_secs(2) {
+        black_box(read(black_box(body)));
+        iterations += 1;
+    }
+    let per_iteration = start.elapsed() / iterations;
+    let megabytes_per_second = body.len() as f64 / per_iteration.as_secs_f64() / (1024.0 * 1024.0);
+    println!("  {:<8} {:>10.3} ms/parse {:>10.1} MB/s ({} fields, {} iterations)",
+        name, per_iteration.as_secs_f64() * 1000.0, megabytes_per_second, fields, iterations);
+    per_iteration
+}
+
+fn compare(title: &str, source: &str, body: &[u8], read_json: impl Fn(&[u8]) -> usize, read_typed: impl Fn(&[u8]) -> usize) {
+    println!("{} ({}, {} bytes)", title, source, body.len());
+    assert_eq!(read_json(body), read_typed(body), "Both paths should read the same fields.");
+    let json_time = measure("json", body, read_json);
+    let typed_time = measure("typed", body, read_typed);
+    println!("  typed is {:.2}x the speed of json", json_time.as_secs_f64() / typed_time.as_secs_f64());
+}
+
+fn main() {
+    let (source, folder) = load_or_generate("BUILD_MONITOR_FOLDER_PAYLOAD", || generate_folder(5000));
+    compare("Folder listing", &source, &folder, read_folder_json, read_folder_typed);
+
+    let (source, build) = load_or_generate("BUILD_MONITOR_BUILD_PAYLOAD", || generate_build(1234, 3));
+    compare("Last build", &source, &build,
+        |body| read_build_json(&json::parse(&String::from_utf8(body.to_vec()).unwrap()).unwrap()),
+        |body| read_build_typed(&jenkins_api::parse::<Build>(body).unwrap()));
+}
@@ -0,0 +1,192 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Sends a server and a client datagrams that don't change anything, an update request while the
+// client has the latest projects and a project update with the projects the client already has, and
+// reports how many of them each handles per second and how many allocations that takes. On Linux the
+// process is pinned to one core, so the receiving thread shares it with the bench.
+//
+// Run with: cargo bench --bench receive_path > /dev/null
+// The server and client log every datagram to stdout, so the results go to stderr. The amount of
+// datagrams can be changed with BENCH_PACKETS, the size of the mock Jenkins with BENCH_FOLDERS and
+// BENCH_JOBS.
+
+use build_monitor::monitor::{CrawlMode, Header, MessageType, Monitor, ProjectUpdateRequest};
+use build_monitor::project::Project;
+use mock_jenkins::{MockJenkins, MockJenkinsConfig};
+
+use futures::executor::block_on;
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::net::UdpSocket;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::{Duration, Instant};
+
+const SERVER_ADDRESS: &str = "127.0.0.1:8096";
+// How many datagrams are sent before waiting for the answers.
+const BATCH_SIZE: usize = 32;
+
+// Counts every allocation of the process, of the bench and of the threads it measures.
+struct CountingAllocator;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAllocator = CountingAllocator;
+
+fn env_or<T: std::str::FromStr>(name: &str, default: T) -> T {
+    std::env::var(name).ok().and_then(|value| value.parse::<T>().ok()).unwrap_or(default)
+}
+
+#[cfg(target_os = "linux")]
+fn pin_to_one_core() {
+    unsafe {
+        let mut cpu_set: libc::cpu_set_t = std::mem::zeroed();
+        libc::CPU_SET(0, &mut cpu_set);
+        if libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &cpu_set) != 0 {
+            eprintln!("Failed to pin the bench to one core, the results include the other cores.");
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn pin_to_one_core() {}
+
+fn message(msg_type: MessageType, mut body: Vec<u8>) -> Vec<u8> {
+    let mut header = Header::new();
+    header.msg_type = msg_type;
+    header.msg_size = body.len() as u32;
+    let mut message = bincode::serialize(&header).unwrap();
+    message.append(&mut body);
+    message
+}
+
+fn project_update(projects: &Vec<Project>) -> Vec<u8> {
+    let mut body = bincode::serialize(projects).unwrap();
+    body.append(&mut bincode::serialize(&1u64).unwrap());
+    message(MessageType::ProjectUpdate, body)
+}
+
+fn report(name: &str, packets: usize, allocations: usize, elapsed: Duration) {
+    eprintln!("  {:<8} {:>8} packets in {:>8.1} ms, {:>8.0} packets/s, {:>6.2} allocations/packet",
+        name,
+        packets,
+        elapsed.as_secs_f64() * 1000.0,
+        packets as f64 / elapsed.as_secs_f64(),
+        allocations as f64 / packets as f64);
+}
+
+// Lets the server answer update requests of a client that already has its projects.
+fn bench_server(server_monitor: &Monitor, packets: usize) {
+    let projects_hash = Monitor::generate_projects_hash(&server_monitor.get_projects().read().unwrap());
+    let request = message(MessageType::ProjectUpdateRequest,
+        bincode::serialize(&ProjectUpdateRequest { projects_hash, sequence: 0, capabilities: 0 }).unwrap());
+    let client = UdpSocket::bind("127.0.0.1:0").unwrap();
+    client.connect(SERVER_ADDRESS).unwrap();
+    client.set_read_timeout(Some(Duration::from_secs(1))).unwrap();
+    let mut recv_buffer = vec![0; 64 * 1024];
+
+    let mut answered = 0;
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+    let start = Instant::now();
+    for _ in 0..packets / BATCH_SIZE {
+        for _ in 0..BATCH_SIZE {
+            client.send(&request).unwrap();
+        }
+        for _ in 0..BATCH_SIZE {
+            match client.recv(&mut recv_buffer) {
+                Ok(_) => answered += 1,
+                Err(_) => break,
+            }
+        }
+    }
+    let elapsed = start.elapsed();
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed) - allocations;
+    report("server", answered, allocations, elapsed);
+}
+
+// Sends the client updates with the projects it has, followed by one with other projects so the
+// bench knows when the client read the batch.
+fn bench_client(projects: &Vec<Project>, packets: usize) {
+    let server = UdpSocket::bind("127.0.0.1:0").unwrap();
+    let mut client_monitor = Monitor::new("");
+    client_monitor.start_client(&server.local_addr().unwrap().to_string(), "127.0.0.1:0", false).unwrap();
+    let mut recv_buffer = vec![0; 64 * 1024];
+    let (_, client_address) = server.recv_from(&mut recv_buffer).unwrap();
+
+    let mut other_projects = projects.clone();
+    other_projects[0].set_volunteer("volunteer");
+    let updates = [project_update(projects), project_update(&other_projects)];
+    let hashes = [Monitor::generate_projects_hash(projects), Monitor::generate_projects_hash(&other_projects)];
+    let mut current = 0;
+    let mut send_and_wait = |copies: usize, client_monitor: &mut Monitor| {
+        for _ in 0..copies {
+            server.send_to(&updates[current], client_address).unwrap();
+        }
+        current = 1 - current;
+        server.send_to(&updates[current], client_address).unwrap();
+        while Monitor::generate_projects_hash(&client_monitor.get_projects().read().unwrap()) != hashes[current] {
+            std::thread::sleep(Duration::from_micros(100));
+            block_on(client_monitor.refresh_projects()).unwrap();
+        }
+    };
+    send_and_wait(0, &mut client_monitor);
+
+    // The updates that change the projects are measured separately, and left out of the result.
+    let rounds = packets / BATCH_SIZE;
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+    let start = Instant::now();
+    for _ in 0..rounds {
+        send_and_wait(0, &mut client_monitor);
+    }
+    let change_elapsed = start.elapsed();
+    let change_allocations = ALLOCATIONS.load(Ordering::Relaxed) - allocations;
+
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+    let start = Instant::now();
+    for _ in 0..rounds {
+        send_and_wait(BATCH_SIZE, &mut client_monitor);
+    }
+    let elapsed = start.elapsed().saturating_sub(change_elapsed);
+    let allocations = (ALLOCATIONS.load(Ordering::Relaxed) - allocations).saturating_sub(change_allocations);
+    report("client", rounds * BATCH_SIZE, allocations, elapsed);
+    client_monitor.stop_client();
+}
+
+fn main() {
+    pin_to_one_core();
+    let config = MockJenkinsConfig {
+        folder_depth: 1,
+        folders_per_folder: env_or("BENCH_FOLDERS", 2),
+        jobs_per_folder: env_or("BENCH_JOBS", 10),
+        ..MockJenkinsConfig::default()
+    };
+    let packets: usize = env_or("BENCH_PACKETS", 20000);
+
+    let jenkins = MockJenkins::start("127.0.0.1:0", config).expect("Failed to start mock Jenkins.");
+    let mut server_monitor = Monitor::new(jenkins.url());
+    server_monitor.set_crawl_mode(CrawlMode::Bulk);
+    block_on(server_monitor.refresh_projects()).expect("Failed to crawl mock Jenkins.");
+    server_monitor.start_server(SERVER_ADDRESS, false).expect("Failed to start the server.");
+    std::thread::sleep(Duration::from_millis(100));
+
+    let projects = server_monitor.get_projects().read().unwrap().clone();
+    eprintln!("{} projects, {} byte project update", projects.len(), project_update(&projects).len());
+    bench_server(&server_monitor, packets);
+    bench_client(&projects, packets);
+    server_monitor.stop_server();
+}
@@ -0,0 +1,119 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Lets many clients ask a query server for all projects at once, like after a network outage, and
+// reports how many requests the server answers per second.
+//
+// Run with: cargo bench --bench server_throughput
+// The amount of clients and how often each of them asks can be changed with the BENCH_CLIENTS and
+// BENCH_ROUNDS environment variables, the size of the mock Jenkins with BENCH_FOLDERS and BENCH_JOBS.
+// BENCH_COMPRESSION=1 asks for compressed updates, BENCH_WORKERS sets how many threads the server
+// answers with.
+
+use build_monitor::monitor::{CrawlMode, Header, MessageType, Monitor, ProjectUpdateRequest};
+use mock_jenkins::{MockJenkins, MockJenkinsConfig};
+
+use futures::executor::block_on;
+use socket2::{Domain, Protocol, Socket, Type};
+use std::net::{SocketAddr, UdpSocket};
+use std::time::{Duration, Instant};
+
+const SERVER_ADDRESS: &str = "127.0.0.1:8095";
+
+fn env_or<T: std::str::FromStr>(name: &str, default: T) -> T {
+    std::env::var(name).ok().and_then(|value| value.parse::<T>().ok()).unwrap_or(default)
+}
+
+fn update_request(capabilities: u32) -> Vec<u8> {
+    // A hash the server never has, so it always answers with all projects.
+    let mut request = bincode::serialize(&ProjectUpdateRequest { projects_hash: 0, sequence: 0, capabilities }).unwrap();
+    let mut header = Header::new();
+    header.msg_type = MessageType::ProjectUpdateRequest;
+    header.msg_size = request.len() as u32;
+    let mut message = bincode::serialize(&header).unwrap();
+    message.append(&mut request);
+    message
+}
+
+// Receives one whole response, which may arrive in chunks. Returns its size, or None when the rest
+// didn't arrive in time.
+fn receive_response(socket: &UdpSocket, recv_buffer: &mut [u8]) -> Option<usize> {
+    let mut received_chunks = 0;
+    let mut size = 0;
+    loop {
+        let bytes_read = socket.recv(recv_buffer).ok()?;
+        size += bytes_read;
+        let (header, header_size) = Header::from_bytes(&recv_buffer[..bytes_read])?;
+        if header.msg_type != MessageType::ProjectChunk {
+            return Some(size);
+        }
+        let (_message_id, _chunk_index, chunk_count) =
+            bincode::deserialize::<(u64, u32, u32)>(&recv_buffer[header_size..bytes_read]).ok()?;
+        received_chunks += 1;
+        if received_chunks == chunk_count {
+            return Some(size);
+        }
+    }
+}
+
+fn main() {
+    let config = MockJenkinsConfig {
+        folder_depth: 1,
+        folders_per_folder: env_or("BENCH_FOLDERS", 4),
+        jobs_per_folder: env_or("BENCH_JOBS", 75),
+        ..MockJenkinsConfig::default()
+    };
+    let client_count: usize = env_or("BENCH_CLIENTS", 200);
+    let rounds: usize = env_or("BENCH_ROUNDS", 5);
+    let capabilities: u32 = env_or("BENCH_COMPRESSION", 0);
+    let workers: usize = env_or("BENCH_WORKERS", 1);
+
+    let jenkins = MockJenkins::start("127.0.0.1:0", config).expect("Failed to start mock Jenkins.");
+    let mut server_monitor = Monitor::new(jenkins.url());
+    server_monitor.set_crawl_mode(CrawlMode::Bulk);
+    block_on(server_monitor.refresh_projects()).expect("Failed to crawl mock Jenkins.");
+    server_monitor.set_server_workers(workers);
+    server_monitor.start_server(SERVER_ADDRESS, false).expect("Failed to start the server.");
+    std::thread::sleep(Duration::from_millis(100));
+
+    let clients: Vec<UdpSocket> = (0..client_count)
+        .map(|_| {
+            let socket = Socket::new(Domain::IPV4, Type::DGRAM, Some(Protocol::UDP)).unwrap();
+            // The clients are read one after the other, the others have to hold their whole response.
+            let _ = socket.set_recv_buffer_size(8 * 1024 * 1024);
+            socket.bind(&"127.0.0.1:0".parse::<SocketAddr>().unwrap().into()).unwrap();
+            let socket: UdpSocket = socket.into();
+            socket.set_read_timeout(Some(Duration::from_secs(1))).unwrap();
+            socket
+        })
+        .collect();
+    let request = update_request(capabilities);
+    let mut recv_buffer = vec![0; 64 * 1024];
+    let mut responses = 0;
+    let mut bytes = 0;
+    let start = Instant::now();
+    for _ in 0..rounds {
+        for client in clients.iter() {
+            client.send_to(&request, SERVER_ADDRESS).unwrap();
+        }
+        for client in clients.iter() {
+            match receive_response(client, &mut recv_buffer) {
+                Some(size) => {
+                    responses += 1;
+                    bytes += size;
+                }
+                None => {}
+            }
+        }
+    }
+    let elapsed = start.elapsed();
+    server_monitor.stop_server();
+
+    // The server logs every request to stdout, so the results go to stderr.
+    eprintln!("{} projects, {} clients, {} rounds, {} workers", jenkins.project_count(), client_count, rounds, workers);
+    eprintln!("  {} of {} requests answered in {:.1} ms, {:.0} requests/s, {:.1} MB/s",
+        responses,
+        client_count * rounds,
+        elapsed.as_secs_f64() * 1000.0,
+        responses as f64 / elapsed.as_secs_f64(),
+        bytes as f64 / elapsed.as_secs_f64() / (1024.0 * 1024.0));
+}
@@ -0,0 +1,86 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Compares the size of a ProjectUpdate and a CompressedProjectUpdate of the same projects, and how
+// long it takes to encode and decode them.
+//
+// Run with: cargo bench --bench wire_encoding
+// The projects are crawled from a local mock Jenkins, whose size can be changed with the BENCH_DEPTH,
+// BENCH_FOLDERS and BENCH_JOBS environment variables. A snapshot of a real Jenkins can be used instead
+// by pointing BUILD_MONITOR_SNAPSHOT at it.
+
+use build_monitor::monitor::{CrawlMode, Monitor};
+use build_monitor::project::Project;
+use build_monitor::project_encoding::{decode_projects, encode_projects};
+use mock_jenkins::{MockJenkins, MockJenkinsConfig};
+
+use futures::executor::block_on;
+use std::hint::black_box;
+use std::time::{Duration, Instant};
+
+const ITERATIONS: u32 = 20;
+
+fn env_or<T: std::str::FromStr>(name: &str, default: T) -> T {
+    std::env::var(name).ok().and_then(|value| value.parse::<T>().ok()).unwrap_or(default)
+}
+
+fn load_projects() -> (String, Vec<Project>) {
+    match std::env::var("BUILD_MONITOR_SNAPSHOT") {
+        Ok(path) => {
+            let mut monitor = Monitor::new("");
+            monitor.set_snapshot_path(&path);
+            assert!(monitor.load_snapshot().expect("Failed to read the snapshot."), "The snapshot is empty.");
+            let projects = monitor.get_projects().read().unwrap().clone();
+            (path, projects)
+        }
+        Err(_) => {
+            let config = MockJenkinsConfig {
+                folder_depth: env_or("BENCH_DEPTH", 2),
+                folders_per_folder: env_or("BENCH_FOLDERS", 8),
+                jobs_per_folder: env_or("BENCH_JOBS", 50),
+                ..MockJenkinsConfig::default()
+            };
+            let jenkins = MockJenkins::start("127.0.0.1:0", config).expect("Failed to start mock Jenkins.");
+            let mut monitor = Monitor::new(jenkins.url());
+            monitor.set_crawl_mode(CrawlMode::Bulk);
+            block_on(monitor.refresh_projects()).expect("Failed to crawl mock Jenkins.");
+            let projects = monitor.get_projects().read().unwrap().clone();
+            ("mock Jenkins".to_string(), projects)
+        }
+    }
+}
+
+// The average time of running the function ITERATIONS times.
+fn time<T>(function: impl Fn() -> T) -> Duration {
+    let start = Instant::now();
+    for _ in 0..ITERATIONS {
+        black_box(function());
+    }
+    start.elapsed() / ITERATIONS
+}
+
+fn report(name: &str, size: usize, full_size: usize, encode: Duration, decode: Duration) {
+    println!("  {:<11} {:>10} bytes {:>6.2}x {:>9.2} ms encode {:>9.2} ms decode",
+        name,
+        size,
+        full_size as f64 / size as f64,
+        encode.as_secs_f64() * 1000.0,
+        decode.as_secs_f64() * 1000.0);
+}
+
+fn main() {
+    let (source, projects) = load_projects();
+    println!("{} projects from {}", projects.len(), source);
+
+    let serialized = bincode::serialize(&projects).unwrap();
+    let serialize_time = time(|| bincode::serialize(&projects).unwrap());
+    let deserialize_time = time(|| bincode::deserialize::<Vec<Project>>(&serialized).unwrap());
+    report("bincode", serialized.len(), serialized.len(), serialize_time, deserialize_time);
+
+    let encoded = encode_projects(&projects);
+    let encode_time = time(|| encode_projects(&projects));
+    let decode_time = time(|| decode_projects(&encoded).unwrap());
+    report("compressed", encoded.len(), serialized.len(), encode_time, decode_time);
+
+    let decoded = decode_projects(&encoded).unwrap();
+    assert_eq!(Monitor::generate_projects_hash(&decoded), Monitor::generate_projects_hash(&projects));
+}
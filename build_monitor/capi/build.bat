@@ -13,5 +13,6 @@ if not exist include (
 echo #pragma once > include\build_monitor.h
 echo. >> include\build_monitor.h
 cbindgen >> include\build_monitor.h
+copy /Y build_monitor_snapshot.h include\ > nul
 
 popd
\ No newline at end of file
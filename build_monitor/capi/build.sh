@@ -11,5 +11,6 @@ fi
 echo "#pragma once" > include/build_monitor.h
 echo "" >> include/build_monitor.h
 cbindgen >> include/build_monitor.h
+cp build_monitor_snapshot.h include/
 
 popd
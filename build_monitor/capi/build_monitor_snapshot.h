@@ -0,0 +1,157 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Reads the projects of a snapshot in the layout of build_monitor/src/flat_snapshot.rs, in place. The
+// accessors only point into the snapshot, which has to outlive them. The strings are UTF-8 and followed
+// by a 0, so data() of a string is also a C string. Assumes a little endian host, like the snapshot.
+
+#pragma once
+
+#include "build_monitor.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace build_monitor
+{
+	constexpr uint32_t SnapshotMagic = 0x53534D42; // "BMSS"
+	constexpr uint32_t SnapshotVersion = 1;
+	constexpr size_t SnapshotHeaderSize = 32;
+	constexpr size_t SnapshotProjectSize = 88;
+	constexpr size_t SnapshotStringSize = 8;
+
+	namespace detail
+	{
+		// The snapshot doesn't have to be aligned, memcpy compiles to a plain load anyway.
+		template<typename T>
+		T Load(const uint8_t* data, size_t offset)
+		{
+			T value;
+			std::memcpy(&value, data + offset, sizeof(T));
+			return value;
+		}
+
+		inline std::string_view LoadString(const uint8_t* strings, const uint8_t* reference)
+		{
+			return std::string_view(reinterpret_cast<const char*>(strings + Load<uint32_t>(reference, 0)),
+				Load<uint32_t>(reference, 4));
+		}
+
+		// Whether the string and its 0 lie within the strings section.
+		inline bool IsValidString(const uint8_t* strings, uint32_t stringsSize, const uint8_t* reference)
+		{
+			const uint64_t end = uint64_t(Load<uint32_t>(reference, 0)) + uint64_t(Load<uint32_t>(reference, 4));
+			return end < stringsSize && strings[end] == 0;
+		}
+	}
+
+	class SnapshotProject
+	{
+	public:
+		SnapshotProject(const uint8_t* record, const uint8_t* culprits, const uint8_t* strings) :
+			record(record),
+			culprits(culprits),
+			strings(strings)
+		{
+		}
+
+		uint64_t id() const { return detail::Load<uint64_t>(record, 0); }
+		uint64_t lastSuccessfulBuildTime() const { return detail::Load<uint64_t>(record, 8); }
+		uint64_t duration() const { return detail::Load<uint64_t>(record, 16); }
+		uint64_t estimatedDuration() const { return detail::Load<uint64_t>(record, 24); }
+		uint64_t timestamp() const { return detail::Load<uint64_t>(record, 32); }
+		std::string_view folderName() const { return detail::LoadString(strings, record + 40); }
+		std::string_view projectName() const { return detail::LoadString(strings, record + 48); }
+		std::string_view url() const { return detail::LoadString(strings, record + 56); }
+		std::string_view volunteer() const { return detail::LoadString(strings, record + 64); }
+		ProjectStatusFFI status() const { return static_cast<ProjectStatusFFI>(record[80]); }
+		bool isBuilding() const { return record[81] != 0; }
+
+		uint32_t culpritCount() const { return detail::Load<uint32_t>(record, 76); }
+		std::string_view culprit(uint32_t index) const
+		{
+			const uint32_t firstCulprit = detail::Load<uint32_t>(record, 72);
+			return detail::LoadString(strings, culprits + (size_t(firstCulprit) + index) * SnapshotStringSize);
+		}
+
+	private:
+		const uint8_t* record;
+		const uint8_t* culprits;
+		const uint8_t* strings;
+	};
+
+	class SnapshotView
+	{
+	public:
+		SnapshotView() :
+			data(nullptr),
+			size(0)
+		{
+		}
+
+		SnapshotView(const void* data, size_t size) :
+			data(static_cast<const uint8_t*>(data)),
+			size(size)
+		{
+		}
+
+		// Whether the snapshot has a version this reader knows, its sections fit in it, and the strings and
+		// culprits of its projects lie within their sections. Only a valid snapshot may be read.
+		bool isValid() const
+		{
+			if (data == nullptr || size < SnapshotHeaderSize ||
+				detail::Load<uint32_t>(data, 0) != SnapshotMagic || detail::Load<uint32_t>(data, 4) != SnapshotVersion)
+			{
+				return false;
+			}
+			const uint32_t culpritCount = detail::Load<uint32_t>(data, 12);
+			const uint32_t stringsSize = detail::Load<uint32_t>(data, 28);
+			const uint64_t projectsEnd = uint64_t(section(16)) + uint64_t(projectCount()) * SnapshotProjectSize;
+			const uint64_t culpritsEnd = uint64_t(section(20)) + uint64_t(culpritCount) * SnapshotStringSize;
+			const uint64_t stringsEnd = uint64_t(section(24)) + uint64_t(stringsSize);
+			if (projectsEnd > size || culpritsEnd > size || stringsEnd > size)
+			{
+				return false;
+			}
+
+			const uint8_t* strings = data + section(24);
+			for (uint32_t index = 0; index < projectCount(); ++index)
+			{
+				const uint8_t* record = data + section(16) + size_t(index) * SnapshotProjectSize;
+				for (size_t reference = 40; reference <= 64; reference += SnapshotStringSize)
+				{
+					if (!detail::IsValidString(strings, stringsSize, record + reference))
+					{
+						return false;
+					}
+				}
+				if (uint64_t(detail::Load<uint32_t>(record, 72)) + uint64_t(detail::Load<uint32_t>(record, 76)) > culpritCount)
+				{
+					return false;
+				}
+			}
+			for (uint32_t index = 0; index < culpritCount; ++index)
+			{
+				if (!detail::IsValidString(strings, stringsSize, data + section(20) + size_t(index) * SnapshotStringSize))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		uint32_t projectCount() const { return detail::Load<uint32_t>(data, 8); }
+
+		SnapshotProject project(uint32_t index) const
+		{
+			return SnapshotProject(data + section(16) + size_t(index) * SnapshotProjectSize, data + section(20), data + section(24));
+		}
+
+	private:
+		uint32_t section(size_t offset) const { return detail::Load<uint32_t>(data, offset); }
+
+		const uint8_t* data;
+		size_t size;
+	};
+}
@@ -1,12 +1,14 @@
 // Copyright Sander Brattinga. All rights reserved.
 
 use libc::*;
+use build_monitor::flat_snapshot::{encode_flat_snapshot, FlatSnapshot};
 use build_monitor::project;
 use std::ffi::CStr;
 use std::ffi::CString;
 use std::ffi::c_void;
 use std::os::raw::c_char;
 use std::slice;
+use std::time::Duration;
 
 #[repr(C)]
 pub enum ProjectStatusFFI {
@@ -36,6 +38,26 @@ pub struct ProjectsFFI {
     volunteer: *mut c_char,
 }
 
+// The projects of bm_acquire_snapshot. Their strings point into the flat snapshot, which holds all
+// projects in one allocation, so releasing the snapshot is a few frees however many projects it has.
+struct ProjectsSnapshot {
+    arena: Vec<u8>,
+    culprits: Vec<*mut c_char>,
+    projects: Vec<ProjectsFFI>,
+}
+
+fn status_to_ffi(status: project::ProjectStatus) -> ProjectStatusFFI {
+    match status {
+        project::ProjectStatus::Success => ProjectStatusFFI::Success,
+        project::ProjectStatus::Unstable => ProjectStatusFFI::Unstable,
+        project::ProjectStatus::Failed => ProjectStatusFFI::Failed,
+        project::ProjectStatus::NotBuilt => ProjectStatusFFI::NotBuilt,
+        project::ProjectStatus::Aborted => ProjectStatusFFI::Aborted,
+        project::ProjectStatus::Disabled => ProjectStatusFFI::Disabled,
+        project::ProjectStatus::Unknown => ProjectStatusFFI::Unknown,
+    }
+}
+
 #[cfg(windows)]
 pub fn output_debug_string(s: &str) {
     let len = s.encode_utf16().count() + 1;
@@ -162,6 +184,8 @@ pub extern "C" fn bm_get_num_projects(handle: *mut std::ffi::c_void) -> u32 {
     return result;
 }
 
+// Copies every string of the projects, which bm_release_projects frees again. Fails when the number of
+// projects changed since bm_get_num_projects, bm_acquire_snapshot takes them all under one lock instead.
 #[no_mangle]
 pub extern "C" fn bm_acquire_projects(
     handle: *mut std::ffi::c_void,
@@ -206,15 +230,7 @@ pub extern "C" fn bm_acquire_projects(
                     (*entry).url = std::mem::transmute(malloc(len));
                     memcpy((*entry).url as *mut c_void, ptr as *const c_void, len);
                 }
-                entry.status = match projects[index].status() {
-                    project::ProjectStatus::Success => ProjectStatusFFI::Success,
-                    project::ProjectStatus::Unstable => ProjectStatusFFI::Unstable,
-                    project::ProjectStatus::Failed => ProjectStatusFFI::Failed,
-                    project::ProjectStatus::NotBuilt => ProjectStatusFFI::NotBuilt,
-                    project::ProjectStatus::Aborted => ProjectStatusFFI::Aborted,
-                    project::ProjectStatus::Disabled => ProjectStatusFFI::Disabled,
-                    project::ProjectStatus::Unknown => ProjectStatusFFI::Unknown,
-                };
+                entry.status = status_to_ffi(projects[index].status());
                 entry.is_building = projects[index].is_building();
                 entry.last_successful_build_time = projects[index].last_successful_build_time();
                 entry.duration = projects[index].duration();
@@ -277,6 +293,80 @@ pub extern "C" fn bm_release_projects(
     }
 }
 
+// Takes all projects at once, under the same lock. The projects of bm_snapshot_projects and the data of
+// bm_snapshot_data stay valid until the snapshot is released with bm_release_snapshot.
+#[no_mangle]
+pub extern "C" fn bm_acquire_snapshot(handle: *mut std::ffi::c_void) -> *mut std::ffi::c_void {
+    let monitor = unsafe { &*(handle as *const build_monitor::monitor::Monitor) };
+    let arena = encode_flat_snapshot(&monitor.get_projects().read().unwrap());
+
+    let mut snapshot = Box::new(ProjectsSnapshot {
+        arena,
+        culprits: Vec::new(),
+        projects: Vec::new(),
+    });
+    let flat_snapshot = FlatSnapshot::new(&snapshot.arena).unwrap();
+    // Every culprit is added before the projects point into them, so the culprits don't move anymore.
+    snapshot.culprits.reserve_exact(flat_snapshot.culprit_count());
+    for index in 0..flat_snapshot.project_count() {
+        let project = flat_snapshot.project(index);
+        snapshot.culprits.extend(project.culprits().map(|culprit| culprit.as_ptr() as *mut c_char));
+    }
+    snapshot.projects.reserve_exact(flat_snapshot.project_count());
+    let mut culprits = snapshot.culprits.as_mut_ptr();
+    for index in 0..flat_snapshot.project_count() {
+        let project = flat_snapshot.project(index);
+        let culprits_num = project.culprits().count();
+        snapshot.projects.push(ProjectsFFI {
+            id: project.id(),
+            folder_name: project.folder().as_ptr() as *mut c_char,
+            project_name: project.name().as_ptr() as *mut c_char,
+            url: project.url().as_ptr() as *mut c_char,
+            status: status_to_ffi(project.status()),
+            is_building: project.is_building(),
+            last_successful_build_time: project.last_successful_build_time(),
+            duration: project.duration(),
+            estimated_duration: project.estimated_duration(),
+            timestamp: project.timestamp(),
+            culprits,
+            culprits_num: culprits_num as u64,
+            volunteer: project.volunteer().as_ptr() as *mut c_char,
+        });
+        culprits = unsafe { culprits.add(culprits_num) };
+    }
+    Box::into_raw(snapshot) as *mut std::ffi::c_void
+}
+
+#[no_mangle]
+pub extern "C" fn bm_snapshot_num_projects(snapshot: *const std::ffi::c_void) -> u32 {
+    let snapshot = unsafe { &*(snapshot as *const ProjectsSnapshot) };
+    snapshot.projects.len() as u32
+}
+
+// The projects of the snapshot, as bm_acquire_projects would return them. They can't be released on
+// their own.
+#[no_mangle]
+pub extern "C" fn bm_snapshot_projects(snapshot: *const std::ffi::c_void) -> *const ProjectsFFI {
+    let snapshot = unsafe { &*(snapshot as *const ProjectsSnapshot) };
+    snapshot.projects.as_ptr()
+}
+
+// The flat snapshot the projects are read from, for build_monitor::SnapshotView of
+// build_monitor_snapshot.h.
+#[no_mangle]
+pub extern "C" fn bm_snapshot_data(snapshot: *const std::ffi::c_void, size: *mut u64) -> *const u8 {
+    let snapshot = unsafe { &*(snapshot as *const ProjectsSnapshot) };
+    unsafe { *size = snapshot.arena.len() as u64 };
+    snapshot.arena.as_ptr()
+}
+
+#[no_mangle]
+pub extern "C" fn bm_release_snapshot(snapshot: *mut std::ffi::c_void) {
+    unsafe {
+        drop(Box::from_raw(snapshot as *mut ProjectsSnapshot));
+    }
+}
+
 #[no_mangle]
 pub extern "C" fn bm_has_projects(handle: *mut std::ffi::c_void) -> bool {
     let monitor = unsafe { Box::from_raw(handle as *mut build_monitor::monitor::Monitor) };
@@ -292,3 +382,24 @@ pub extern "C" fn bm_set_volunteer(handle: *mut std::ffi::c_void, project_id: u6
     Box::into_raw(monitor);
 }
 
+// Whether the projects may be out of date, because the client didn't hear from its server for the max
+// staleness, or didn't hear from it at all yet.
+#[no_mangle]
+pub extern "C" fn bm_is_stale(handle: *mut std::ffi::c_void) -> bool {
+    let monitor = unsafe { &*(handle as *const build_monitor::monitor::Monitor) };
+    monitor.is_stale()
+}
+
+// In milliseconds, how long the client hasn't heard from its server, or u64::MAX when it didn't hear
+// from it yet.
+#[no_mangle]
+pub extern "C" fn bm_client_silence(handle: *mut std::ffi::c_void) -> u64 {
+    let monitor = unsafe { &*(handle as *const build_monitor::monitor::Monitor) };
+    monitor.client_silence().map_or(u64::MAX, |silence| silence.as_millis().min(u64::MAX as u128) as u64)
+}
+
+#[no_mangle]
+pub extern "C" fn bm_set_max_staleness(handle: *mut std::ffi::c_void, seconds: u32) {
+    let monitor = unsafe { &mut *(handle as *mut build_monitor::monitor::Monitor) };
+    monitor.set_max_staleness(Duration::from_secs(seconds as u64));
+}
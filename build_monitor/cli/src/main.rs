@@ -1,14 +1,153 @@
 // Copyright Sander Brattinga. All rights reserved.
 
-use build_monitor::monitor::Monitor;
+use build_monitor::monitor::{CrawlMode, Monitor};
 
 use futures::executor::block_on;
 use std::env;
+use std::net::ToSocketAddrs;
 use std::thread::sleep;
-use std::time::{Duration, SystemTime};
+use std::time::{Duration, Instant, SystemTime};
 
-fn retrieve_info(address: &str) {
-    let mut monitor = Monitor::new(address); 
+struct Options {
+    max_concurrent_requests: Option<usize>,
+    crawl_mode: Option<CrawlMode>,
+    snapshot_path: Option<String>,
+    topology_refresh_interval: Option<Duration>,
+    request_timeout: Option<Duration>,
+    crawl_deadline: Option<Duration>,
+    events_address: Option<String>,
+    server_workers: Option<usize>,
+    max_staleness: Option<Duration>,
+}
+
+// Removes the '--name value' pair at index from the arguments and returns the value.
+fn take_option_value(args: &mut Vec<String>, index: usize) -> Result<String, String> {
+    if index + 1 >= args.len() {
+        return Err(format!("Missing value for '{}'.", args[index]));
+    }
+    let value = args.remove(index + 1);
+    args.remove(index);
+    Ok(value)
+}
+
+// Removes the optional '--name value' pairs from the arguments, so only the positional arguments remain.
+fn take_options(args: &mut Vec<String>) -> Result<Options, String> {
+    let mut options = Options {
+        max_concurrent_requests: None,
+        crawl_mode: None,
+        snapshot_path: None,
+        topology_refresh_interval: None,
+        request_timeout: None,
+        crawl_deadline: None,
+        events_address: None,
+        server_workers: None,
+        max_staleness: None,
+    };
+
+    let mut index = 0;
+    while index < args.len() {
+        if args[index] == "--concurrency" {
+            let value = take_option_value(args, index)?;
+            options.max_concurrent_requests = match value.parse::<usize>() {
+                Ok(value) => Some(value),
+                Err(_) => return Err(format!("Invalid value '{}' for '--concurrency'.", value)),
+            };
+        }
+        else if args[index] == "--crawl-mode" {
+            let value = take_option_value(args, index)?;
+            options.crawl_mode = match value.as_str() {
+                "per-project" => Some(CrawlMode::PerProject),
+                "bulk" => Some(CrawlMode::Bulk),
+                _ => return Err(format!("Invalid value '{}' for '--crawl-mode'.", value)),
+            };
+        }
+        else if args[index] == "--snapshot" {
+            options.snapshot_path = Some(take_option_value(args, index)?);
+        }
+        else if args[index] == "--topology-refresh" {
+            let value = take_option_value(args, index)?;
+            options.topology_refresh_interval = match value.parse::<u64>() {
+                Ok(value) => Some(Duration::from_secs(value)),
+                Err(_) => return Err(format!("Invalid value '{}' for '--topology-refresh'.", value)),
+            };
+        }
+        else if args[index] == "--request-timeout" {
+            let value = take_option_value(args, index)?;
+            options.request_timeout = match value.parse::<u64>() {
+                Ok(value) => Some(Duration::from_secs(value)),
+                Err(_) => return Err(format!("Invalid value '{}' for '--request-timeout'.", value)),
+            };
+        }
+        else if args[index] == "--crawl-deadline" {
+            let value = take_option_value(args, index)?;
+            options.crawl_deadline = match value.parse::<u64>() {
+                Ok(value) => Some(Duration::from_secs(value)),
+                Err(_) => return Err(format!("Invalid value '{}' for '--crawl-deadline'.", value)),
+            };
+        }
+        else if args[index] == "--events" {
+            options.events_address = Some(take_option_value(args, index)?);
+        }
+        else if args[index] == "--workers" {
+            let value = take_option_value(args, index)?;
+            options.server_workers = match value.parse::<usize>() {
+                Ok(value) if value > 0 => Some(value),
+                _ => return Err(format!("Invalid value '{}' for '--workers'.", value)),
+            };
+        }
+        else if args[index] == "--max-staleness" {
+            let value = take_option_value(args, index)?;
+            options.max_staleness = match value.parse::<u64>() {
+                Ok(value) if value > 0 => Some(Duration::from_secs(value)),
+                _ => return Err(format!("Invalid value '{}' for '--max-staleness'.", value)),
+            };
+        }
+        else {
+            index += 1;
+        }
+    }
+
+    Ok(options)
+}
+
+fn apply_options(monitor: &mut Monitor, options: &Options) {
+    match options.max_concurrent_requests {
+        Some(max_concurrent_requests) => monitor.set_max_concurrent_requests(max_concurrent_requests),
+        None => {}
+    }
+    match options.crawl_mode {
+        Some(crawl_mode) => monitor.set_crawl_mode(crawl_mode),
+        None => {}
+    }
+    match &options.snapshot_path {
+        Some(snapshot_path) => monitor.set_snapshot_path(snapshot_path),
+        None => {}
+    }
+    match options.topology_refresh_interval {
+        Some(topology_refresh_interval) => monitor.set_topology_refresh_interval(topology_refresh_interval),
+        None => {}
+    }
+    match options.request_timeout {
+        Some(request_timeout) => monitor.set_request_timeout(request_timeout),
+        None => {}
+    }
+    match options.crawl_deadline {
+        Some(crawl_deadline) => monitor.set_crawl_deadline(crawl_deadline),
+        None => {}
+    }
+    match options.server_workers {
+        Some(server_workers) => monitor.set_server_workers(server_workers),
+        None => {}
+    }
+    match options.max_staleness {
+        Some(max_staleness) => monitor.set_max_staleness(max_staleness),
+        None => {}
+    }
+}
+
+fn retrieve_info(address: &str, options: &Options) {
+    let mut monitor = Monitor::new(address);
+    apply_options(&mut monitor, options);
     match block_on(monitor.refresh_projects()) {
         Ok(has_projects) => {
             if has_projects {
@@ -19,9 +158,16 @@ fn retrieve_info(address: &str) {
     }
 }
 
-fn client(address: &str) -> Result<(), String> {
+fn client(address: &str, stream: bool, options: &Options) -> Result<(), String> {
     let mut monitor = Monitor::new("");
-    monitor.start_client(address, "0.0.0.0:8091", false)?;
+    apply_options(&mut monitor, options);
+    if stream {
+        monitor.start_stream_client(address)?;
+    }
+    else {
+        monitor.start_client(address, "0.0.0.0:8091", false)?;
+    }
+    let mut was_stale = false;
     loop {
         {
             match block_on(monitor.refresh_projects()) {
@@ -34,24 +180,63 @@ fn client(address: &str) -> Result<(), String> {
             }
         }
 
+        let is_stale = monitor.is_stale() && !monitor.get_projects().read().unwrap().is_empty();
+        if is_stale && !was_stale {
+            println!("Didn't hear from {} in {} seconds, the projects above may be out of date.", address, monitor.max_staleness().as_secs());
+        }
+        else if !is_stale && was_stale {
+            println!("Hearing from {} again.", address);
+        }
+        was_stale = is_stale;
+
         sleep(Duration::from_millis(500));
     }
 }
 
-fn server(jenkins_address: &str, address: &str) -> Result<(), String> {
+fn server(jenkins_address: &str, address: &str, options: &Options) -> Result<(), String> {
     let mut monitor = Monitor::new(jenkins_address);
+    apply_options(&mut monitor, options);
+    let has_snapshot = match monitor.load_snapshot() {
+        Ok(has_snapshot) => has_snapshot,
+        Err(e) => {
+            eprintln!("Failed to load snapshot. Error: {}", e);
+            false
+        }
+    };
+    // With a snapshot the clients can be served while the first crawl is still running.
+    if has_snapshot {
+        println!("Starting server with {} projects from the snapshot...", monitor.get_projects().read().unwrap().len());
+        monitor.start_server(address, false)?;
+    }
     println!("Refreshing initial projects...");
     match block_on(monitor.refresh_projects()) {
         Ok(_) => {}
         Err(e) => eprintln!("Failed to refresh projects. Error: {}", e),
     }
-    println!("Starting server...");
-    monitor.start_server(address, false)?;
+    if !has_snapshot {
+        println!("Starting server...");
+        monitor.start_server(address, false)?;
+    }
+    match &options.events_address {
+        Some(events_address) => {
+            println!("Receiving build notifications on {}...", events_address);
+            monitor.start_event_receiver(events_address)?;
+        }
+        None => {}
+    }
 
+    // Notified projects are refreshed right away, the full refresh catches everything else.
     let mut elapsed_time: Duration = Duration::new(10, 0);
     loop {
         if elapsed_time.as_secs_f32() < 10.0f32 {
-            sleep(Duration::new(10, 0) - elapsed_time);
+            let wait_until = Instant::now() + (Duration::new(10, 0) - elapsed_time);
+            let mut now = Instant::now();
+            while now < wait_until {
+                if monitor.refresh_notified_projects(wait_until - now) {
+                    println!("Refreshed notified projects.");
+                }
+                now = Instant::now();
+            }
         }
         let start_time = SystemTime::now();
         match block_on(monitor.refresh_projects()) {
@@ -59,35 +244,112 @@ fn server(jenkins_address: &str, address: &str) -> Result<(), String> {
             Err(e) => eprintln!("Failed to refresh projects. Error: {}", e),
         }
         elapsed_time = start_time.elapsed().unwrap_or(Duration::new(999, 0));
+        let cache_statistics = monitor.cache_statistics();
+        let crawl_health = monitor.crawl_health();
         println!(
-            "Refreshing projects took {} seconds.",
-            elapsed_time.as_secs_f32()
+            "Refreshing projects took {} seconds. Cache hits: {}, misses: {}, downloaded: {} bytes. Failed: {}, skipped: {}.",
+            elapsed_time.as_secs_f32(),
+            cache_statistics.hits,
+            cache_statistics.misses,
+            cache_statistics.bytes_downloaded,
+            crawl_health.failed,
+            crawl_health.skipped
         );
     }
 }
 
+fn is_multicast(address: &str) -> bool {
+    match address.to_socket_addrs().ok().and_then(|mut addresses| addresses.next()) {
+        Some(address) => address.ip().is_multicast(),
+        None => false,
+    }
+}
+
+// Serves the projects of another server to the clients on this network, without crawling Jenkins.
+// The server is only started once the first projects arrived, and stopped when the other server
+// wasn't heard from for too long, so the clients never get projects that are older than that. Its
+// clients then stop hearing from the relay, and show their projects as stale after their own max
+// staleness.
+fn relay(upstream_address: &str, address: &str, options: &Options) -> Result<(), String> {
+    let mut monitor = Monitor::new("");
+    apply_options(&mut monitor, options);
+    // A multicast server is listened to, any other server pushes the projects over a stream as soon as
+    // they change.
+    if is_multicast(upstream_address) {
+        monitor.start_client(upstream_address, upstream_address, true)?;
+    }
+    else {
+        monitor.start_stream_client(upstream_address)?;
+    }
+    let mut serving = false;
+    println!("Waiting for the projects of {}...", upstream_address);
+    loop {
+        if monitor.refresh_received_projects(Duration::from_secs(1)) {
+            println!("Relaying {} projects.", monitor.get_projects().read().unwrap().len());
+        }
+
+        let is_fresh = !monitor.is_stale();
+        if is_fresh && !serving && !monitor.get_projects().read().unwrap().is_empty() {
+            println!("Starting server...");
+            monitor.start_server(address, is_multicast(address))?;
+            serving = true;
+        }
+        else if !is_fresh && serving {
+            println!("Didn't hear from {} in {} seconds, stopping the server.", upstream_address, monitor.max_staleness().as_secs());
+            monitor.stop_server();
+            serving = false;
+        }
+    }
+}
+
 fn main() {
-    let help_message = "Please specify '--retrieveinfo', '--client' or '--server' on the commandline args.";
+    let help_message = concat!("Please specify '--retrieveinfo', '--client', '--stream-client', '--server' or '--relay' on the commandline args.\n",
+        "Optional: '--concurrency {max_concurrent_requests}' to limit the parallel requests to Jenkins.\n",
+        "Optional: '--crawl-mode {per-project|bulk}' to request the status of all projects in a folder at once.\n",
+        "Optional: '--snapshot {path}' to store the projects on disk and serve them right away after a restart.\n",
+        "Optional: '--topology-refresh {seconds}' to change how often the server searches for new folders.\n",
+        "Optional: '--request-timeout {seconds}' and '--crawl-deadline {seconds}' to limit how long a request and a refresh may take.\n",
+        "Optional: '--events {address}' to refresh projects as soon as Jenkins posts a build notification to the server.\n",
+        "Optional: '--workers {count}' to answer the clients of a server without multicast on several threads.\n",
+        "Optional: '--max-staleness {seconds}' to change how long a relay keeps serving, and a client shows its projects as current, after they last heard from their server.");
 
-    let args: Vec<String> = env::args().collect();
+    let mut args: Vec<String> = env::args().collect();
+    let options = match take_options(&mut args) {
+        Ok(options) => options,
+        Err(e) => {
+            eprintln!("{}", e);
+            return;
+        }
+    };
     if args.len() < 2 {
         println!("{}", help_message);
     }
     else {
         if args[1] == "--retrieveinfo" {
             if args.len() != 3 {
-                println!("Usage build_monitor_cli.exe --retrieveinfo {{url_to_buildserver}}");
+                println!("Usage build_monitor_cli.exe --retrieveinfo {{url_to_buildserver}} [--concurrency {{max_concurrent_requests}}] [--crawl-mode {{per-project|bulk}}]");
             }
             else {
-                retrieve_info(&args[2]);
+                retrieve_info(&args[2], &options);
             }
         }
         else if args[1] == "--client" {
             if args.len() != 3 {
-                println!("Usage build_monitor_cli.exe --client {{address}}");
+                println!("Usage build_monitor_cli.exe --client {{address}} [--max-staleness {{seconds}}]");
+            }
+            else {
+                match client(&args[2], false, &options) {
+                    Ok(()) => {},
+                    Err(e) => eprintln!("Failed to start client: {}", e)
+                }
+            }
+        }
+        else if args[1] == "--stream-client" {
+            if args.len() != 3 {
+                println!("Usage build_monitor_cli.exe --stream-client {{address}} [--max-staleness {{seconds}}]");
             }
             else {
-                match client(&args[2]) {
+                match client(&args[2], true, &options) {
                     Ok(()) => {},
                     Err(e) => eprintln!("Failed to start client: {}", e)
                 }
@@ -95,15 +357,26 @@ fn main() {
         }
         else if args[1] == "--server" {
             if args.len() != 4 {
-                println!("Usage build_monitor_cli.exe --server {{url_to_buildserver}} {{address}}");
+                println!("Usage build_monitor_cli.exe --server {{url_to_buildserver}} {{address}} [--concurrency {{max_concurrent_requests}}] [--crawl-mode {{per-project|bulk}}] [--snapshot {{path}}] [--topology-refresh {{seconds}}] [--request-timeout {{seconds}}] [--crawl-deadline {{seconds}}] [--events {{address}}] [--workers {{count}}]");
             }
             else {
-                match server(&args[2], &args[3]) {
+                match server(&args[2], &args[3], &options) {
                     Ok(()) => {},
                     Err(e) => eprintln!("Failed to start server: {}", e)
                 }
             }
         }
+        else if args[1] == "--relay" {
+            if args.len() != 4 {
+                println!("Usage build_monitor_cli.exe --relay {{server_address}} {{address}} [--max-staleness {{seconds}}] [--workers {{count}}]");
+            }
+            else {
+                match relay(&args[2], &args[3], &options) {
+                    Ok(()) => {},
+                    Err(e) => eprintln!("Failed to start relay: {}", e)
+                }
+            }
+        }
         else
         {
             println!("{}", help_message);
@@ -0,0 +1,387 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Simulated clients that speak the protocol of MonitorClient, many of them on one thread. They only
+// keep the hash and sequence of the projects they received, which is all they need to ask the server
+// for updates the way the real client does.
+
+use build_monitor::chunked_message::{Reassembler, MAX_RECEIVE_SIZE};
+use build_monitor::monitor::{
+    deserialize_project_update, serialize_message, split_compressed_project_update, Header, MessageType, Monitor, ProjectDelta,
+    ProjectUpdateRequest,
+};
+use build_monitor::project::Project;
+use build_monitor::project_encoding::decode_projects;
+
+use mio::net::UdpSocket;
+use mio::{Events, Interest, Poll, Token};
+use socket2::{Domain, Protocol, Socket, Type};
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::net::{Ipv4Addr, SocketAddr};
+use std::time::{Duration, Instant};
+
+// Requests that aren't answered within this time count as dropped, also the last requests after the
+// load test ended.
+const ANSWER_TIMEOUT: Duration = Duration::from_secs(1);
+
+// What the clients of one thread sent and received.
+#[derive(Default)]
+pub struct ClientResults {
+    pub requests: u64,
+    pub answers: u64,
+    // Requests that weren't answered within the answer timeout.
+    pub dropped: u64,
+    pub no_updates: u64,
+    pub updates: u64,
+    pub deltas: u64,
+    pub beacons: u64,
+    pub bytes_received: u64,
+    // In microseconds, from the oldest request that wasn't answered yet to the next answer.
+    pub latencies: Vec<u32>,
+    // The sequences of the updates every multicast client received, per client.
+    pub received_sequences: Vec<(Instant, Vec<(u64, Instant)>)>,
+}
+
+impl ClientResults {
+    pub fn merge(&mut self, other: ClientResults) {
+        self.requests += other.requests;
+        self.answers += other.answers;
+        self.dropped += other.dropped;
+        self.no_updates += other.no_updates;
+        self.updates += other.updates;
+        self.deltas += other.deltas;
+        self.beacons += other.beacons;
+        self.bytes_received += other.bytes_received;
+        self.latencies.extend(other.latencies);
+        self.received_sequences.extend(other.received_sequences);
+    }
+}
+
+struct SimulatedClient {
+    socket: UdpSocket,
+    projects_hash: u64,
+    sequence: u64,
+    // When the requests that weren't answered yet were sent, the oldest first. The answers don't say
+    // which request they answer, so an answer is counted for the oldest one.
+    requests: VecDeque<Instant>,
+    reassembler: Reassembler,
+    // When the multicast client received its first update, and the sequences of all its updates.
+    first_update: Option<Instant>,
+    received_sequences: Vec<(u64, Instant)>,
+}
+
+impl SimulatedClient {
+    fn new(socket: UdpSocket) -> SimulatedClient {
+        SimulatedClient {
+            socket,
+            projects_hash: 0,
+            sequence: 0,
+            requests: VecDeque::new(),
+            reassembler: Reassembler::new(),
+            first_update: None,
+            received_sequences: Vec::new(),
+        }
+    }
+}
+
+// The hash of the projects of every sequence that was received, so only the first client that
+// receives a full update decodes it.
+struct ProjectsHashes {
+    hashes: HashMap<u64, u64>,
+}
+
+impl ProjectsHashes {
+    fn hash(&mut self, sequence: u64, decode: impl FnOnce() -> Option<Vec<Project>>) -> Option<u64> {
+        match self.hashes.get(&sequence) {
+            Some(hash) => Some(*hash),
+            None => {
+                let hash = Monitor::generate_projects_hash(&decode()?);
+                self.hashes.insert(sequence, hash);
+                Some(hash)
+            }
+        }
+    }
+}
+
+fn update_request(projects_hash: u64, sequence: u64, capabilities: u32) -> Vec<u8> {
+    let request = ProjectUpdateRequest { projects_hash, sequence, capabilities };
+    serialize_message(Header::new().version, MessageType::ProjectUpdateRequest, bincode::serialize(&request).unwrap())
+}
+
+// Applies a whole message to what the client has, and counts it. Returns whether it answers a request.
+fn handle_message(client: &mut SimulatedClient, message: &[u8], hashes: &mut ProjectsHashes, results: &mut ClientResults) -> bool {
+    let (header, header_size) = match Header::from_bytes(message) {
+        Some(header) => header,
+        None => return false,
+    };
+    let body = &message[header_size..];
+    let sequence = match header.msg_type {
+        MessageType::NoProjectUpdate => {
+            results.no_updates += 1;
+            return true;
+        }
+        MessageType::Beacon => {
+            results.beacons += 1;
+            return false;
+        }
+        MessageType::ProjectUpdate => {
+            let (views, sequence) = match deserialize_project_update(body) {
+                Ok(update) => update,
+                Err(_) => return false,
+            };
+            match hashes.hash(sequence, || Some(views.iter().map(|view| view.to_project()).collect())) {
+                Some(projects_hash) => {
+                    client.projects_hash = projects_hash;
+                    client.sequence = sequence;
+                }
+                None => return false,
+            }
+            results.updates += 1;
+            sequence
+        }
+        MessageType::CompressedProjectUpdate => {
+            let (sequence, encoded_projects) = match split_compressed_project_update(body) {
+                Some(update) => update,
+                None => return false,
+            };
+            match hashes.hash(sequence, || decode_projects(encoded_projects).ok()) {
+                Some(projects_hash) => {
+                    client.projects_hash = projects_hash;
+                    client.sequence = sequence;
+                }
+                None => return false,
+            }
+            results.updates += 1;
+            sequence
+        }
+        MessageType::ProjectDelta => {
+            let delta = match bincode::deserialize::<ProjectDelta>(body) {
+                Ok(delta) => delta,
+                Err(_) => return false,
+            };
+            // A client that doesn't have the base asks for all projects next time.
+            if delta.base_sequence == client.sequence {
+                client.projects_hash = delta.projects_hash;
+                client.sequence = delta.sequence;
+            }
+            else {
+                client.projects_hash = 0;
+                client.sequence = 0;
+            }
+            results.deltas += 1;
+            delta.sequence
+        }
+        _ => return false,
+    };
+    let now = Instant::now();
+    client.first_update.get_or_insert(now);
+    client.received_sequences.push((sequence, now));
+    true
+}
+
+// Reads everything that arrived for the client.
+fn receive(client: &mut SimulatedClient, recv_buffer: &mut [u8], hashes: &mut ProjectsHashes, results: &mut ClientResults) {
+    loop {
+        let (bytes_read, from_address) = match client.socket.recv_from(recv_buffer) {
+            Ok(received) => received,
+            Err(_) => return,
+        };
+        results.bytes_received += bytes_read as u64;
+        let packet = &recv_buffer[..bytes_read];
+        let is_answer = match Header::from_bytes(packet) {
+            Some((header, header_size)) if header.msg_type == MessageType::ProjectChunk => {
+                match client.reassembler.add_chunk(from_address, &packet[header_size..]) {
+                    Some(message) => handle_message(client, &message, hashes, results),
+                    None => false,
+                }
+            }
+            Some(_) => handle_message(client, packet, hashes, results),
+            None => false,
+        };
+        if is_answer {
+            let now = Instant::now();
+            expire_requests(client, now, results);
+            match client.requests.pop_front() {
+                Some(requested_at) => {
+                    results.answers += 1;
+                    results.latencies.push((now - requested_at).as_micros().min(u32::MAX as u128) as u32);
+                }
+                // Answers a request that was counted as dropped already.
+                None => {}
+            }
+        }
+    }
+}
+
+// Counts the requests that weren't answered within the answer timeout as dropped.
+fn expire_requests(client: &mut SimulatedClient, now: Instant, results: &mut ClientResults) {
+    while let Some(&requested_at) = client.requests.front() {
+        if now.saturating_duration_since(requested_at) < ANSWER_TIMEOUT {
+            break;
+        }
+        client.requests.pop_front();
+        results.dropped += 1;
+    }
+}
+
+fn send_request(client: &mut SimulatedClient, server_address: &SocketAddr, capabilities: u32, results: &mut ClientResults) {
+    let now = Instant::now();
+    expire_requests(client, now, results);
+    let request = update_request(client.projects_hash, client.sequence, capabilities);
+    match client.socket.send_to(&request, *server_address) {
+        Ok(_) => {
+            results.requests += 1;
+            client.requests.push_back(now);
+        }
+        Err(e) => eprintln!("Failed to send a request. Error: {}", e),
+    }
+}
+
+fn register_clients(poll: &Poll, clients: &mut Vec<SimulatedClient>) {
+    for (index, client) in clients.iter_mut().enumerate() {
+        poll.registry()
+            .register(&mut client.socket, Token(index), Interest::READABLE)
+            .expect("Failed to register a client.");
+    }
+}
+
+// Lets the clients ask the server for updates every interval, spread evenly over the interval, until
+// the duration passed.
+pub fn run_query_clients(server_address: SocketAddr, count: usize, interval: Duration, duration: Duration, capabilities: u32) -> ClientResults {
+    let mut clients: Vec<SimulatedClient> = (0..count)
+        .map(|_| {
+            let socket = UdpSocket::bind(SocketAddr::new(Ipv4Addr::LOCALHOST.into(), 0)).expect("Failed to bind a client.");
+            SimulatedClient::new(socket)
+        })
+        .collect();
+    let mut poll = Poll::new().expect("Unable to create the event loop.");
+    register_clients(&poll, &mut clients);
+    let mut events = Events::with_capacity(1024);
+    let mut recv_buffer = vec![0; MAX_RECEIVE_SIZE];
+    let mut hashes = ProjectsHashes { hashes: HashMap::new() };
+    let mut results = ClientResults::default();
+
+    // Every client asks once per interval, so the next one to ask is always at the front.
+    let start = Instant::now();
+    let end = start + duration;
+    let mut schedule: VecDeque<(Instant, usize)> = (0..count)
+        .map(|index| (start + interval.mul_f64(index as f64 / count as f64), index))
+        .collect();
+    loop {
+        let now = Instant::now();
+        if now >= end {
+            break;
+        }
+        while let Some(&(due, index)) = schedule.front() {
+            if due > now {
+                break;
+            }
+            schedule.pop_front();
+            send_request(&mut clients[index], &server_address, capabilities, &mut results);
+            schedule.push_back((due + interval, index));
+        }
+
+        let next_due = schedule.front().map_or(end, |(due, _)| std::cmp::min(*due, end));
+        let _ = poll.poll(&mut events, Some(next_due.saturating_duration_since(Instant::now())));
+        for event in events.iter() {
+            receive(&mut clients[event.token().0], &mut recv_buffer, &mut hashes, &mut results);
+        }
+    }
+
+    // The last requests still get their answers, the ones that don't are dropped.
+    let final_end = Instant::now() + ANSWER_TIMEOUT;
+    while clients.iter().any(|client| !client.requests.is_empty()) && Instant::now() < final_end {
+        let _ = poll.poll(&mut events, Some(final_end.saturating_duration_since(Instant::now())));
+        for event in events.iter() {
+            receive(&mut clients[event.token().0], &mut recv_buffer, &mut hashes, &mut results);
+        }
+    }
+    results.dropped += clients.iter().map(|client| client.requests.len() as u64).sum::<u64>();
+    results
+}
+
+// Lets the clients listen to the multicast group until the duration passed. They don't ask for
+// anything, several sockets on the same port don't all get the answers that are sent to it.
+pub fn run_multicast_clients(group_address: SocketAddr, count: usize, duration: Duration) -> ClientResults {
+    let group = match group_address.ip() {
+        std::net::IpAddr::V4(group) => group,
+        std::net::IpAddr::V6(_) => panic!("Only IPv4 multicast groups are supported."),
+    };
+    let mut clients: Vec<SimulatedClient> = (0..count)
+        .map(|_| {
+            let socket = Socket::new(Domain::IPV4, Type::DGRAM, Some(Protocol::UDP)).expect("Unable to create socket.");
+            socket.set_reuse_address(true).expect("Failed to apply reuse address");
+            socket.set_nonblocking(true).expect("Failed to set non blocking.");
+            socket
+                .bind(&SocketAddr::new(Ipv4Addr::UNSPECIFIED.into(), group_address.port()).into())
+                .expect("Failed to bind a client.");
+            socket.join_multicast_v4(&group, &Ipv4Addr::UNSPECIFIED).expect("Failed to join multicast group.");
+            SimulatedClient::new(UdpSocket::from_std(socket.into()))
+        })
+        .collect();
+    let mut poll = Poll::new().expect("Unable to create the event loop.");
+    register_clients(&poll, &mut clients);
+    let mut events = Events::with_capacity(1024);
+    let mut recv_buffer = vec![0; MAX_RECEIVE_SIZE];
+    let mut hashes = ProjectsHashes { hashes: HashMap::new() };
+    let mut results = ClientResults::default();
+
+    let start = Instant::now();
+    let end = start + duration;
+    loop {
+        let now = Instant::now();
+        if now >= end {
+            break;
+        }
+        let _ = poll.poll(&mut events, Some(end - now));
+        for event in events.iter() {
+            receive(&mut clients[event.token().0], &mut recv_buffer, &mut hashes, &mut results);
+        }
+    }
+    results.received_sequences = clients
+        .into_iter()
+        .map(|client| (client.first_update.unwrap_or(end), client.received_sequences))
+        .collect();
+    results
+}
+
+// When the first client received each multicast update.
+fn first_received(results: &ClientResults) -> HashMap<u64, Instant> {
+    let mut first_received: HashMap<u64, Instant> = HashMap::new();
+    for (_, received_sequences) in results.received_sequences.iter() {
+        for (sequence, received_at) in received_sequences.iter() {
+            let first = first_received.entry(*sequence).or_insert(*received_at);
+            *first = std::cmp::min(*first, *received_at);
+        }
+    }
+    first_received
+}
+
+// How many of the multicast updates the clients didn't receive. Only the updates that were sent after
+// a client received its first one count for it.
+pub fn missed_updates(results: &ClientResults) -> (u64, u64) {
+    let sent = first_received(results);
+    let mut expected = 0;
+    let mut missed = 0;
+    for (first_update, received_sequences) in results.received_sequences.iter() {
+        let received: HashSet<u64> = received_sequences.iter().map(|(sequence, _)| *sequence).collect();
+        for (sequence, first_received) in sent.iter() {
+            if first_received > first_update {
+                expected += 1;
+                if !received.contains(sequence) {
+                    missed += 1;
+                }
+            }
+        }
+    }
+    (expected, missed)
+}
+
+// In microseconds, how long after the first client each client received a multicast update.
+pub fn delivery_spread(results: &ClientResults) -> Vec<u32> {
+    let first_received = first_received(results);
+    results.received_sequences
+        .iter()
+        .flat_map(|(_, received_sequences)| received_sequences.iter())
+        .map(|(sequence, received_at)| (*received_at - first_received[sequence]).as_micros().min(u32::MAX as u128) as u32)
+        .collect()
+}
@@ -0,0 +1,342 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Starts a mock Jenkins, a server in a child process and thousands of simulated clients on this
+// machine, and reports how the server held up: the request rate, the latency of the answers, the
+// requests that weren't answered, and the CPU time and bytes of the server.
+
+mod clients;
+mod server;
+
+use crate::clients::{delivery_spread, missed_updates, run_multicast_clients, run_query_clients, ClientResults};
+use crate::server::{serve, ServerOptions, ServerReport, READY_PREFIX, STATISTICS_PREFIX};
+use build_monitor::monitor::{CAPABILITY_CHUNKED_MESSAGES, CAPABILITY_COMPRESSED_UPDATES};
+use mock_jenkins::{MockJenkins, MockJenkinsConfig};
+
+use std::env;
+use std::io::{BufRead, BufReader};
+use std::net::{SocketAddr, ToSocketAddrs};
+use std::process::{Command, Stdio};
+use std::sync::mpsc::{channel, Receiver};
+use std::time::Duration;
+
+const DEFAULT_QUERY_ADDRESS: &str = "127.0.0.1:8098";
+const DEFAULT_MULTICAST_ADDRESS: &str = "239.255.13.37:8098";
+// How long the server may take to crawl the mock Jenkins and start.
+const READY_TIMEOUT: Duration = Duration::from_secs(60);
+
+struct Options {
+    // Set in the server process, to the url of the mock Jenkins.
+    serve: Option<String>,
+    address: Option<String>,
+    multicast: bool,
+    clients: usize,
+    threads: usize,
+    duration: Duration,
+    interval: Duration,
+    compression: bool,
+    workers: usize,
+    refresh_interval: Duration,
+    multicast_deltas: bool,
+    jenkins: MockJenkinsConfig,
+}
+
+fn parse_value<T: std::str::FromStr>(name: &str, value: Option<&String>) -> Result<T, String> {
+    match value.map(|value| value.parse::<T>()) {
+        Some(Ok(value)) => Ok(value),
+        _ => Err(format!("Invalid or missing value for '{}'.", name)),
+    }
+}
+
+fn parse_args(args: &[String]) -> Result<Options, String> {
+    let mut options = Options {
+        serve: None,
+        address: None,
+        multicast: false,
+        clients: 1000,
+        threads: 2,
+        duration: Duration::from_secs(10),
+        interval: Duration::from_millis(1000),
+        compression: true,
+        workers: 1,
+        refresh_interval: Duration::from_millis(1000),
+        multicast_deltas: false,
+        jenkins: MockJenkinsConfig {
+            folder_depth: 1,
+            folders_per_folder: 4,
+            jobs_per_folder: 75,
+            rebuild_interval: Some(Duration::from_secs(4)),
+            ..MockJenkinsConfig::default()
+        },
+    };
+    let mut index = 1;
+    while index < args.len() {
+        let name = args[index].as_str();
+        let value = args.get(index + 1);
+        match name {
+            "--serve" => options.serve = Some(parse_value(name, value)?),
+            "--address" => options.address = Some(parse_value(name, value)?),
+            "--clients" => options.clients = parse_value(name, value)?,
+            "--threads" => options.threads = std::cmp::max(parse_value(name, value)?, 1),
+            "--seconds" => options.duration = Duration::from_secs(parse_value(name, value)?),
+            "--interval-ms" => options.interval = Duration::from_millis(std::cmp::max(parse_value(name, value)?, 1)),
+            "--workers" => options.workers = std::cmp::max(parse_value(name, value)?, 1),
+            "--refresh-ms" => options.refresh_interval = Duration::from_millis(parse_value(name, value)?),
+            "--folders" => options.jenkins.folders_per_folder = parse_value(name, value)?,
+            "--jobs" => options.jenkins.jobs_per_folder = parse_value(name, value)?,
+            "--rebuild-seconds" => {
+                let seconds: u64 = parse_value(name, value)?;
+                options.jenkins.rebuild_interval = if seconds > 0 { Some(Duration::from_secs(seconds)) } else { None };
+            }
+            "--multicast" => {
+                options.multicast = true;
+                index += 1;
+                continue;
+            }
+            "--no-compression" => {
+                options.compression = false;
+                index += 1;
+                continue;
+            }
+            "--multicast-deltas" => {
+                options.multicast_deltas = true;
+                index += 1;
+                continue;
+            }
+            _ => return Err(format!("Unknown option '{}'.", name)),
+        }
+        index += 2;
+    }
+    Ok(options)
+}
+
+// Every client has its own socket, which is more than the default limit of some systems allows.
+#[cfg(unix)]
+fn raise_open_files_limit() {
+    unsafe {
+        let mut limit: libc::rlimit = std::mem::zeroed();
+        if libc::getrlimit(libc::RLIMIT_NOFILE, &mut limit) == 0 && limit.rlim_cur < limit.rlim_max {
+            limit.rlim_cur = limit.rlim_max;
+            libc::setrlimit(libc::RLIMIT_NOFILE, &limit);
+        }
+    }
+}
+
+#[cfg(not(unix))]
+fn raise_open_files_limit() {}
+
+// Passes on what the server writes to stderr, except for the lines that are meant for the load test.
+fn forward_server_output(stderr: impl std::io::Read + Send + 'static) -> Receiver<String> {
+    let (sender, receiver) = channel();
+    std::thread::spawn(move || {
+        for line in BufReader::new(stderr).lines() {
+            let line = match line {
+                Ok(line) => line,
+                Err(_) => break,
+            };
+            if line.starts_with(READY_PREFIX) || line.starts_with(STATISTICS_PREFIX) {
+                if sender.send(line).is_err() {
+                    break;
+                }
+            }
+            else {
+                eprintln!("server: {}", line);
+            }
+        }
+    });
+    receiver
+}
+
+fn run_clients(options: &Options, address: SocketAddr) -> ClientResults {
+    let threads = std::cmp::min(options.threads, std::cmp::max(options.clients, 1));
+    let capabilities = CAPABILITY_CHUNKED_MESSAGES | if options.compression { CAPABILITY_COMPRESSED_UPDATES } else { 0 };
+    let handles: Vec<_> = (0..threads)
+        .map(|thread| {
+            let count = options.clients / threads + if thread < options.clients % threads { 1 } else { 0 };
+            let multicast = options.multicast;
+            let interval = options.interval;
+            let duration = options.duration;
+            std::thread::spawn(move || {
+                if multicast {
+                    run_multicast_clients(address, count, duration)
+                }
+                else {
+                    run_query_clients(address, count, interval, duration, capabilities)
+                }
+            })
+        })
+        .collect();
+    let mut results = ClientResults::default();
+    for handle in handles {
+        match handle.join() {
+            Ok(thread_results) => results.merge(thread_results),
+            Err(_) => eprintln!("A client thread failed."),
+        }
+    }
+    results
+}
+
+fn megabytes(bytes: u64) -> f64 {
+    bytes as f64 / (1024.0 * 1024.0)
+}
+
+// In milliseconds, the latency below which the percent of the sorted latencies are.
+fn percentile(sorted_latencies: &[u32], percent: f64) -> f64 {
+    if sorted_latencies.is_empty() {
+        return 0.0;
+    }
+    let index = ((sorted_latencies.len() - 1) as f64 * percent / 100.0).round() as usize;
+    sorted_latencies[index] as f64 / 1000.0
+}
+
+fn print_latencies(name: &str, mut latencies: Vec<u32>) {
+    latencies.sort_unstable();
+    println!("{:<10} p50 {:.2} ms, p90 {:.2} ms, p99 {:.2} ms, p99.9 {:.2} ms, max {:.2} ms",
+        name,
+        percentile(&latencies, 50.0),
+        percentile(&latencies, 90.0),
+        percentile(&latencies, 99.0),
+        percentile(&latencies, 99.9),
+        percentile(&latencies, 100.0));
+}
+
+fn print_report(options: &Options, project_count: usize, results: ClientResults, server_report: Option<ServerReport>) {
+    let seconds = options.duration.as_secs_f64();
+    println!("{} {} clients on {} threads, {} projects, {} s",
+        options.clients,
+        if options.multicast { "multicast" } else { "query" },
+        options.threads,
+        project_count,
+        seconds);
+    if options.multicast {
+        let (expected, missed) = missed_updates(&results);
+        println!("{:<10} {} received, {} of {} missed ({:.2}%), {} beacons",
+            "Updates:",
+            results.updates + results.deltas,
+            missed,
+            expected,
+            if expected > 0 { missed as f64 * 100.0 / expected as f64 } else { 0.0 },
+            results.beacons);
+        print_latencies("Spread:", delivery_spread(&results));
+    }
+    else {
+        println!("{:<10} {} sent, {} answered ({:.0}/s), {} dropped ({:.2}%)",
+            "Requests:",
+            results.requests,
+            results.answers,
+            results.answers as f64 / seconds,
+            results.dropped,
+            if results.requests > 0 { results.dropped as f64 * 100.0 / results.requests as f64 } else { 0.0 });
+        println!("{:<10} {} no update, {} updates, {} deltas", "Answers:", results.no_updates, results.updates, results.deltas);
+        print_latencies("Latency:", results.latencies);
+    }
+    println!("{:<10} {:.2} MB by the clients", "Received:", megabytes(results.bytes_received));
+    match server_report {
+        Some(report) => {
+            let elapsed = report.elapsed.as_secs_f64();
+            let cpu = match report.cpu_time {
+                Some(cpu_time) => format!("{:.2} s CPU ({:.1}% of a core)", cpu_time.as_secs_f64(), cpu_time.as_secs_f64() * 100.0 / elapsed),
+                None => "unknown CPU".to_string(),
+            };
+            println!("{:<10} {} requests, {} messages, {:.2} MB sent ({:.2} MB/s), {}, {} refreshes",
+                "Server:",
+                report.statistics.requests,
+                report.statistics.messages_sent,
+                megabytes(report.statistics.bytes_sent),
+                megabytes(report.statistics.bytes_sent) / elapsed,
+                cpu,
+                report.refreshes);
+        }
+        None => println!("{:<10} no statistics", "Server:"),
+    }
+}
+
+fn load_test(options: &Options) -> Result<(), String> {
+    raise_open_files_limit();
+    let address = options.address.clone().unwrap_or_else(|| {
+        if options.multicast { DEFAULT_MULTICAST_ADDRESS } else { DEFAULT_QUERY_ADDRESS }.to_string()
+    });
+    let socket_address = match address.to_socket_addrs().ok().and_then(|mut addresses| addresses.next()) {
+        Some(socket_address) => socket_address,
+        None => return Err(format!("Invalid address '{}'.", address)),
+    };
+
+    let jenkins = match MockJenkins::start("127.0.0.1:0", options.jenkins.clone()) {
+        Ok(jenkins) => jenkins,
+        Err(e) => return Err(format!("Failed to start mock Jenkins. Error: {}", e)),
+    };
+    let executable = env::current_exe().map_err(|e| format!("Failed to find the load test. Error: {}", e))?;
+    let mut command = Command::new(executable);
+    command
+        .args(["--serve", jenkins.url(), "--address", &address])
+        .args(["--workers", &options.workers.to_string()])
+        .args(["--refresh-ms", &options.refresh_interval.as_millis().to_string()])
+        .stdin(Stdio::piped())
+        .stdout(Stdio::null())
+        .stderr(Stdio::piped());
+    if options.multicast {
+        command.arg("--multicast");
+    }
+    if options.multicast_deltas {
+        command.arg("--multicast-deltas");
+    }
+    if !options.compression {
+        command.arg("--no-compression");
+    }
+    let mut child = command.spawn().map_err(|e| format!("Failed to start the server. Error: {}", e))?;
+    let server_lines = forward_server_output(child.stderr.take().unwrap());
+
+    let project_count = match server_lines.recv_timeout(READY_TIMEOUT) {
+        Ok(line) if line.starts_with(READY_PREFIX) => line[READY_PREFIX.len()..].trim().parse::<usize>().unwrap_or(0),
+        _ => {
+            let _ = child.kill();
+            let _ = child.wait();
+            return Err("The server didn't start.".to_string());
+        }
+    };
+
+    let results = run_clients(options, socket_address);
+
+    // Closing stdin stops the server, which reports what it did.
+    drop(child.stdin.take());
+    let server_report = server_lines
+        .recv_timeout(Duration::from_secs(10))
+        .ok()
+        .and_then(|line| ServerReport::from_line(&line));
+    let _ = child.wait();
+    print_report(options, project_count, results, server_report);
+    Ok(())
+}
+
+fn main() {
+    let args: Vec<String> = env::args().collect();
+    let options = match parse_args(&args) {
+        Ok(options) => options,
+        Err(e) => {
+            eprintln!("{}", e);
+            println!(concat!("Usage build_monitor_loadtest [--clients {{count}}] [--threads {{client_threads}}] ",
+                "[--seconds {{duration}}] [--interval-ms {{milliseconds_between_requests}}] [--multicast] [--address {{address}}] ",
+                "[--workers {{server_threads}}] [--refresh-ms {{milliseconds}}] [--no-compression] [--multicast-deltas] ",
+                "[--folders {{folders_per_folder}}] [--jobs {{jobs_per_folder}}] [--rebuild-seconds {{seconds}}]"));
+            return;
+        }
+    };
+
+    let result = match &options.serve {
+        Some(jenkins_url) => {
+            let server_options = ServerOptions {
+                address: options.address.clone().unwrap_or_else(|| DEFAULT_QUERY_ADDRESS.to_string()),
+                multicast: options.multicast,
+                workers: options.workers,
+                refresh_interval: options.refresh_interval,
+                multicast_deltas: options.multicast_deltas,
+                multicast_compression: options.compression,
+            };
+            serve(jenkins_url, &server_options)
+        }
+        None => load_test(&options),
+    };
+    match result {
+        Ok(()) => {}
+        Err(e) => eprintln!("{}", e),
+    }
+}
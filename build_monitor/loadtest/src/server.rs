@@ -0,0 +1,125 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// The server runs in its own process, started by the load test with --serve, so its CPU time doesn't
+// include the clients. It reports on stderr, its stdout only has the log of every datagram.
+
+use build_monitor::monitor::{CrawlMode, Monitor, ServerStatistics};
+
+use futures::executor::block_on;
+use std::io::Read;
+use std::sync::mpsc::{channel, RecvTimeoutError};
+use std::time::{Duration, Instant};
+
+pub const READY_PREFIX: &str = "loadtest-ready";
+pub const STATISTICS_PREFIX: &str = "loadtest-statistics";
+
+pub struct ServerOptions {
+    pub address: String,
+    pub multicast: bool,
+    pub workers: usize,
+    pub refresh_interval: Duration,
+    pub multicast_deltas: bool,
+    pub multicast_compression: bool,
+}
+
+// What the server process did while the clients were running.
+pub struct ServerReport {
+    pub statistics: ServerStatistics,
+    pub cpu_time: Option<Duration>,
+    pub elapsed: Duration,
+    pub refreshes: u64,
+}
+
+impl ServerReport {
+    pub fn to_line(&self) -> String {
+        format!("{} {} {} {} {} {} {}",
+            STATISTICS_PREFIX,
+            self.statistics.requests,
+            self.statistics.messages_sent,
+            self.statistics.bytes_sent,
+            self.cpu_time.map_or(-1, |cpu_time| cpu_time.as_micros() as i64),
+            self.elapsed.as_micros(),
+            self.refreshes)
+    }
+
+    pub fn from_line(line: &str) -> Option<ServerReport> {
+        let values: Vec<&str> = line.strip_prefix(STATISTICS_PREFIX)?.split_whitespace().collect();
+        if values.len() != 6 {
+            return None;
+        }
+        let cpu_time = values[3].parse::<i64>().ok()?;
+        Some(ServerReport {
+            statistics: ServerStatistics {
+                requests: values[0].parse().ok()?,
+                messages_sent: values[1].parse().ok()?,
+                bytes_sent: values[2].parse().ok()?,
+            },
+            cpu_time: if cpu_time >= 0 { Some(Duration::from_micros(cpu_time as u64)) } else { None },
+            elapsed: Duration::from_micros(values[4].parse().ok()?),
+            refreshes: values[5].parse().ok()?,
+        })
+    }
+}
+
+// The user and system time of this process.
+#[cfg(unix)]
+fn process_cpu_time() -> Option<Duration> {
+    let mut usage: libc::rusage = unsafe { std::mem::zeroed() };
+    if unsafe { libc::getrusage(libc::RUSAGE_SELF, &mut usage) } != 0 {
+        return None;
+    }
+    let to_duration = |time: libc::timeval| Duration::from_secs(time.tv_sec as u64) + Duration::from_micros(time.tv_usec as u64);
+    Some(to_duration(usage.ru_utime) + to_duration(usage.ru_stime))
+}
+
+#[cfg(not(unix))]
+fn process_cpu_time() -> Option<Duration> {
+    None
+}
+
+// Crawls the Jenkins, serves the projects and refreshes them every interval until stdin is closed.
+pub fn serve(jenkins_url: &str, options: &ServerOptions) -> Result<(), String> {
+    let mut monitor = Monitor::new(jenkins_url);
+    monitor.set_crawl_mode(CrawlMode::Bulk);
+    match block_on(monitor.refresh_projects()) {
+        Ok(_) => {}
+        Err(e) => return Err(format!("Failed to refresh projects. Error: {}", e)),
+    }
+    monitor.set_server_workers(options.workers);
+    monitor.set_multicast_deltas(options.multicast_deltas);
+    monitor.set_multicast_compression(options.multicast_compression);
+    monitor.start_server(&options.address, options.multicast)?;
+
+    let (stopped_sender, stopped_receiver) = channel();
+    std::thread::spawn(move || {
+        let _ = std::io::stdin().read_to_end(&mut Vec::new());
+        let _ = stopped_sender.send(());
+    });
+
+    // The initial crawl is left out, only what the server does while the clients run counts.
+    let start_cpu_time = process_cpu_time();
+    let start = Instant::now();
+    eprintln!("{} {}", READY_PREFIX, monitor.get_projects().read().unwrap().len());
+    let mut refreshes = 0;
+    loop {
+        match stopped_receiver.recv_timeout(options.refresh_interval) {
+            Err(RecvTimeoutError::Timeout) => {
+                match block_on(monitor.refresh_projects()) {
+                    Ok(_) => refreshes += 1,
+                    Err(e) => eprintln!("Failed to refresh projects. Error: {}", e),
+                }
+            }
+            _ => break,
+        }
+    }
+
+    let report = ServerReport {
+        statistics: monitor.server_statistics(),
+        cpu_time: process_cpu_time().and_then(|cpu_time| Some(cpu_time - start_cpu_time?)),
+        elapsed: start.elapsed(),
+        refreshes,
+    };
+    monitor.stop_server();
+    eprintln!("{}", report.to_line());
+    Ok(())
+}
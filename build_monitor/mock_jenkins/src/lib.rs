@@ -0,0 +1,644 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// A stand-in for a Jenkins server, so crawling can be tested and measured without network access.
+// It serves a generated tree of folders and free style projects through the same json api that
+// Jenkins has, including the tree parameter, ETags, Last-Modified and the lastBuild style build pages.
+
+mod value;
+
+use value::{parse_tree, Value};
+
+use std::collections::hash_map::DefaultHasher;
+use std::collections::HashMap;
+use std::hash::{Hash, Hasher};
+use std::io::{BufRead, BufReader, Write};
+use std::net::{Shutdown, TcpListener, TcpStream};
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+
+const FOLDER_CLASS: &str = "com.cloudbees.hudson.plugins.folder.Folder";
+const FREE_STYLE_PROJECT_CLASS: &str = "hudson.model.FreeStyleProject";
+const FREE_STYLE_BUILD_CLASS: &str = "hudson.model.FreeStyleBuild";
+
+// The fields Jenkins returns when no tree is requested. Nested objects only contain a summary.
+const FOLDER_DEFAULT_TREE: &str = "_class,description,displayName,fullName,name,url,jobs[_class,name,url,color]";
+const JOB_DEFAULT_TREE: &str = concat!("_class,description,displayName,fullName,name,url,buildable,color,inQueue,",
+    "nextBuildNumber,lastBuild[_class,number,url],lastSuccessfulBuild[_class,number,url],",
+    "lastCompletedBuild[_class,number,url]");
+
+#[derive(Clone)]
+pub struct MockJenkinsConfig {
+    // The amount of folder levels below the root. Projects are only found in the deepest folders.
+    pub folder_depth: usize,
+    pub folders_per_folder: usize,
+    pub jobs_per_folder: usize,
+    // How long every request waits before it is answered.
+    pub latency: Duration,
+    // Extra bytes in every build, like the parameters and change sets of a real build. A tree that
+    // doesn't ask for them leaves them out.
+    pub build_padding: usize,
+    // How often the rebuilding jobs start a new build. They are building during the first half.
+    pub rebuild_interval: Option<Duration>,
+    pub rebuilding_jobs_percent: u64,
+    // The job and build pages of these jobs answer with an internal server error.
+    pub failing_jobs_percent: u64,
+    pub etags: bool,
+    // Answers with a Last-Modified date, like Jenkins behind a proxy that only passes that on. The date
+    // changes with the page, and only a request for exactly that date is answered with a 304.
+    pub last_modified: bool,
+}
+
+impl Default for MockJenkinsConfig {
+    fn default() -> MockJenkinsConfig {
+        MockJenkinsConfig {
+            folder_depth: 1,
+            folders_per_folder: 4,
+            jobs_per_folder: 25,
+            latency: Duration::from_millis(0),
+            build_padding: 0,
+            rebuild_interval: None,
+            rebuilding_jobs_percent: 10,
+            failing_jobs_percent: 0,
+            etags: true,
+            last_modified: false,
+        }
+    }
+}
+
+#[derive(Clone, Copy, Default)]
+pub struct MockJenkinsStatistics {
+    pub requests: u64,
+    pub not_modified: u64,
+    pub bytes_sent: u64,
+}
+
+struct SharedData {
+    config: MockJenkinsConfig,
+    url: String,
+    started_at: Instant,
+    running: AtomicBool,
+    failing_jobs_percent: AtomicU64,
+    // Builds that were finished on request, on top of the ones the configuration generates.
+    finished_builds: Mutex<HashMap<u64, i64>>,
+    requests: AtomicU64,
+    not_modified: AtomicU64,
+    bytes_sent: AtomicU64,
+}
+
+pub struct MockJenkins {
+    data: Arc<SharedData>,
+    listener_thread: Option<JoinHandle<()>>,
+}
+
+struct Request {
+    path: String,
+    tree: Option<String>,
+    if_none_match: Option<String>,
+    if_modified_since: Option<String>,
+    keep_alive: bool,
+}
+
+enum Page {
+    Folder(Vec<usize>),
+    Job(Vec<usize>, usize),
+    Build(Vec<usize>, usize, BuildKind),
+}
+
+#[derive(Clone, Copy)]
+enum BuildKind {
+    Last,
+    LastSuccessful,
+    LastCompleted,
+}
+
+struct JobState {
+    buildable: bool,
+    number: i64,
+    building: bool,
+    result: &'static str,
+    culprits: usize,
+}
+
+impl MockJenkins {
+    // Starts serving on the address, use port 0 to pick a free port.
+    pub fn start(address: &str, config: MockJenkinsConfig) -> std::io::Result<MockJenkins> {
+        let listener = TcpListener::bind(address)?;
+        let data = Arc::new(SharedData {
+            failing_jobs_percent: AtomicU64::new(config.failing_jobs_percent),
+            finished_builds: Mutex::new(HashMap::new()),
+            config,
+            url: format!("http://{}/", listener.local_addr()?),
+            started_at: Instant::now(),
+            running: AtomicBool::new(true),
+            requests: AtomicU64::new(0),
+            not_modified: AtomicU64::new(0),
+            bytes_sent: AtomicU64::new(0),
+        });
+
+        let thread_data = data.clone();
+        let listener_thread = std::thread::spawn(move || {
+            for stream in listener.incoming() {
+                if !thread_data.running.load(Ordering::Relaxed) {
+                    break;
+                }
+                match stream {
+                    Ok(stream) => {
+                        let connection_data = thread_data.clone();
+                        std::thread::spawn(move || serve_connection(&connection_data, stream));
+                    }
+                    Err(error) => eprintln!("Failed to accept connection: {}", error),
+                }
+            }
+        });
+
+        Ok(MockJenkins {
+            data,
+            listener_thread: Some(listener_thread),
+        })
+    }
+
+    // The url to pass to Monitor::new.
+    pub fn url(&self) -> &str {
+        &self.data.url
+    }
+
+    pub fn project_count(&self) -> usize {
+        let config = &self.data.config;
+        config.folders_per_folder.pow(config.folder_depth as u32) * config.jobs_per_folder
+    }
+
+    pub fn statistics(&self) -> MockJenkinsStatistics {
+        MockJenkinsStatistics {
+            requests: self.data.requests.load(Ordering::Relaxed),
+            not_modified: self.data.not_modified.load(Ordering::Relaxed),
+            bytes_sent: self.data.bytes_sent.load(Ordering::Relaxed),
+        }
+    }
+
+    pub fn set_failing_jobs_percent(&self, failing_jobs_percent: u64) {
+        self.data.failing_jobs_percent.store(failing_jobs_percent, Ordering::Relaxed);
+    }
+
+    // Adds a finished build to the job in the folder, for example folders [1, 0] and job 3 for
+    // job/folder1/job/folder0/job/project3.
+    pub fn finish_build(&self, folders: &[usize], job: usize) {
+        let job_number = job_number(&self.data.config, folders, job);
+        *self.data.finished_builds.lock().unwrap().entry(job_number).or_insert(0) += 1;
+    }
+
+    // Posts a notification for the last build of the job, in the format of the Jenkins notification
+    // plugin, to an url like http://127.0.0.1:8095/.
+    pub fn notify_build(&self, notification_url: &str, folders: &[usize], job: usize) -> std::io::Result<()> {
+        let state = job_state(&self.data, job_number(&self.data.config, folders, job));
+        let job_url = format!("{}job/project{}/", folder_url(&self.data, folders), job);
+        let mut body = String::new();
+        Value::Object(vec![
+            ("name", Value::String(format!("project{}", job))),
+            ("url", Value::String(job_url[self.data.url.len()..].to_string())),
+            ("build", Value::Object(vec![
+                ("full_url", Value::String(format!("{}{}/", job_url, state.number))),
+                ("number", Value::Number(state.number)),
+                ("phase", Value::String(if state.building { "STARTED" } else { "COMPLETED" }.to_string())),
+                ("status", Value::String(state.result.to_string())),
+            ])),
+        ]).write(&mut body);
+
+        let address = notification_url.trim_start_matches("http://");
+        let (host, path) = match address.find('/') {
+            Some(index) => (&address[..index], &address[index..]),
+            None => (address, "/"),
+        };
+        let mut stream = TcpStream::connect(host)?;
+        write!(stream, "POST {} HTTP/1.1\r\nHost: {}\r\nContent-Type: application/json\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+            path, host, body.len(), body)?;
+        let mut status_line = String::new();
+        BufReader::new(stream).read_line(&mut status_line)?;
+        match status_line.split_whitespace().nth(1) {
+            Some("200") | Some("202") | Some("204") => Ok(()),
+            _ => Err(std::io::Error::new(std::io::ErrorKind::Other, format!("Notification was refused: {}", status_line.trim()))),
+        }
+    }
+
+    pub fn reset_statistics(&self) {
+        self.data.requests.store(0, Ordering::Relaxed);
+        self.data.not_modified.store(0, Ordering::Relaxed);
+        self.data.bytes_sent.store(0, Ordering::Relaxed);
+    }
+}
+
+impl Drop for MockJenkins {
+    fn drop(&mut self) {
+        self.data.running.store(false, Ordering::Relaxed);
+        // Wake up the listener, so it notices that it has to stop.
+        let address = self.data.url.trim_start_matches("http://").trim_end_matches('/').to_string();
+        let _ = TcpStream::connect(address);
+        match self.listener_thread.take() {
+            Some(listener_thread) => { let _ = listener_thread.join(); }
+            None => {}
+        }
+    }
+}
+
+fn serve_connection(data: &SharedData, stream: TcpStream) {
+    // Idle connections are checked every now and then, so they don't outlive the server.
+    let _ = stream.set_read_timeout(Some(Duration::from_millis(250)));
+    let mut writer = match stream.try_clone() {
+        Ok(writer) => writer,
+        Err(_) => return,
+    };
+    let mut reader = BufReader::new(stream);
+    while data.running.load(Ordering::Relaxed) {
+        // Only wait with a timeout for the start of a request, so a request is never read partially.
+        match reader.fill_buf() {
+            Ok(buffer) if buffer.is_empty() => break,
+            Ok(_) => {}
+            Err(error) if error.kind() == std::io::ErrorKind::WouldBlock || error.kind() == std::io::ErrorKind::TimedOut => continue,
+            Err(_) => break,
+        }
+        let request = match read_request(&mut reader) {
+            Ok(Some(request)) => request,
+            _ => break,
+        };
+
+        data.requests.fetch_add(1, Ordering::Relaxed);
+        if !data.config.latency.is_zero() {
+            std::thread::sleep(data.config.latency);
+        }
+
+        let response = build_response(data, &request);
+        data.bytes_sent.fetch_add(response.len() as u64, Ordering::Relaxed);
+        if writer.write_all(&response).is_err() || !request.keep_alive {
+            break;
+        }
+    }
+    let _ = writer.shutdown(Shutdown::Both);
+}
+
+fn read_request(reader: &mut BufReader<TcpStream>) -> std::io::Result<Option<Request>> {
+    let mut request_line = String::new();
+    if reader.read_line(&mut request_line)? == 0 {
+        return Ok(None);
+    }
+    let target = request_line.split_whitespace().nth(1).unwrap_or("/").to_string();
+
+    let mut if_none_match = None;
+    let mut if_modified_since = None;
+    let mut keep_alive = true;
+    loop {
+        let mut header = String::new();
+        if reader.read_line(&mut header)? == 0 {
+            return Ok(None);
+        }
+        let header = header.trim_end();
+        if header.is_empty() {
+            break;
+        }
+        match header.split_once(':') {
+            Some((name, value)) => {
+                if name.eq_ignore_ascii_case("if-none-match") {
+                    if_none_match = Some(value.trim().to_string());
+                }
+                else if name.eq_ignore_ascii_case("if-modified-since") {
+                    if_modified_since = Some(value.trim().to_string());
+                }
+                else if name.eq_ignore_ascii_case("connection") && value.trim().eq_ignore_ascii_case("close") {
+                    keep_alive = false;
+                }
+            }
+            None => {}
+        }
+    }
+
+    let (path, query) = match target.split_once('?') {
+        Some((path, query)) => (path.to_string(), query.to_string()),
+        None => (target, String::new()),
+    };
+    let tree = query
+        .split('&')
+        .find_map(|parameter| parameter.strip_prefix("tree="))
+        .map(percent_decode);
+
+    Ok(Some(Request { path, tree, if_none_match, if_modified_since, keep_alive }))
+}
+
+fn percent_decode(value: &str) -> String {
+    let bytes = value.as_bytes();
+    let mut decoded = Vec::with_capacity(bytes.len());
+    let mut index = 0;
+    while index < bytes.len() {
+        if bytes[index] == b'%' && index + 2 < bytes.len() {
+            let hex = std::str::from_utf8(&bytes[index + 1..index + 3]).unwrap_or("");
+            match u8::from_str_radix(hex, 16) {
+                Ok(byte) => {
+                    decoded.push(byte);
+                    index += 3;
+                    continue;
+                }
+                Err(_) => {}
+            }
+        }
+        decoded.push(bytes[index]);
+        index += 1;
+    }
+    String::from_utf8_lossy(&decoded).into_owned()
+}
+
+fn build_response(data: &SharedData, request: &Request) -> Vec<u8> {
+    let page = match find_page(&data.config, &request.path) {
+        Some(page) => page,
+        None => return response_without_body("404 Not Found", ""),
+    };
+    let failing_job = match &page {
+        Page::Job(folders, job) | Page::Build(folders, job, _) => Some(job_number(&data.config, folders, *job)),
+        Page::Folder(_) => None,
+    };
+    if let Some(job_number) = failing_job {
+        if job_number % 100 < data.failing_jobs_percent.load(Ordering::Relaxed) {
+            return response_without_body("500 Internal Server Error", "");
+        }
+    }
+    let tree = match &request.tree {
+        Some(tree) => parse_tree(tree),
+        None => match &page {
+            Page::Folder(_) => parse_tree(FOLDER_DEFAULT_TREE),
+            Page::Job(_, _) => parse_tree(JOB_DEFAULT_TREE),
+            Page::Build(_, _, _) => Some(Vec::new()),
+        },
+    };
+    let tree = match tree {
+        Some(tree) => tree,
+        None => return response_without_body("400 Bad Request", ""),
+    };
+
+    let value = match page_value(data, &page) {
+        Some(value) => value,
+        None => return response_without_body("404 Not Found", ""),
+    };
+    let mut body = String::new();
+    value.filter(&tree).write(&mut body);
+
+    let mut hasher = DefaultHasher::new();
+    body.hash(&mut hasher);
+    let body_hash = hasher.finish();
+    let etag = match data.config.etags {
+        true => Some(format!("\"{:016x}\"", body_hash)),
+        false => None,
+    };
+    // Some time between 2020 and 2023, that changes with the body.
+    let last_modified = match data.config.last_modified {
+        true => Some(http_date(1_600_000_000 + body_hash % 100_000_000)),
+        false => None,
+    };
+    let mut validators = String::new();
+    if let Some(etag) = &etag {
+        validators += &format!("ETag: {}\r\n", etag);
+    }
+    if let Some(last_modified) = &last_modified {
+        validators += &format!("Last-Modified: {}\r\n", last_modified);
+    }
+    if (etag.is_some() && etag == request.if_none_match) ||
+        (last_modified.is_some() && last_modified == request.if_modified_since) {
+        data.not_modified.fetch_add(1, Ordering::Relaxed);
+        return response_without_body("304 Not Modified", &validators);
+    }
+
+    let mut response = format!("HTTP/1.1 200 OK\r\nContent-Type: application/json;charset=utf-8\r\nContent-Length: {}\r\n{}\r\n",
+        body.len(), validators);
+    response += &body;
+    response.into_bytes()
+}
+
+// The headers are lines like the ETag and Last-Modified of the page.
+fn response_without_body(status: &str, headers: &str) -> Vec<u8> {
+    format!("HTTP/1.1 {}\r\nContent-Length: 0\r\n{}\r\n", status, headers).into_bytes()
+}
+
+// Formats seconds since 1970 like Thu, 01 Jan 1970 00:00:00 GMT.
+fn http_date(seconds: u64) -> String {
+    const WEEKDAYS: [&str; 7] = ["Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed"];
+    const MONTHS: [&str; 12] = ["Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"];
+    let days = seconds / 86400;
+    let time = seconds % 86400;
+    // The civil date of the day, from the days since 0000-03-01.
+    let days_since_march = days + 719468;
+    let era = days_since_march / 146097;
+    let day_of_era = days_since_march % 146097;
+    let year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    let day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    let month_index = (5 * day_of_year + 2) / 153;
+    let day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    let month = if month_index < 10 { month_index + 2 } else { month_index - 10 };
+    let year = year_of_era + era * 400 + if month < 2 { 1 } else { 0 };
+    format!("{}, {:02} {} {} {:02}:{:02}:{:02} GMT", WEEKDAYS[(days % 7) as usize], day, MONTHS[month as usize], year,
+        time / 3600, time / 60 % 60, time % 60)
+}
+
+// Resolves paths like /job/folder0/job/project3/lastBuild/api/json.
+fn find_page(config: &MockJenkinsConfig, path: &str) -> Option<Page> {
+    let segments: Vec<&str> = path.split('/').filter(|segment| !segment.is_empty()).collect();
+    if segments.len() < 2 || segments[segments.len() - 2..] != ["api", "json"] {
+        return None;
+    }
+    let mut segments = &segments[..segments.len() - 2];
+
+    let mut folders = Vec::new();
+    while segments.len() >= 2 && segments[0] == "job" {
+        let name = segments[1];
+        segments = &segments[2..];
+        if folders.len() < config.folder_depth {
+            let index = name.strip_prefix("folder")?.parse::<usize>().ok()?;
+            if index >= config.folders_per_folder {
+                return None;
+            }
+            folders.push(index);
+        }
+        else {
+            let index = name.strip_prefix("project")?.parse::<usize>().ok()?;
+            if index >= config.jobs_per_folder {
+                return None;
+            }
+            return match segments {
+                [] => Some(Page::Job(folders, index)),
+                ["lastBuild"] => Some(Page::Build(folders, index, BuildKind::Last)),
+                ["lastSuccessfulBuild"] => Some(Page::Build(folders, index, BuildKind::LastSuccessful)),
+                ["lastCompletedBuild"] => Some(Page::Build(folders, index, BuildKind::LastCompleted)),
+                _ => None,
+            };
+        }
+    }
+
+    match segments {
+        [] => Some(Page::Folder(folders)),
+        _ => None,
+    }
+}
+
+fn page_value(data: &SharedData, page: &Page) -> Option<Value> {
+    match page {
+        Page::Folder(folders) => Some(folder_value(data, folders)),
+        Page::Job(folders, job) => Some(job_value(data, folders, *job)),
+        Page::Build(folders, job, kind) => build_value(data, folders, *job, *kind),
+    }
+}
+
+fn folder_url(data: &SharedData, folders: &[usize]) -> String {
+    let mut url = data.url.clone();
+    for folder in folders {
+        url += &format!("job/folder{}/", folder);
+    }
+    url
+}
+
+fn folder_value(data: &SharedData, folders: &[usize]) -> Value {
+    let url = folder_url(data, folders);
+    let name = folders.last().map_or(String::new(), |folder| format!("folder{}", folder));
+    let mut jobs = Vec::new();
+    if folders.len() < data.config.folder_depth {
+        for folder in 0..data.config.folders_per_folder {
+            let mut sub_folders = folders.to_vec();
+            sub_folders.push(folder);
+            let sub_folder_url = folder_url(data, &sub_folders);
+            jobs.push(Value::Object(vec![
+                ("_class", Value::String(FOLDER_CLASS.to_string())),
+                ("name", Value::String(format!("folder{}", folder))),
+                ("url", Value::String(sub_folder_url)),
+            ]));
+        }
+    }
+    else {
+        for job in 0..data.config.jobs_per_folder {
+            jobs.push(job_value(data, folders, job));
+        }
+    }
+
+    Value::Object(vec![
+        ("_class", Value::String(FOLDER_CLASS.to_string())),
+        ("description", Value::Null),
+        ("displayName", Value::String(name.clone())),
+        ("fullName", Value::String(name.clone())),
+        ("name", Value::String(name)),
+        ("url", Value::String(url)),
+        ("jobs", Value::Array(jobs)),
+    ])
+}
+
+// Every job gets a fixed number, so its state only depends on the configuration and the time.
+fn job_number(config: &MockJenkinsConfig, folders: &[usize], job: usize) -> u64 {
+    let folder_number = folders.iter().fold(0, |number, folder| number * config.folders_per_folder + folder);
+    (folder_number * config.jobs_per_folder + job) as u64
+}
+
+fn job_state(data: &SharedData, job_number: u64) -> JobState {
+    let mut number = 1 + (job_number % 7) as i64;
+    number += data.finished_builds.lock().unwrap().get(&job_number).copied().unwrap_or(0);
+    let mut building = false;
+    match data.config.rebuild_interval {
+        Some(rebuild_interval) if job_number % 100 < data.config.rebuilding_jobs_percent => {
+            let interval = std::cmp::max(rebuild_interval.as_millis(), 1);
+            let elapsed = data.started_at.elapsed().as_millis() + (job_number as u128 * 7919) % interval;
+            number += (elapsed / interval) as i64;
+            building = elapsed % interval < interval / 2;
+        }
+        _ => {}
+    }
+
+    let result = match (job_number + number as u64) % 10 {
+        0..=5 => "SUCCESS",
+        6 => "UNSTABLE",
+        7 | 8 => "FAILURE",
+        _ => "ABORTED",
+    };
+    JobState {
+        buildable: job_number % 20 != 19,
+        number,
+        building,
+        result,
+        culprits: if result == "FAILURE" { 1 + (job_number % 3) as usize } else { 0 },
+    }
+}
+
+fn job_value(data: &SharedData, folders: &[usize], job: usize) -> Value {
+    let job_number = job_number(&data.config, folders, job);
+    let state = job_state(data, job_number);
+    let name = format!("project{}", job);
+    let url = format!("{}job/{}/", folder_url(data, folders), name);
+    let color = match (state.buildable, state.result) {
+        (false, _) => "disabled",
+        (true, "SUCCESS") => "blue",
+        (true, "UNSTABLE") => "yellow",
+        (true, "FAILURE") => "red",
+        (true, _) => "aborted",
+    };
+    let color = if state.building { format!("{}_anime", color) } else { color.to_string() };
+
+    Value::Object(vec![
+        ("_class", Value::String(FREE_STYLE_PROJECT_CLASS.to_string())),
+        ("description", Value::String(String::new())),
+        ("displayName", Value::String(name.clone())),
+        ("fullName", Value::String(name.clone())),
+        ("name", Value::String(name)),
+        ("url", Value::String(url)),
+        ("buildable", Value::Bool(state.buildable)),
+        ("color", Value::String(color)),
+        ("inQueue", Value::Bool(false)),
+        ("nextBuildNumber", Value::Number(state.number + 1)),
+        ("lastBuild", build_value(data, folders, job, BuildKind::Last).unwrap_or(Value::Null)),
+        ("lastSuccessfulBuild", build_value(data, folders, job, BuildKind::LastSuccessful).unwrap_or(Value::Null)),
+        ("lastCompletedBuild", build_value(data, folders, job, BuildKind::LastCompleted).unwrap_or(Value::Null)),
+    ])
+}
+
+fn build_value(data: &SharedData, folders: &[usize], job: usize, kind: BuildKind) -> Option<Value> {
+    let job_number = job_number(&data.config, folders, job);
+    let state = job_state(data, job_number);
+    let (number, building, result) = match kind {
+        BuildKind::Last => (state.number, state.building, if state.building { None } else { Some(state.result) }),
+        BuildKind::LastCompleted if state.building => (state.number - 1, false, Some(state.result)),
+        BuildKind::LastCompleted => (state.number, false, Some(state.result)),
+        BuildKind::LastSuccessful if !state.building && state.result == "SUCCESS" => (state.number, false, Some("SUCCESS")),
+        BuildKind::LastSuccessful => (state.number - 1 - (job_number % 2) as i64, false, Some("SUCCESS")),
+    };
+    if number < 1 {
+        return None;
+    }
+
+    let url = format!("{}job/project{}/{}/", folder_url(data, folders), job, number);
+    let culprits = (0..if result == Some("FAILURE") { state.culprits } else { 0 })
+        .map(|culprit| Value::Object(vec![
+            ("absoluteUrl", Value::String(format!("{}user/user{}", data.url, culprit))),
+            ("fullName", Value::String(format!("User {}", culprit))),
+        ]))
+        .collect();
+    Some(Value::Object(vec![
+        ("_class", Value::String(FREE_STYLE_BUILD_CLASS.to_string())),
+        ("actions", Value::Array(vec![Value::Object(vec![
+            ("_class", Value::String("hudson.model.ParametersAction".to_string())),
+            ("parameters", Value::Array(vec![Value::Object(vec![
+                ("name", Value::String("PADDING".to_string())),
+                ("value", Value::String("x".repeat(data.config.build_padding))),
+            ])])),
+        ])])),
+        ("artifacts", Value::Array(Vec::new())),
+        ("building", Value::Bool(building)),
+        ("description", Value::Null),
+        ("displayName", Value::String(format!("#{}", number))),
+        ("duration", Value::Number(if building { 0 } else { 60000 + (job_number % 600) as i64 * 1000 })),
+        ("estimatedDuration", Value::Number(90000)),
+        ("fullDisplayName", Value::String(format!("project{} #{}", job, number))),
+        ("id", Value::String(number.to_string())),
+        ("keepLog", Value::Bool(false)),
+        ("number", Value::Number(number)),
+        ("result", result.map_or(Value::Null, |result| Value::String(result.to_string()))),
+        ("timestamp", Value::Number(1600000000000 + number * 3600000)),
+        ("url", Value::String(url)),
+        ("builtOn", Value::String(format!("agent{}", job_number % 4))),
+        ("changeSet", Value::Object(vec![
+            ("_class", Value::String("hudson.plugins.git.GitChangeSetList".to_string())),
+            ("items", Value::Array(Vec::new())),
+            ("kind", Value::String("git".to_string())),
+        ])),
+        ("culprits", Value::Array(culprits)),
+    ]))
+}
@@ -0,0 +1,78 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+use mock_jenkins::{MockJenkins, MockJenkinsConfig};
+
+use std::env;
+use std::thread::sleep;
+use std::time::Duration;
+
+fn parse_value<T: std::str::FromStr>(name: &str, value: Option<&String>) -> Result<T, String> {
+    match value.map(|value| value.parse::<T>()) {
+        Some(Ok(value)) => Ok(value),
+        _ => Err(format!("Invalid or missing value for '{}'.", name)),
+    }
+}
+
+fn parse_args(args: &[String]) -> Result<(String, MockJenkinsConfig), String> {
+    let mut address = "127.0.0.1:8080".to_string();
+    let mut config = MockJenkinsConfig::default();
+    let mut index = 1;
+    while index < args.len() {
+        let name = args[index].as_str();
+        let value = args.get(index + 1);
+        match name {
+            "--address" => address = parse_value(name, value)?,
+            "--depth" => config.folder_depth = parse_value(name, value)?,
+            "--folders" => config.folders_per_folder = parse_value(name, value)?,
+            "--jobs" => config.jobs_per_folder = parse_value(name, value)?,
+            "--latency-ms" => config.latency = Duration::from_millis(parse_value(name, value)?),
+            "--padding" => config.build_padding = parse_value(name, value)?,
+            "--rebuild-seconds" => config.rebuild_interval = Some(Duration::from_secs(parse_value(name, value)?)),
+            "--rebuilding-percent" => config.rebuilding_jobs_percent = parse_value(name, value)?,
+            "--no-etags" => {
+                config.etags = false;
+                index += 1;
+                continue;
+            }
+            "--last-modified" => {
+                config.last_modified = true;
+                index += 1;
+                continue;
+            }
+            _ => return Err(format!("Unknown option '{}'.", name)),
+        }
+        index += 2;
+    }
+    Ok((address, config))
+}
+
+fn main() {
+    let args: Vec<String> = env::args().collect();
+    let (address, config) = match parse_args(&args) {
+        Ok(options) => options,
+        Err(e) => {
+            eprintln!("{}", e);
+            println!(concat!("Usage mock_jenkins [--address {{address}}] [--depth {{folder_levels}}] ",
+                "[--folders {{folders_per_folder}}] [--jobs {{jobs_per_folder}}] [--latency-ms {{milliseconds}}] ",
+                "[--padding {{bytes_per_build}}] [--rebuild-seconds {{seconds}}] [--rebuilding-percent {{percent}}] ",
+                "[--no-etags] [--last-modified]"));
+            return;
+        }
+    };
+
+    let jenkins = match MockJenkins::start(&address, config) {
+        Ok(jenkins) => jenkins,
+        Err(e) => {
+            eprintln!("Failed to start mock Jenkins on {}. Error: {}", address, e);
+            return;
+        }
+    };
+    println!("Serving {} projects on {}", jenkins.project_count(), jenkins.url());
+
+    loop {
+        sleep(Duration::new(10, 0));
+        let statistics = jenkins.statistics();
+        println!("Requests: {}, not modified: {}, sent: {} bytes.",
+            statistics.requests, statistics.not_modified, statistics.bytes_sent);
+    }
+}
@@ -0,0 +1,146 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// A minimal JSON document with support for Jenkins' tree parameter, which limits a response to the
+// listed fields, for example 'jobs[name,lastBuild[number,building]]'.
+
+pub enum Value {
+    Null,
+    Bool(bool),
+    Number(i64),
+    String(String),
+    Array(Vec<Value>),
+    Object(Vec<(&'static str, Value)>),
+}
+
+pub struct TreeField {
+    name: String,
+    children: Vec<TreeField>,
+}
+
+// Parses the value of the tree parameter. Returns None for a malformed tree.
+pub fn parse_tree(tree: &str) -> Option<Vec<TreeField>> {
+    let mut position = 0;
+    let fields = parse_tree_fields(tree.as_bytes(), &mut position)?;
+    if position == tree.len() {
+        Some(fields)
+    }
+    else {
+        None
+    }
+}
+
+fn parse_tree_fields(tree: &[u8], position: &mut usize) -> Option<Vec<TreeField>> {
+    let mut fields = Vec::new();
+    loop {
+        let start = *position;
+        while *position < tree.len() && !b",[]".contains(&tree[*position]) {
+            *position += 1;
+        }
+        let name = String::from_utf8(tree[start..*position].to_vec()).ok()?;
+        let mut children = Vec::new();
+        if *position < tree.len() && tree[*position] == b'[' {
+            *position += 1;
+            children = parse_tree_fields(tree, position)?;
+            if *position >= tree.len() || tree[*position] != b']' {
+                return None;
+            }
+            *position += 1;
+        }
+        if !name.is_empty() {
+            fields.push(TreeField { name, children });
+        }
+        if *position < tree.len() && tree[*position] == b',' {
+            *position += 1;
+        }
+        else {
+            return Some(fields);
+        }
+    }
+}
+
+impl Value {
+    // Drops every field that isn't part of the tree. An empty tree keeps everything.
+    pub fn filter(self, tree: &[TreeField]) -> Value {
+        if tree.is_empty() {
+            return self;
+        }
+        match self {
+            Value::Array(values) => Value::Array(values.into_iter().map(|value| value.filter(tree)).collect()),
+            Value::Object(fields) => Value::Object(fields
+                .into_iter()
+                .filter_map(|(name, value)| tree
+                    .iter()
+                    .find(|field| field.name == name)
+                    .map(|field| (name, value.filter(&field.children))))
+                .collect()),
+            value => value,
+        }
+    }
+
+    pub fn write(&self, output: &mut String) {
+        match self {
+            Value::Null => output.push_str("null"),
+            Value::Bool(value) => output.push_str(if *value { "true" } else { "false" }),
+            Value::Number(value) => output.push_str(&value.to_string()),
+            Value::String(value) => {
+                output.push('"');
+                for character in value.chars() {
+                    match character {
+                        '"' => output.push_str("\\\""),
+                        '\\' => output.push_str("\\\\"),
+                        character if (character as u32) < 0x20 => output.push_str(&format!("\\u{:04x}", character as u32)),
+                        character => output.push(character),
+                    }
+                }
+                output.push('"');
+            }
+            Value::Array(values) => {
+                output.push('[');
+                for (index, value) in values.iter().enumerate() {
+                    if index > 0 {
+                        output.push(',');
+                    }
+                    value.write(output);
+                }
+                output.push(']');
+            }
+            Value::Object(fields) => {
+                output.push('{');
+                for (index, (name, value)) in fields.iter().enumerate() {
+                    if index > 0 {
+                        output.push(',');
+                    }
+                    Value::String(name.to_string()).write(output);
+                    output.push(':');
+                    value.write(output);
+                }
+                output.push('}');
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{parse_tree, Value};
+
+    #[test]
+    fn filter_test() {
+        let value = Value::Object(vec![
+            ("jobs", Value::Array(vec![Value::Object(vec![
+                ("name", Value::String("Build \"1\"".to_string())),
+                ("color", Value::String("blue".to_string())),
+                ("lastBuild", Value::Object(vec![("number", Value::Number(3)), ("building", Value::Bool(false))])),
+            ])])),
+            ("description", Value::Null),
+        ]);
+
+        let tree = parse_tree("jobs[name,lastBuild[number]]").unwrap();
+        let mut output = String::new();
+        value.filter(&tree).write(&mut output);
+        assert_eq!(output, r#"{"jobs":[{"name":"Build \"1\"","lastBuild":{"number":3}}]}"#);
+
+        assert!(parse_tree("jobs[name").is_none());
+        assert!(parse_tree("jobs]").is_none());
+    }
+}
@@ -0,0 +1,428 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Messages that don't fit in a single datagram are split into ProjectChunk messages, which the
+// receiver puts back together into the original message.
+
+use crate::monitor::{Header, MessageType, HEADER_SIZE};
+
+use mio::net::UdpSocket;
+use serde::{Deserialize, Serialize};
+use std::collections::{HashMap, VecDeque};
+use std::net::SocketAddr;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+// Stays below the 65507 bytes an IPv4 UDP datagram can carry.
+pub const MAX_DATAGRAM_SIZE: usize = 60 * 1024;
+// Fits any datagram, for the buffers that datagrams are received in.
+pub const MAX_RECEIVE_SIZE: usize = 64 * 1024;
+// The receive buffer that is requested for sockets that receive bursts, like the chunks of a message
+// or the requests of many clients, so they aren't dropped before they're read. The system may limit
+// it further.
+pub const SOCKET_RECV_BUFFER_SIZE: usize = 8 * 1024 * 1024;
+// How long a message may take to arrive completely, before its chunks are dropped.
+pub const REASSEMBLY_TIMEOUT: Duration = Duration::from_secs(5);
+// The most memory that is used for messages that didn't arrive completely yet.
+pub const MAX_REASSEMBLY_SIZE: usize = 64 * 1024 * 1024;
+
+// Gives the receiver a moment to read the previous chunk, so they don't overflow its receive buffer.
+const CHUNK_INTERVAL: Duration = Duration::from_micros(200);
+// How many completed messages are remembered, so chunks that are sent again for other receivers don't
+// start them over.
+const MAX_COMPLETED_MESSAGES: usize = 64;
+
+#[derive(Deserialize, Serialize)]
+pub struct ChunkHeader {
+    pub message_id: u64,
+    pub chunk_index: u32,
+    pub chunk_count: u32,
+}
+
+struct Reassembly {
+    chunks: Vec<Option<Vec<u8>>>,
+    received_chunks: usize,
+    size: usize,
+    started_at: Instant,
+    // When the last chunk arrived, or the missing chunks were last asked for.
+    last_activity: Instant,
+}
+
+impl Reassembly {
+    // The memory of the received chunks and of the slots for all chunks.
+    fn memory_size(&self) -> usize {
+        self.size + self.chunks.len() * std::mem::size_of::<Option<Vec<u8>>>()
+    }
+}
+
+// Puts the chunks of messages back together, per sender and message id.
+pub struct Reassembler {
+    reassemblies: HashMap<(SocketAddr, u64), Reassembly>,
+    size: usize,
+    // The messages in the order they started, so the oldest are found without going through all of
+    // them. Messages that were completed or dropped already are skipped when they come up.
+    started: VecDeque<((SocketAddr, u64), Instant)>,
+    completed: VecDeque<(SocketAddr, u64)>,
+}
+
+fn next_message_id() -> u64 {
+    // Starts at the time, so the ids of a restarted server don't match the chunks of the previous run.
+    static NEXT_MESSAGE_ID: AtomicU64 = AtomicU64::new(0);
+    let _ = NEXT_MESSAGE_ID.compare_exchange(
+        0,
+        SystemTime::now().duration_since(UNIX_EPOCH).map(|time| time.as_nanos() as u64).unwrap_or(1),
+        Ordering::Relaxed,
+        Ordering::Relaxed);
+    NEXT_MESSAGE_ID.fetch_add(1, Ordering::Relaxed)
+}
+
+pub fn send_datagram(socket: &UdpSocket, datagram: &[u8], address: &SocketAddr) -> std::io::Result<()> {
+    loop {
+        match socket.send_to(datagram, *address) {
+            Ok(_) => return Ok(()),
+            // The socket is non blocking, wait for the send buffer to drain.
+            Err(error) if error.kind() == std::io::ErrorKind::WouldBlock => std::thread::sleep(CHUNK_INTERVAL),
+            Err(error) => return Err(error),
+        }
+    }
+}
+
+fn chunk_header_size() -> usize {
+    bincode::serialized_size(&ChunkHeader { message_id: 0, chunk_index: 0, chunk_count: 0 }).unwrap() as usize
+}
+
+// The most data a chunk carries.
+fn chunk_size() -> usize {
+    MAX_DATAGRAM_SIZE - HEADER_SIZE - chunk_header_size()
+}
+
+// The most chunks a message that fits in the reassembly memory is split into.
+fn max_chunk_count() -> usize {
+    MAX_REASSEMBLY_SIZE / chunk_size()
+}
+
+// Calls write_chunk with the datagram of every chunk of a message that doesn't fit in a single datagram.
+fn for_each_chunk<F>(version: u32, message: &[u8], mut write_chunk: F) -> std::io::Result<()>
+    where F: FnMut(&[u8]) -> std::io::Result<()> {
+    let mut chunk_header = ChunkHeader {
+        message_id: next_message_id(),
+        chunk_index: 0,
+        chunk_count: 0,
+    };
+    let chunk_header_size = chunk_header_size();
+    let chunk_size = chunk_size();
+    chunk_header.chunk_count = ((message.len() + chunk_size - 1) / chunk_size) as u32;
+
+    let mut datagram = Vec::with_capacity(MAX_DATAGRAM_SIZE);
+    for (chunk_index, chunk) in message.chunks(chunk_size).enumerate() {
+        chunk_header.chunk_index = chunk_index as u32;
+        let mut header = Header::new();
+        header.version = version;
+        header.msg_type = MessageType::ProjectChunk;
+        header.msg_size = (chunk_header_size + chunk.len()) as u32;
+
+        datagram.clear();
+        bincode::serialize_into(&mut datagram, &header).unwrap();
+        bincode::serialize_into(&mut datagram, &chunk_header).unwrap();
+        datagram.extend_from_slice(chunk);
+        write_chunk(&datagram)?;
+    }
+    Ok(())
+}
+
+// Sends the message, which starts with its header, in a single datagram when it fits and in chunks
+// otherwise. Returns how many bytes were sent, with the headers of the chunks.
+pub fn send_message(socket: &UdpSocket, version: u32, message: &[u8], address: &SocketAddr) -> std::io::Result<usize> {
+    if message.len() <= MAX_DATAGRAM_SIZE {
+        send_datagram(socket, message, address)?;
+        return Ok(message.len());
+    }
+
+    let mut bytes_sent = 0;
+    for_each_chunk(version, message, |datagram| {
+        send_datagram(socket, datagram, address)?;
+        bytes_sent += datagram.len();
+        std::thread::sleep(CHUNK_INTERVAL);
+        Ok(())
+    })?;
+    Ok(bytes_sent)
+}
+
+// Returns the datagrams send_message would send for the message, for a sender that keeps them to send
+// them again, with the message id of their chunks. The id is 0 when the message fits in one datagram.
+pub fn split_message(version: u32, message: &[u8]) -> (u64, Vec<Vec<u8>>) {
+    if message.len() <= MAX_DATAGRAM_SIZE {
+        return (0, vec![message.to_vec()]);
+    }
+
+    let mut datagrams = Vec::new();
+    for_each_chunk(version, message, |datagram| {
+        datagrams.push(datagram.to_vec());
+        Ok(())
+    }).unwrap();
+    let message_id = bincode::deserialize::<ChunkHeader>(&datagrams[0][HEADER_SIZE..]).unwrap().message_id;
+    (message_id, datagrams)
+}
+
+// Sends the datagrams of split_message the way send_message does. Returns how many bytes were sent.
+pub fn send_datagrams(socket: &UdpSocket, datagrams: &[Vec<u8>], address: &SocketAddr) -> std::io::Result<usize> {
+    let mut bytes_sent = 0;
+    for (index, datagram) in datagrams.iter().enumerate() {
+        if index > 0 {
+            std::thread::sleep(CHUNK_INTERVAL);
+        }
+        send_datagram(socket, datagram, address)?;
+        bytes_sent += datagram.len();
+    }
+    Ok(bytes_sent)
+}
+
+impl Reassembler {
+    pub fn new() -> Reassembler {
+        Reassembler {
+            reassemblies: HashMap::new(),
+            size: 0,
+            started: VecDeque::new(),
+            completed: VecDeque::new(),
+        }
+    }
+
+    // Whether chunks of a message are waiting for the rest of the message.
+    pub fn is_reassembling(&self) -> bool {
+        !self.reassemblies.is_empty()
+    }
+
+    // Adds the body of a ProjectChunk message. Returns the original message, including its header,
+    // once all of its chunks were received.
+    pub fn add_chunk(&mut self, from: SocketAddr, chunk: &[u8]) -> Option<Vec<u8>> {
+        self.remove_expired();
+
+        let chunk_header_size = chunk_header_size();
+        if chunk.len() < chunk_header_size {
+            return None;
+        }
+        let chunk_header = bincode::deserialize::<ChunkHeader>(&chunk[..chunk_header_size]).ok()?;
+        let data = &chunk[chunk_header_size..];
+        let chunk_count = chunk_header.chunk_count as usize;
+        // The chunk count is checked on its own, the slots for the chunks are allocated before they arrive.
+        if chunk_header.chunk_index >= chunk_header.chunk_count || chunk_count > max_chunk_count() ||
+            data.is_empty() || data.len() > chunk_size() {
+            eprintln!("Dropping an invalid chunk from {}.", from);
+            return None;
+        }
+
+        let key = (from, chunk_header.message_id);
+        if self.completed.contains(&key) {
+            return None;
+        }
+        match self.reassemblies.get(&key) {
+            Some(reassembly) => {
+                if reassembly.chunks.len() != chunk_count || reassembly.chunks[chunk_header.chunk_index as usize].is_some() {
+                    return None;
+                }
+            }
+            None => {}
+        }
+
+        // The oldest messages make room for the new chunk, and for the slots of its message when it's new.
+        loop {
+            let slots_size = if self.reassemblies.contains_key(&key) { 0 } else { chunk_count * std::mem::size_of::<Option<Vec<u8>>>() };
+            if self.size + slots_size + data.len() <= MAX_REASSEMBLY_SIZE {
+                break;
+            }
+            let (oldest, started_at) = self.started.pop_front()?;
+            if self.is_started_at(&oldest, started_at) {
+                eprintln!("Dropping an incomplete message from {} to stay within the memory limit.", oldest.0);
+                self.remove(&oldest);
+            }
+        }
+
+        if !self.reassemblies.contains_key(&key) {
+            let started_at = Instant::now();
+            let reassembly = Reassembly {
+                chunks: vec![None; chunk_count],
+                received_chunks: 0,
+                size: 0,
+                started_at,
+                last_activity: started_at,
+            };
+            self.size += reassembly.memory_size();
+            self.reassemblies.insert(key, reassembly);
+            self.started.push_back((key, started_at));
+        }
+        let reassembly = self.reassemblies.get_mut(&key)?;
+        reassembly.chunks[chunk_header.chunk_index as usize] = Some(data.to_vec());
+        reassembly.received_chunks += 1;
+        reassembly.size += data.len();
+        reassembly.last_activity = Instant::now();
+        self.size += data.len();
+        if reassembly.received_chunks < chunk_count {
+            return None;
+        }
+
+        let reassembly = self.remove(&key)?;
+        if self.completed.len() == MAX_COMPLETED_MESSAGES {
+            self.completed.pop_front();
+        }
+        self.completed.push_back(key);
+        let mut message = Vec::with_capacity(reassembly.size);
+        for chunk in reassembly.chunks.into_iter() {
+            message.extend_from_slice(&chunk.unwrap());
+        }
+        Some(message)
+    }
+
+    fn remove(&mut self, key: &(SocketAddr, u64)) -> Option<Reassembly> {
+        let reassembly = self.reassemblies.remove(key)?;
+        self.size -= reassembly.memory_size();
+        Some(reassembly)
+    }
+
+    // Whether the message is still being reassembled since then, and wasn't completed or dropped.
+    fn is_started_at(&self, key: &(SocketAddr, u64), started_at: Instant) -> bool {
+        self.reassemblies.get(key).map_or(false, |reassembly| reassembly.started_at == started_at)
+    }
+
+    // Returns the indices of the chunks that are missing, per sender and message id, of the messages that
+    // received nothing for the idle time. Their idle time starts over, so they're returned once per idle
+    // time while the chunks are sent again.
+    pub fn missing_chunks(&mut self, idle: Duration) -> Vec<(SocketAddr, u64, Vec<u32>)> {
+        let now = Instant::now();
+        self.reassemblies
+            .iter_mut()
+            .filter(|(_, reassembly)| now.duration_since(reassembly.last_activity) >= idle)
+            .map(|(key, reassembly)| {
+                reassembly.last_activity = now;
+                let missing = reassembly.chunks
+                    .iter()
+                    .enumerate()
+                    .filter(|(_, chunk)| chunk.is_none())
+                    .map(|(index, _)| index as u32)
+                    .collect();
+                (key.0, key.1, missing)
+            })
+            .collect()
+    }
+
+    // Drops the messages whose chunks didn't all arrive within the reassembly timeout.
+    pub fn remove_expired(&mut self) {
+        while let Some(&(key, started_at)) = self.started.front() {
+            if started_at.elapsed() < REASSEMBLY_TIMEOUT {
+                break;
+            }
+            self.started.pop_front();
+            if self.is_started_at(&key, started_at) {
+                eprintln!("Dropping an incomplete message from {}, the rest didn't arrive in time.", key.0);
+                self.remove(&key);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn reassemble_test() {
+        let sender = UdpSocket::bind("127.0.0.1:0".parse().unwrap()).unwrap();
+        let receiver = std::net::UdpSocket::bind("127.0.0.1:0").unwrap();
+        receiver.set_read_timeout(Some(Duration::from_secs(5))).unwrap();
+        let message: Vec<u8> = (0..3 * MAX_DATAGRAM_SIZE).map(|index| (index % 251) as u8).collect();
+        send_message(&sender, 1, &message, &receiver.local_addr().unwrap()).unwrap();
+
+        let mut reassembler = Reassembler::new();
+        let mut recv_buffer = vec![0; MAX_DATAGRAM_SIZE];
+        let mut chunks = Vec::new();
+        loop {
+            let (bytes_read, from) = receiver.recv_from(&mut recv_buffer).unwrap();
+            let (header, header_size) = Header::from_bytes(&recv_buffer[..bytes_read]).unwrap();
+            assert!(header.msg_type == MessageType::ProjectChunk);
+            chunks.push(recv_buffer[header_size..bytes_read].to_vec());
+            // Chunks can arrive in any order.
+            if chunks.len() == 4 {
+                chunks.reverse();
+                let mut result = None;
+                for chunk in chunks.iter() {
+                    assert!(result.is_none());
+                    result = reassembler.add_chunk(from, chunk);
+                }
+                assert!(result.unwrap() == message);
+                assert!(!reassembler.is_reassembling());
+                break;
+            }
+        }
+    }
+
+    #[test]
+    fn missing_chunks_test() {
+        let from = "127.0.0.1:8000".parse().unwrap();
+        let message: Vec<u8> = (0..3 * MAX_DATAGRAM_SIZE).map(|index| (index % 251) as u8).collect();
+        let (message_id, datagrams) = split_message(1, &message);
+        assert!(datagrams.len() == 4);
+        assert!(split_message(1, &message[..100]) == (0, vec![message[..100].to_vec()]));
+
+        let mut reassembler = Reassembler::new();
+        assert!(reassembler.add_chunk(from, &datagrams[0][HEADER_SIZE..]).is_none());
+        assert!(reassembler.add_chunk(from, &datagrams[2][HEADER_SIZE..]).is_none());
+        // Only messages that received nothing for the idle time are missing chunks, once per idle time.
+        assert!(reassembler.missing_chunks(Duration::from_secs(60)).is_empty());
+        let missing = reassembler.missing_chunks(Duration::from_secs(0));
+        assert!(missing == vec![(from, message_id, vec![1, 3])]);
+
+        assert!(reassembler.add_chunk(from, &datagrams[3][HEADER_SIZE..]).is_none());
+        assert!(reassembler.add_chunk(from, &datagrams[1][HEADER_SIZE..]).unwrap() == message);
+        // Chunks that are sent again for other receivers don't start the message over.
+        assert!(reassembler.add_chunk(from, &datagrams[1][HEADER_SIZE..]).is_none());
+        assert!(!reassembler.is_reassembling());
+    }
+
+    #[test]
+    fn invalid_chunk_test() {
+        let from = "127.0.0.1:8000".parse().unwrap();
+        let chunk = |chunk_count: u32, data: &[u8]| {
+            let mut chunk = bincode::serialize(&ChunkHeader { message_id: 1, chunk_index: 0, chunk_count }).unwrap();
+            chunk.extend_from_slice(data);
+            chunk
+        };
+        let mut reassembler = Reassembler::new();
+
+        // Empty chunks, and chunk counts that couldn't fit in the reassembly memory, are dropped before
+        // anything is allocated for them.
+        assert!(reassembler.add_chunk(from, &chunk(2, &[])).is_none());
+        assert!(reassembler.add_chunk(from, &chunk(u32::MAX, &[])).is_none());
+        assert!(reassembler.add_chunk(from, &chunk(u32::MAX, &[1])).is_none());
+        assert!(reassembler.add_chunk(from, &chunk(max_chunk_count() as u32 + 1, &[1])).is_none());
+        assert!(reassembler.add_chunk(from, &chunk(2, &vec![1; chunk_size() + 1])).is_none());
+        assert!(!reassembler.is_reassembling());
+
+        // The slots for the chunks count toward the memory limit too.
+        assert!(reassembler.add_chunk(from, &chunk(max_chunk_count() as u32, &[1])).is_none());
+        assert!(reassembler.is_reassembling());
+        assert!(reassembler.size == 1 + max_chunk_count() * std::mem::size_of::<Option<Vec<u8>>>());
+    }
+
+    #[test]
+    fn memory_limit_test() {
+        let from = "127.0.0.1:8000".parse().unwrap();
+        let data = vec![1; chunk_size()];
+        let chunk = |message_id: u64, chunk_index: u32| {
+            let mut chunk = bincode::serialize(&ChunkHeader { message_id, chunk_index, chunk_count: 2 }).unwrap();
+            chunk.extend_from_slice(&data);
+            chunk
+        };
+        let mut reassembler = Reassembler::new();
+
+        // Completed messages leave the memory, and the oldest incomplete message makes room for new ones.
+        assert!(reassembler.add_chunk(from, &chunk(0, 0)).is_none());
+        assert!(reassembler.add_chunk(from, &chunk(0, 1)).is_some());
+        assert!(reassembler.size == 0);
+        let messages = (MAX_REASSEMBLY_SIZE / chunk_size()) as u64;
+        for message_id in 1..=messages {
+            assert!(reassembler.add_chunk(from, &chunk(message_id, 0)).is_none());
+        }
+        assert!(reassembler.size <= MAX_REASSEMBLY_SIZE);
+        assert!(!reassembler.reassemblies.contains_key(&(from, 1)));
+        assert!(reassembler.reassemblies.contains_key(&(from, messages)));
+        assert!(reassembler.add_chunk(from, &chunk(messages, 1)).is_some());
+    }
+}
@@ -0,0 +1,537 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+use crate::error::BuildMonitorError;
+use crate::jenkins_api::{Job, JobList, FOLDER_CLASS, FREE_STYLE_PROJECT_CLASS};
+use crate::jenkins_client::{CacheStatistics, JenkinsClient};
+use crate::project::{Project, JOB_TREE};
+use crate::utils::url_path;
+
+use futures::executor::block_on;
+use std::collections::{HashMap, VecDeque};
+use std::sync::{Arc, Condvar, Mutex};
+use std::time::{Duration, Instant};
+
+pub const DEFAULT_MAX_CONCURRENT_REQUESTS: usize = 8;
+pub const DEFAULT_TOPOLOGY_REFRESH_INTERVAL: Duration = Duration::from_secs(10 * 60);
+pub const DEFAULT_CRAWL_DEADLINE: Duration = Duration::from_secs(5 * 60);
+
+// A folder or project is skipped after this many failed refreshes in a row, for a period that
+// doubles with every failure after that.
+const CIRCUIT_BREAKER_THRESHOLD: u32 = 3;
+const CIRCUIT_BREAKER_MIN_BACKOFF: Duration = Duration::from_secs(30);
+const CIRCUIT_BREAKER_MAX_BACKOFF: Duration = Duration::from_secs(15 * 60);
+
+#[derive(Clone, Copy, PartialEq)]
+pub enum CrawlMode {
+    // Lists the jobs of every folder and requests the status of each project separately.
+    PerProject,
+    // Requests the jobs of a folder together with the status of each project in a single request.
+    Bulk,
+}
+
+// The folders and projects that couldn't be refreshed during the last crawl. They kept the state
+// of the crawl before.
+#[derive(Clone, Copy, Default)]
+pub struct CrawlHealth {
+    pub failed: usize,
+    // Skipped because they failed too often recently, or because the crawl ran out of time.
+    pub skipped: usize,
+}
+
+// The fields of a job that tell whether its status could have changed since the last crawl.
+const PROBE_TREE: &str = "url,buildable,lastBuild[number,building]";
+
+#[derive(Clone, PartialEq)]
+struct BuildProbe {
+    buildable: bool,
+    last_build_number: Option<u64>,
+    is_building: bool,
+}
+
+// The folders that were found during the last crawl that searched the whole folder tree.
+struct FolderTopology {
+    folders: Vec<String>,
+    discovered_at: Instant,
+}
+
+struct KnownProject {
+    probe: BuildProbe,
+    project: Project,
+}
+
+struct CircuitBreaker {
+    consecutive_failures: u32,
+    retry_at: Instant,
+}
+
+enum CrawlTask {
+    Folder(String),
+    Project(KnownProject),
+}
+
+struct CrawlQueue {
+    tasks: VecDeque<CrawlTask>,
+    in_progress: usize,
+    deadline: Instant,
+    // Whether sub folders are crawled, or only the folders that were queued at the start.
+    discover_folders: bool,
+    folders: Vec<String>,
+    projects: Vec<Project>,
+    known_projects: HashMap<String, KnownProject>,
+    // The urls of folders and projects that weren't refreshed. Every project at or below them keeps
+    // its state from the previous crawl.
+    unfinished: Vec<String>,
+    has_unfinished_folders: bool,
+    has_moved_folders: bool,
+    succeeded: usize,
+    health: CrawlHealth,
+    error: Option<BuildMonitorError>,
+}
+
+// Counts a task as in progress until it's dropped, also when the worker panics while running it, so the
+// other workers don't wait for it forever.
+struct TaskInProgress<'a> {
+    queue: &'a Mutex<CrawlQueue>,
+    queue_changed: &'a Condvar,
+}
+
+impl<'a> Drop for TaskInProgress<'a> {
+    fn drop(&mut self) {
+        self.queue.lock().unwrap_or_else(|error| error.into_inner()).in_progress -= 1;
+        self.queue_changed.notify_all();
+    }
+}
+
+enum CrawlResult {
+    Folder(RefreshedFolder),
+    Project(KnownProject),
+}
+
+struct RefreshedFolder {
+    folders: Vec<String>,
+    // Projects whose last build changed and still need a refresh.
+    projects: Vec<KnownProject>,
+    // Projects that are up to date, either because their last build didn't change since the previous
+    // crawl or because their status was part of the folder.
+    finished_projects: Vec<KnownProject>,
+    failed_projects: Vec<String>,
+}
+
+pub struct Crawler {
+    jenkins_server: String,
+    max_concurrent_requests: usize,
+    crawl_mode: CrawlMode,
+    crawl_deadline: Duration,
+    client: JenkinsClient,
+    known_projects: Mutex<HashMap<String, KnownProject>>,
+    topology: Mutex<Option<FolderTopology>>,
+    topology_refresh_interval: Duration,
+    circuit_breakers: Mutex<HashMap<String, CircuitBreaker>>,
+    health: Mutex<CrawlHealth>,
+}
+
+impl BuildProbe {
+    fn from_job(job: &Job) -> BuildProbe {
+        BuildProbe {
+            buildable: job.buildable.unwrap_or(true),
+            last_build_number: job.last_build.as_ref().and_then(|build| build.number),
+            is_building: job.last_build.as_ref().and_then(|build| build.building).unwrap_or(false),
+        }
+    }
+}
+
+impl CrawlTask {
+    fn url(&self) -> &str {
+        match self {
+            CrawlTask::Folder(url) => url,
+            CrawlTask::Project(known_project) => known_project.project.url(),
+        }
+    }
+}
+
+impl CrawlQueue {
+    fn add_known_project(&mut self, known_project: KnownProject) {
+        self.projects.push(known_project.project.clone());
+        self.known_projects.insert(known_project.project.url().to_string(), known_project);
+    }
+
+    fn add_unfinished(&mut self, task: &CrawlTask) {
+        if let CrawlTask::Folder(_) = task {
+            self.has_unfinished_folders = true;
+        }
+        self.unfinished.push(task.url().to_string());
+    }
+}
+
+impl Crawler {
+    pub fn new(jenkins_server: &str) -> Crawler {
+        Crawler {
+            jenkins_server: jenkins_server.to_string(),
+            max_concurrent_requests: DEFAULT_MAX_CONCURRENT_REQUESTS,
+            crawl_mode: CrawlMode::PerProject,
+            crawl_deadline: DEFAULT_CRAWL_DEADLINE,
+            client: JenkinsClient::new(),
+            known_projects: Mutex::new(HashMap::new()),
+            topology: Mutex::new(None),
+            topology_refresh_interval: DEFAULT_TOPOLOGY_REFRESH_INTERVAL,
+            circuit_breakers: Mutex::new(HashMap::new()),
+            health: Mutex::new(CrawlHealth::default()),
+        }
+    }
+
+    pub fn jenkins_server(&self) -> &str {
+        &self.jenkins_server
+    }
+
+    pub fn max_concurrent_requests(&self) -> usize {
+        self.max_concurrent_requests
+    }
+
+    pub fn set_max_concurrent_requests(&mut self, max_concurrent_requests: usize) {
+        self.max_concurrent_requests = std::cmp::max(max_concurrent_requests, 1);
+    }
+
+    pub fn crawl_mode(&self) -> CrawlMode {
+        self.crawl_mode
+    }
+
+    pub fn set_crawl_mode(&mut self, crawl_mode: CrawlMode) {
+        self.crawl_mode = crawl_mode;
+    }
+
+    pub fn request_timeout(&self) -> Duration {
+        self.client.request_timeout()
+    }
+
+    pub fn set_request_timeout(&mut self, request_timeout: Duration) {
+        self.client.set_request_timeout(request_timeout);
+    }
+
+    pub fn crawl_deadline(&self) -> Duration {
+        self.crawl_deadline
+    }
+
+    pub fn set_crawl_deadline(&mut self, crawl_deadline: Duration) {
+        self.crawl_deadline = crawl_deadline;
+    }
+
+    pub fn topology_refresh_interval(&self) -> Duration {
+        self.topology_refresh_interval
+    }
+
+    pub fn set_topology_refresh_interval(&mut self, topology_refresh_interval: Duration) {
+        self.topology_refresh_interval = topology_refresh_interval;
+    }
+
+    // Makes the next crawl search the whole folder tree again, instead of only the known folders.
+    pub fn invalidate_topology(&self) {
+        *self.topology.lock().unwrap() = None;
+    }
+
+    // The cache statistics of the last crawl.
+    pub fn cache_statistics(&self) -> CacheStatistics {
+        self.client.cache_statistics()
+    }
+
+    pub fn crawl_health(&self) -> CrawlHealth {
+        *self.health.lock().unwrap()
+    }
+
+    // Crawls every folder and project reachable from the Jenkins server. Folders and projects are
+    // handed out to a fixed set of workers so that up to max_concurrent_requests requests are in
+    // flight at the same time.
+    // The folder tree is only searched once per topology_refresh_interval. In between, all known
+    // folders are queued at once, so no request has to wait for the listing of its parent folder.
+    // Folders and projects that fail, or that are still queued when the crawl deadline passes, keep
+    // the state of the previous crawl. Only when nothing could be refreshed is the first error returned.
+    pub fn crawl(&self) -> Result<Vec<Project>, BuildMonitorError> {
+        let crawl_start = Instant::now();
+        let known_folders = match &*self.topology.lock().unwrap() {
+            Some(topology) if topology.discovered_at.elapsed() < self.topology_refresh_interval => Some(topology.folders.clone()),
+            _ => None,
+        };
+        let discover_folders = known_folders.is_none();
+        let tasks: VecDeque<CrawlTask> = known_folders
+            .unwrap_or_else(|| vec![self.jenkins_server.clone()])
+            .into_iter()
+            .map(CrawlTask::Folder)
+            .collect();
+        let queue = Mutex::new(CrawlQueue {
+            tasks,
+            in_progress: 0,
+            deadline: crawl_start + self.crawl_deadline,
+            discover_folders,
+            folders: Vec::new(),
+            projects: Vec::new(),
+            known_projects: HashMap::new(),
+            unfinished: Vec::new(),
+            has_unfinished_folders: false,
+            has_moved_folders: false,
+            succeeded: 0,
+            health: CrawlHealth::default(),
+            error: None,
+        });
+        let queue_changed = Condvar::new();
+
+        self.client.begin_crawl();
+        std::thread::scope(|scope| {
+            for _ in 0..self.max_concurrent_requests {
+                scope.spawn(|| self.crawl_worker(&queue, &queue_changed));
+            }
+        });
+        self.client.end_crawl();
+
+        let mut queue = queue.into_inner().unwrap();
+        // Whatever is still queued ran out of time.
+        while let Some(task) = queue.tasks.pop_front() {
+            queue.health.skipped += 1;
+            queue.add_unfinished(&task);
+        }
+        *self.health.lock().unwrap() = queue.health;
+
+        if queue.succeeded == 0 {
+            if let Some(error) = queue.error {
+                return Err(error);
+            }
+        }
+
+        let mut known_projects = self.known_projects.lock().unwrap();
+        for (url, known_project) in known_projects.drain() {
+            if !queue.known_projects.contains_key(&url) && queue.unfinished.iter().any(|unfinished| url.starts_with(unfinished.as_str())) {
+                queue.add_known_project(known_project);
+            }
+        }
+        *known_projects = queue.known_projects;
+
+        if discover_folders && !queue.has_unfinished_folders {
+            *self.topology.lock().unwrap() = Some(FolderTopology {
+                folders: queue.folders,
+                discovered_at: crawl_start,
+            });
+        }
+        // A known folder was moved or removed, search the folder tree again next time.
+        if !discover_folders && queue.has_moved_folders {
+            self.invalidate_topology();
+        }
+
+        Ok(queue.projects)
+    }
+
+    // Refreshes a single project that was found by an earlier crawl, for example after Jenkins sent a
+    // notification for it. The url may be absolute or relative to Jenkins. Returns None for projects
+    // that weren't found yet, those show up in the next crawl.
+    pub fn refresh_project(&self, job_url: &str) -> Result<Option<Project>, BuildMonitorError> {
+        let job_path = if job_url.contains("://") {
+            url_path(job_url).to_string()
+        }
+        else {
+            url_path(&self.jenkins_server).trim_end_matches('/').to_string() + "/" + job_url.trim_start_matches('/')
+        };
+        // The project is refreshed from scratch like in a crawl, refreshing the known one would add its
+        // culprits again and keep it disabled. Only the volunteer carries over.
+        let mut project = {
+            let known_projects = self.known_projects.lock().unwrap();
+            let known_project = known_projects
+                .values()
+                .find(|known_project| url_path(known_project.project.url()).trim_end_matches('/') == job_path.trim_end_matches('/'));
+            match known_project {
+                Some(known_project) => {
+                    let mut project = Project::new(known_project.project.folder(), known_project.project.url());
+                    project.set_volunteer(known_project.project.volunteer());
+                    project
+                }
+                None => return Ok(None),
+            }
+        };
+
+        let url = project.url().to_string();
+        match block_on(project.refresh_status(&self.client)) {
+            Ok(()) => self.record_success(&url),
+            Err(error) => {
+                self.record_failure(&url);
+                return Err(error);
+            }
+        }
+        // The probe is left alone, so the next crawl refreshes the project once more and picks up
+        // whatever happened after the notification.
+        match self.known_projects.lock().unwrap().get_mut(&url) {
+            Some(known_project) => known_project.project = project.clone(),
+            None => {}
+        }
+        Ok(Some(project))
+    }
+
+    fn crawl_worker(&self, queue: &Mutex<CrawlQueue>, queue_changed: &Condvar) {
+        loop {
+            let (task, _in_progress) = {
+                let mut queue_lock = queue.lock().unwrap();
+                loop {
+                    // The remaining tasks are left in the queue and keep their previous state.
+                    if Instant::now() >= queue_lock.deadline {
+                        return;
+                    }
+                    if let Some(task) = queue_lock.tasks.pop_front() {
+                        if self.is_backed_off(task.url()) {
+                            queue_lock.health.skipped += 1;
+                            queue_lock.add_unfinished(&task);
+                            continue;
+                        }
+                        queue_lock.in_progress += 1;
+                        break (task, TaskInProgress { queue, queue_changed });
+                    }
+                    // Nothing queued and nothing that can queue more work, the crawl is done.
+                    if queue_lock.in_progress == 0 {
+                        return;
+                    }
+                    queue_lock = queue_changed.wait(queue_lock).unwrap();
+                }
+            };
+
+            let url = task.url().to_string();
+            let is_folder = match task {
+                CrawlTask::Folder(_) => true,
+                CrawlTask::Project(_) => false,
+            };
+            let result = match task {
+                CrawlTask::Folder(url) => block_on(self.refresh_folder(&url))
+                    .map(CrawlResult::Folder),
+                CrawlTask::Project(mut known_project) => block_on(known_project.project.refresh_status(&self.client))
+                    .map(|_| CrawlResult::Project(known_project)),
+            };
+            match &result {
+                Ok(_) => self.record_success(&url),
+                Err(error) => {
+                    eprintln!("Failed to refresh {}. Error: {}", url, error);
+                    self.record_failure(&url);
+                }
+            }
+
+            // The results are queued before the task stops being in progress.
+            let mut queue_lock = queue.lock().unwrap();
+            match result {
+                Ok(CrawlResult::Folder(folder)) => {
+                    queue_lock.succeeded += 1;
+                    queue_lock.folders.push(url);
+                    if queue_lock.discover_folders {
+                        for url in folder.folders {
+                            queue_lock.tasks.push_back(CrawlTask::Folder(url));
+                        }
+                    }
+                    for known_project in folder.projects {
+                        queue_lock.tasks.push_back(CrawlTask::Project(known_project));
+                    }
+                    for known_project in folder.finished_projects {
+                        queue_lock.add_known_project(known_project);
+                    }
+                    queue_lock.health.failed += folder.failed_projects.len();
+                    queue_lock.unfinished.extend(folder.failed_projects);
+                }
+                Ok(CrawlResult::Project(known_project)) => {
+                    queue_lock.succeeded += 1;
+                    queue_lock.add_known_project(known_project);
+                }
+                Err(error) => {
+                    queue_lock.health.failed += 1;
+                    queue_lock.unfinished.push(url);
+                    if is_folder {
+                        queue_lock.has_unfinished_folders = true;
+                        if let BuildMonitorError::PageNotFoundError() = error {
+                            queue_lock.has_moved_folders = true;
+                        }
+                    }
+                    if queue_lock.error.is_none() {
+                        queue_lock.error = Some(error);
+                    }
+                }
+            }
+        }
+    }
+
+    fn is_backed_off(&self, url: &str) -> bool {
+        match self.circuit_breakers.lock().unwrap().get(url) {
+            Some(circuit_breaker) => circuit_breaker.consecutive_failures >= CIRCUIT_BREAKER_THRESHOLD
+                && Instant::now() < circuit_breaker.retry_at,
+            None => false,
+        }
+    }
+
+    fn record_success(&self, url: &str) {
+        self.circuit_breakers.lock().unwrap().remove(url);
+    }
+
+    fn record_failure(&self, url: &str) {
+        let mut circuit_breakers = self.circuit_breakers.lock().unwrap();
+        let circuit_breaker = circuit_breakers.entry(url.to_string()).or_insert(CircuitBreaker {
+            consecutive_failures: 0,
+            retry_at: Instant::now(),
+        });
+        circuit_breaker.consecutive_failures += 1;
+        if circuit_breaker.consecutive_failures >= CIRCUIT_BREAKER_THRESHOLD {
+            let doublings = std::cmp::min(circuit_breaker.consecutive_failures - CIRCUIT_BREAKER_THRESHOLD, 16);
+            let backoff = std::cmp::min(CIRCUIT_BREAKER_MIN_BACKOFF * 2u32.pow(doublings), CIRCUIT_BREAKER_MAX_BACKOFF);
+            circuit_breaker.retry_at = Instant::now() + backoff;
+        }
+    }
+
+    async fn refresh_folder(&self, refresh_url: &str) -> Result<RefreshedFolder, BuildMonitorError> {
+        let refresh_url = refresh_url.to_owned();
+        let query = match self.crawl_mode {
+            CrawlMode::PerProject => format!("tree=jobs[_class,{}]", PROBE_TREE),
+            CrawlMode::Bulk => format!("tree=jobs[_class,{}]", JOB_TREE),
+        };
+        let job_list = self.get_job_list(&refresh_url, &query).await?;
+        let mut folder_start = self.jenkins_server.len();
+        if self.jenkins_server.chars().nth(folder_start - 1).unwrap() != '/' {
+            folder_start += 1;
+        }
+        let mut folder_name = String::new();
+        if folder_start < refresh_url.len() {
+            folder_name = refresh_url[folder_start..].replace("job/", "");
+        }
+
+        let mut folders: Vec<String> = Vec::new();
+        let mut projects: Vec<KnownProject> = Vec::new();
+        let mut finished_projects: Vec<KnownProject> = Vec::new();
+        let mut failed_projects: Vec<String> = Vec::new();
+        let known_projects = self.known_projects.lock().unwrap();
+        for job in job_list.jobs.iter() {
+            if job.class == FOLDER_CLASS {
+                let url = job.url.as_ref().ok_or_else(|| BuildMonitorError::FieldError {})?;
+                folders.push(url.to_string());
+            } else if job.class == FREE_STYLE_PROJECT_CLASS {
+                let url = job.url.as_ref().ok_or_else(|| BuildMonitorError::FieldError {})?;
+                let probe = BuildProbe::from_job(job);
+                let mut project = Project::new(&folder_name, url);
+                match self.crawl_mode {
+                    CrawlMode::PerProject => {
+                        match known_projects.get(url.as_str()) {
+                            Some(known_project) if known_project.probe == probe => {
+                                finished_projects.push(KnownProject { probe, project: known_project.project.clone() });
+                            }
+                            _ => projects.push(KnownProject { probe, project }),
+                        }
+                    }
+                    CrawlMode::Bulk => {
+                        match project.refresh_status_from_job(job) {
+                            Ok(()) => finished_projects.push(KnownProject { probe, project }),
+                            Err(error) => {
+                                eprintln!("Failed to refresh {}. Error: {}", url, error);
+                                failed_projects.push(url.to_string());
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        Ok(RefreshedFolder { folders, projects, finished_projects, failed_projects })
+    }
+
+    async fn get_job_list(&self, url: &str, query: &str) -> Result<Arc<JobList>, BuildMonitorError> {
+        let mut api_url = url.to_string() + "/api/json";
+        if !query.is_empty() {
+            api_url = api_url + "?" + query;
+        }
+        self.client.get_json(&api_url)
+    }
+}
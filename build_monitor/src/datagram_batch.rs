@@ -0,0 +1,178 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Receives and sends several datagrams with one system call, with recvmmsg and sendmmsg on Linux.
+// Other systems receive and send one datagram per call.
+
+use crate::chunked_message::MAX_RECEIVE_SIZE;
+
+use mio::net::UdpSocket;
+use std::net::{IpAddr, Ipv4Addr, SocketAddr};
+
+// The most datagrams that are received or sent with one call.
+pub const BATCH_SIZE: usize = 16;
+
+// The datagrams of one receive, each in its own part of a buffer that is reused.
+pub struct ReceiveBatch {
+    buffer: Vec<u8>,
+    lengths: [usize; BATCH_SIZE],
+    addresses: [SocketAddr; BATCH_SIZE],
+}
+
+impl ReceiveBatch {
+    pub fn new() -> ReceiveBatch {
+        ReceiveBatch {
+            buffer: vec![0; BATCH_SIZE * MAX_RECEIVE_SIZE],
+            lengths: [0; BATCH_SIZE],
+            addresses: [SocketAddr::new(IpAddr::V4(Ipv4Addr::UNSPECIFIED), 0); BATCH_SIZE],
+        }
+    }
+
+    // A datagram of the last receive, and who sent it.
+    pub fn datagram(&self, index: usize) -> (&[u8], SocketAddr) {
+        let start = index * MAX_RECEIVE_SIZE;
+        (&self.buffer[start..start + self.lengths[index]], self.addresses[index])
+    }
+
+    // Receives the datagrams that are waiting, up to BATCH_SIZE, and returns how many there are. Fails
+    // with WouldBlock when there are none.
+    #[cfg(target_os = "linux")]
+    pub fn receive(&mut self, socket: &UdpSocket) -> std::io::Result<usize> {
+        use std::os::unix::io::AsRawFd;
+
+        let mut storages: [libc::sockaddr_storage; BATCH_SIZE] = unsafe { std::mem::zeroed() };
+        let mut iovecs: [libc::iovec; BATCH_SIZE] = unsafe { std::mem::zeroed() };
+        let mut headers: [libc::mmsghdr; BATCH_SIZE] = unsafe { std::mem::zeroed() };
+        for (index, chunk) in self.buffer.chunks_mut(MAX_RECEIVE_SIZE).enumerate() {
+            iovecs[index].iov_base = chunk.as_mut_ptr() as *mut libc::c_void;
+            iovecs[index].iov_len = chunk.len();
+            headers[index].msg_hdr.msg_name = &mut storages[index] as *mut libc::sockaddr_storage as *mut libc::c_void;
+            headers[index].msg_hdr.msg_namelen = std::mem::size_of::<libc::sockaddr_storage>() as libc::socklen_t;
+            headers[index].msg_hdr.msg_iov = &mut iovecs[index];
+            headers[index].msg_hdr.msg_iovlen = 1;
+        }
+
+        let count = socket.try_io(|| {
+            let count = unsafe {
+                libc::recvmmsg(socket.as_raw_fd(), headers.as_mut_ptr(), BATCH_SIZE as libc::c_uint, libc::MSG_DONTWAIT, std::ptr::null_mut())
+            };
+            if count < 0 {
+                return Err(std::io::Error::last_os_error());
+            }
+            Ok(count as usize)
+        })?;
+        for index in 0..count {
+            let address = unsafe { socket2::SockAddr::new(storages[index], headers[index].msg_hdr.msg_namelen) };
+            self.lengths[index] = headers[index].msg_len as usize;
+            self.addresses[index] = address.as_socket().unwrap_or(self.addresses[index]);
+        }
+        Ok(count)
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    pub fn receive(&mut self, socket: &UdpSocket) -> std::io::Result<usize> {
+        let (bytes_read, from) = socket.recv_from(&mut self.buffer[..MAX_RECEIVE_SIZE])?;
+        self.lengths[0] = bytes_read;
+        self.addresses[0] = from;
+        Ok(1)
+    }
+}
+
+// Sends the same message to every address. Returns how many were sent before an error occurred.
+#[cfg(target_os = "linux")]
+pub fn send_to_all(socket: &UdpSocket, message: &[u8], addresses: &[SocketAddr]) -> (usize, std::io::Result<()>) {
+    use std::os::unix::io::AsRawFd;
+
+    let mut sent = 0;
+    for batch in addresses.chunks(BATCH_SIZE) {
+        let mut storages: [libc::sockaddr_storage; BATCH_SIZE] = unsafe { std::mem::zeroed() };
+        let mut iovec = libc::iovec {
+            iov_base: message.as_ptr() as *mut libc::c_void,
+            iov_len: message.len(),
+        };
+        let mut headers: [libc::mmsghdr; BATCH_SIZE] = unsafe { std::mem::zeroed() };
+        for (index, address) in batch.iter().enumerate() {
+            let address = socket2::SockAddr::from(*address);
+            headers[index].msg_hdr.msg_namelen = address.len();
+            storages[index] = address.as_storage();
+            headers[index].msg_hdr.msg_name = &mut storages[index] as *mut libc::sockaddr_storage as *mut libc::c_void;
+            headers[index].msg_hdr.msg_iov = &mut iovec;
+            headers[index].msg_hdr.msg_iovlen = 1;
+        }
+
+        let mut batch_sent = 0;
+        while batch_sent < batch.len() {
+            let result = socket.try_io(|| {
+                let count = unsafe {
+                    libc::sendmmsg(socket.as_raw_fd(), headers[batch_sent..].as_mut_ptr(), (batch.len() - batch_sent) as libc::c_uint, 0)
+                };
+                if count < 0 {
+                    return Err(std::io::Error::last_os_error());
+                }
+                Ok(count as usize)
+            });
+            match result {
+                Ok(count) => batch_sent += count,
+                Err(e) => return (sent + batch_sent, Err(e)),
+            }
+        }
+        sent += batch_sent;
+    }
+    (sent, Ok(()))
+}
+
+#[cfg(not(target_os = "linux"))]
+pub fn send_to_all(socket: &UdpSocket, message: &[u8], addresses: &[SocketAddr]) -> (usize, std::io::Result<()>) {
+    for (sent, address) in addresses.iter().enumerate() {
+        match socket.send_to(message, *address) {
+            Ok(_) => {}
+            Err(e) => return (sent, Err(e)),
+        }
+    }
+    (addresses.len(), Ok(()))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn send_and_receive_batch_test() {
+        let sender = UdpSocket::bind("127.0.0.1:0".parse().unwrap()).unwrap();
+        let receivers: Vec<std::net::UdpSocket> = (0..BATCH_SIZE + 3)
+            .map(|_| std::net::UdpSocket::bind("127.0.0.1:0").unwrap())
+            .collect();
+        let addresses: Vec<SocketAddr> = receivers.iter().map(|receiver| receiver.local_addr().unwrap()).collect();
+        let (sent, result) = send_to_all(&sender, b"message", &addresses);
+        assert!(result.is_ok());
+        assert_eq!(sent, addresses.len());
+
+        let mut recv_buffer = [0; 64];
+        for receiver in receivers.iter() {
+            let (bytes_read, from) = receiver.recv_from(&mut recv_buffer).unwrap();
+            assert_eq!(&recv_buffer[..bytes_read], b"message");
+            assert_eq!(from, sender.local_addr().unwrap());
+            receiver.send_to(&recv_buffer[..bytes_read], from).unwrap();
+        }
+
+        // Every answer is received, over as many calls as the system needs.
+        let mut batch = ReceiveBatch::new();
+        let mut received = Vec::new();
+        while received.len() < addresses.len() {
+            match batch.receive(&sender) {
+                Ok(count) => {
+                    for index in 0..count {
+                        let (datagram, from) = batch.datagram(index);
+                        assert_eq!(datagram, b"message");
+                        received.push(from);
+                    }
+                }
+                Err(e) if e.kind() == std::io::ErrorKind::WouldBlock => std::thread::sleep(std::time::Duration::from_millis(1)),
+                Err(e) => panic!("Failed to receive. Error: {}", e),
+            }
+        }
+        received.sort();
+        let mut expected = addresses.clone();
+        expected.sort();
+        assert_eq!(received, expected);
+    }
+}
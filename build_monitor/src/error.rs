@@ -6,10 +6,15 @@ use std::fmt;
 pub enum BuildMonitorError {
     NonExistantHandle(),
     RequestError(reqwest::Error),
-    JsonError(json::JsonError),
+    JsonError(serde_json::Error),
     PageNotFoundError(),
+    HttpStatusError(u16),
     FieldError(),
     MutexError(),
+    IoError(std::io::Error),
+    SerializeError(bincode::Error),
+    SnapshotError(),
+    DecodeError(),
 }
 
 impl From<reqwest::Error> for BuildMonitorError {
@@ -18,12 +23,24 @@ impl From<reqwest::Error> for BuildMonitorError {
     }
 }
 
-impl From<json::JsonError> for BuildMonitorError {
-    fn from(error: json::JsonError) -> Self {
+impl From<serde_json::Error> for BuildMonitorError {
+    fn from(error: serde_json::Error) -> Self {
         BuildMonitorError::JsonError(error)
     }
 }
 
+impl From<std::io::Error> for BuildMonitorError {
+    fn from(error: std::io::Error) -> Self {
+        BuildMonitorError::IoError(error)
+    }
+}
+
+impl From<bincode::Error> for BuildMonitorError {
+    fn from(error: bincode::Error) -> Self {
+        BuildMonitorError::SerializeError(error)
+    }
+}
+
 impl fmt::Display for BuildMonitorError {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         match &*self {
@@ -33,8 +50,13 @@ impl fmt::Display for BuildMonitorError {
             }
             BuildMonitorError::JsonError(json_error) => write!(f, "JsonError: {}", json_error),
             BuildMonitorError::PageNotFoundError() => write!(f, "PageNotFoundError"),
+            BuildMonitorError::HttpStatusError(status) => write!(f, "HttpStatusError: {}", status),
             BuildMonitorError::FieldError() => write!(f, "FieldError"),
             BuildMonitorError::MutexError() => write!(f, "MutexError"),
+            BuildMonitorError::IoError(io_error) => write!(f, "IoError: {}", io_error),
+            BuildMonitorError::SerializeError(serialize_error) => write!(f, "SerializeError: {}", serialize_error),
+            BuildMonitorError::SnapshotError() => write!(f, "SnapshotError"),
+            BuildMonitorError::DecodeError() => write!(f, "DecodeError"),
         }
     }
 }
@@ -0,0 +1,281 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Receives the build notifications that Jenkins posts when a build starts or finishes, so the
+// notified projects can be refreshed right away instead of on the next poll.
+
+use crate::jenkins_api::{self, BuildNotification};
+
+use std::io::{BufRead, BufReader, Read, Write};
+use std::net::{SocketAddr, TcpListener, TcpStream};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::mpsc::{sync_channel, Receiver, TrySendError};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+
+const MAX_NOTIFICATION_SIZE: usize = 1024 * 1024;
+// Limits the request line and the headers, and how long the whole request may take, so a client that
+// sends slowly or endlessly can't hold a worker.
+const MAX_LINE_LENGTH: usize = 8 * 1024;
+const MAX_HEADERS_SIZE: usize = 64 * 1024;
+const CONNECTION_TIMEOUT: Duration = Duration::from_secs(5);
+// The threads that read notifications, and how many connections may wait for them. Connections beyond
+// that are refused, Jenkins posts the notification of the next build anyway.
+const NOTIFICATION_WORKERS: usize = 4;
+const MAX_QUEUED_CONNECTIONS: usize = 64;
+
+struct EventReceiverData {
+    running: AtomicBool,
+    // The urls of the jobs that were notified since the last call to wait_for_events.
+    job_urls: Mutex<Vec<String>>,
+    job_urls_changed: Condvar,
+}
+
+pub struct EventReceiver {
+    address: SocketAddr,
+    listener_thread: Option<JoinHandle<()>>,
+    worker_threads: Vec<JoinHandle<()>>,
+    data: Arc<EventReceiverData>,
+}
+
+impl EventReceiver {
+    pub fn new(address: SocketAddr) -> std::io::Result<EventReceiver> {
+        let listener = TcpListener::bind(address)?;
+        let address = listener.local_addr()?;
+        let data = Arc::new(EventReceiverData {
+            running: AtomicBool::new(true),
+            job_urls: Mutex::new(Vec::new()),
+            job_urls_changed: Condvar::new(),
+        });
+
+        // The workers stop when the listener stops and the queued connections were handled.
+        let (sender, receiver) = sync_channel::<TcpStream>(MAX_QUEUED_CONNECTIONS);
+        let receiver = Arc::new(Mutex::new(receiver));
+        let worker_threads = (0..NOTIFICATION_WORKERS)
+            .map(|_| {
+                let worker_data = data.clone();
+                let worker_receiver = receiver.clone();
+                std::thread::spawn(move || notification_worker(&worker_data, &worker_receiver))
+            })
+            .collect();
+
+        let thread_data = data.clone();
+        let listener_thread = std::thread::spawn(move || {
+            for stream in listener.incoming() {
+                if !thread_data.running.load(Ordering::Relaxed) {
+                    break;
+                }
+                match stream {
+                    Ok(stream) => match sender.try_send(stream) {
+                        Ok(()) => {}
+                        Err(TrySendError::Full(mut stream)) | Err(TrySendError::Disconnected(mut stream)) => {
+                            eprintln!("Refusing a notification, {} are waiting already.", MAX_QUEUED_CONNECTIONS);
+                            let _ = write!(stream, "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                        }
+                    },
+                    Err(e) => eprintln!("Failed to accept notification. Error: {}", e),
+                }
+            }
+        });
+
+        Ok(EventReceiver {
+            address,
+            listener_thread: Some(listener_thread),
+            worker_threads,
+            data,
+        })
+    }
+
+    pub fn address(&self) -> SocketAddr {
+        self.address
+    }
+
+    // Waits until at least one job was notified or the timeout passed, and returns the urls of the
+    // notified jobs. A job that was notified several times is only returned once.
+    pub fn wait_for_events(&self, timeout: Duration) -> Vec<String> {
+        let deadline = Instant::now() + timeout;
+        let mut job_urls = self.data.job_urls.lock().unwrap();
+        while job_urls.is_empty() {
+            let now = Instant::now();
+            if now >= deadline {
+                break;
+            }
+            job_urls = self.data.job_urls_changed.wait_timeout(job_urls, deadline - now).unwrap().0;
+        }
+        std::mem::take(&mut *job_urls)
+    }
+}
+
+impl Drop for EventReceiver {
+    fn drop(&mut self) {
+        self.data.running.store(false, Ordering::Relaxed);
+        // Wakes up the listener, so it notices it has to stop.
+        let _ = TcpStream::connect(self.address);
+        match self.listener_thread.take() {
+            Some(listener_thread) => {
+                if listener_thread.join().is_err() {
+                    eprintln!("Failed to join the event receiver thread.");
+                }
+            }
+            None => {}
+        }
+        for worker_thread in self.worker_threads.drain(..) {
+            if worker_thread.join().is_err() {
+                eprintln!("Failed to join an event receiver worker.");
+            }
+        }
+    }
+}
+
+fn notification_worker(data: &EventReceiverData, receiver: &Mutex<Receiver<TcpStream>>) {
+    loop {
+        let stream = match receiver.lock().unwrap().recv() {
+            Ok(stream) => stream,
+            Err(_) => return,
+        };
+        receive_notification(data, stream);
+    }
+}
+
+// Reads from the stream until the deadline, however slowly the other side sends.
+struct DeadlineStream {
+    stream: TcpStream,
+    deadline: Instant,
+}
+
+impl DeadlineStream {
+    fn new(stream: TcpStream, timeout: Duration) -> DeadlineStream {
+        DeadlineStream {
+            stream,
+            deadline: Instant::now() + timeout,
+        }
+    }
+}
+
+impl Read for DeadlineStream {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        let now = Instant::now();
+        if now >= self.deadline {
+            return Err(std::io::ErrorKind::TimedOut.into());
+        }
+        self.stream.set_read_timeout(Some(self.deadline - now))?;
+        self.stream.read(buf)
+    }
+}
+
+fn receive_notification(data: &EventReceiverData, stream: TcpStream) {
+    let mut response_stream = match stream.try_clone() {
+        Ok(response_stream) => response_stream,
+        Err(_) => return,
+    };
+    let status = match read_notification(&mut BufReader::new(DeadlineStream::new(stream, CONNECTION_TIMEOUT))) {
+        Ok(body) => match jenkins_api::parse::<BuildNotification>(&body) {
+            Ok(notification) => match notification.job_url() {
+                Some(job_url) => {
+                    let mut job_urls = data.job_urls.lock().unwrap();
+                    if !job_urls.contains(&job_url) {
+                        job_urls.push(job_url);
+                    }
+                    data.job_urls_changed.notify_all();
+                    "202 Accepted"
+                }
+                None => "400 Bad Request",
+            },
+            Err(_) => "400 Bad Request",
+        },
+        Err(status) => status,
+    };
+    let _ = write!(response_stream, "HTTP/1.1 {}\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+}
+
+// Reads a line of at most MAX_LINE_LENGTH bytes, including its line break.
+fn read_limited_line<R: BufRead>(reader: &mut R, line: &mut String) -> Result<usize, &'static str> {
+    match reader.take(MAX_LINE_LENGTH as u64).read_line(line) {
+        Ok(0) => Err("400 Bad Request"),
+        Ok(length) if !line.ends_with('\n') => {
+            if length == MAX_LINE_LENGTH { Err("431 Request Header Fields Too Large") } else { Err("400 Bad Request") }
+        }
+        Ok(length) => Ok(length),
+        Err(e) if e.kind() == std::io::ErrorKind::TimedOut || e.kind() == std::io::ErrorKind::WouldBlock => {
+            Err("408 Request Timeout")
+        }
+        Err(_) => Err("400 Bad Request"),
+    }
+}
+
+// Reads a POST request and returns its body, or the status to respond with when it isn't a notification.
+fn read_notification<R: BufRead>(reader: &mut R) -> Result<Vec<u8>, &'static str> {
+    let mut request_line = String::new();
+    read_limited_line(reader, &mut request_line)?;
+    if !request_line.starts_with("POST ") {
+        return Err("405 Method Not Allowed");
+    }
+
+    let mut content_length = 0;
+    let mut headers_size = 0;
+    loop {
+        let mut header = String::new();
+        headers_size += read_limited_line(reader, &mut header)?;
+        if headers_size > MAX_HEADERS_SIZE {
+            return Err("431 Request Header Fields Too Large");
+        }
+        let header = header.trim_end();
+        if header.is_empty() {
+            break;
+        }
+        match header.split_once(':') {
+            Some((name, value)) if name.eq_ignore_ascii_case("content-length") => {
+                content_length = value.trim().parse::<usize>().map_err(|_| "400 Bad Request")?;
+            }
+            _ => {}
+        }
+    }
+    if content_length > MAX_NOTIFICATION_SIZE {
+        return Err("413 Payload Too Large");
+    }
+
+    let mut body = vec![0; content_length];
+    match reader.read_exact(&mut body) {
+        Ok(()) => Ok(body),
+        Err(e) if e.kind() == std::io::ErrorKind::TimedOut || e.kind() == std::io::ErrorKind::WouldBlock => {
+            Err("408 Request Timeout")
+        }
+        Err(_) => Err("400 Bad Request"),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn request_limits_test() {
+        let notification = b"POST /notify HTTP/1.1\r\nContent-Length: 2\r\n\r\n{}";
+        assert_eq!(read_notification(&mut &notification[..]), Ok(b"{}".to_vec()));
+
+        let long_line = format!("POST /{} HTTP/1.1\r\n\r\n", "a".repeat(MAX_LINE_LENGTH));
+        assert_eq!(read_notification(&mut long_line.as_bytes()), Err("431 Request Header Fields Too Large"));
+
+        let many_headers = format!("POST / HTTP/1.1\r\n{}\r\n", "X-Header: value\r\n".repeat(MAX_HEADERS_SIZE / 10));
+        assert_eq!(read_notification(&mut many_headers.as_bytes()), Err("431 Request Header Fields Too Large"));
+
+        // A client that keeps sending a byte now and then still runs into the deadline of the request.
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let mut client = TcpStream::connect(listener.local_addr().unwrap()).unwrap();
+        let (server, _) = listener.accept().unwrap();
+        let sender = std::thread::spawn(move || {
+            for _ in 0..20 {
+                if client.write_all(b"P").is_err() {
+                    break;
+                }
+                std::thread::sleep(Duration::from_millis(50));
+            }
+        });
+        let started_at = Instant::now();
+        let mut reader = BufReader::new(DeadlineStream::new(server, Duration::from_millis(200)));
+        assert_eq!(read_notification(&mut reader), Err("408 Request Timeout"));
+        assert!(started_at.elapsed() < Duration::from_millis(900));
+        drop(reader);
+        sender.join().unwrap();
+    }
+}
@@ -0,0 +1,323 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// The projects in a single buffer with a fixed layout, which C++ reads in place through
+// capi/build_monitor_snapshot.h instead of getting a copy of every string. Numbers are little endian,
+// and every section starts at a multiple of 8 bytes.
+//
+// Header, at 0:
+//   magic u32, version u32, project_count u32, culprit_count u32,
+//   projects_offset u32, culprits_offset u32, strings_offset u32, strings_size u32
+// A record of PROJECT_RECORD_SIZE bytes per project, at projects_offset:
+//   id u64, last_successful_build_time u64, duration u64, estimated_duration u64, timestamp u64,
+//   folder_name, project_name, url and volunteer as string references,
+//   first_culprit u32, culprit_count u32, status u8, is_building u8, 6 bytes of padding
+// A string reference per culprit of every project, at culprits_offset.
+// The strings, at strings_offset. A string reference is the offset of the string from strings_offset
+// and its length in bytes, as two u32s. Every string is followed by a 0, so it's also a C string.
+//
+// A reader that doesn't know the version of a snapshot must not read it. Fields are only ever added
+// with a new version.
+
+use crate::project::{Project, ProjectStatus};
+
+use std::convert::TryInto;
+
+pub const FLAT_SNAPSHOT_MAGIC: u32 = u32::from_le_bytes(*b"BMSS");
+pub const FLAT_SNAPSHOT_VERSION: u32 = 1;
+pub const FLAT_HEADER_SIZE: usize = 32;
+pub const PROJECT_RECORD_SIZE: usize = 88;
+pub const STRING_REFERENCE_SIZE: usize = 8;
+
+// The status as its value in ProjectStatusFFI of the C API.
+fn status_value(status: ProjectStatus) -> u8 {
+    match status {
+        ProjectStatus::Success => 0,
+        ProjectStatus::Unstable => 1,
+        ProjectStatus::Failed => 2,
+        ProjectStatus::NotBuilt => 3,
+        ProjectStatus::Aborted => 4,
+        ProjectStatus::Disabled => 5,
+        ProjectStatus::Unknown => 6,
+    }
+}
+
+fn status_from_value(value: u8) -> ProjectStatus {
+    match value {
+        0 => ProjectStatus::Success,
+        1 => ProjectStatus::Unstable,
+        2 => ProjectStatus::Failed,
+        3 => ProjectStatus::NotBuilt,
+        4 => ProjectStatus::Aborted,
+        5 => ProjectStatus::Disabled,
+        _ => ProjectStatus::Unknown,
+    }
+}
+
+fn get_u32(buffer: &[u8], offset: usize) -> u32 {
+    u32::from_le_bytes(buffer[offset..offset + 4].try_into().unwrap())
+}
+
+fn get_u64(buffer: &[u8], offset: usize) -> u64 {
+    u64::from_le_bytes(buffer[offset..offset + 8].try_into().unwrap())
+}
+
+fn put_u32(buffer: &mut [u8], offset: usize, value: u32) {
+    buffer[offset..offset + 4].copy_from_slice(&value.to_le_bytes());
+}
+
+fn put_u64(buffer: &mut [u8], offset: usize, value: u64) {
+    buffer[offset..offset + 8].copy_from_slice(&value.to_le_bytes());
+}
+
+// Writes the string and its 0 at the end of the strings, and its reference at the offset.
+fn put_string(buffer: &mut [u8], offset: usize, strings_offset: usize, strings_end: &mut usize, value: &str) {
+    buffer[*strings_end..*strings_end + value.len()].copy_from_slice(value.as_bytes());
+    put_u32(buffer, offset, (*strings_end - strings_offset) as u32);
+    put_u32(buffer, offset + 4, value.len() as u32);
+    *strings_end += value.len() + 1;
+}
+
+fn project_strings_size(project: &Project) -> usize {
+    let culprits_size: usize = project.culprits().iter().map(|culprit| culprit.len() + 1).sum();
+    project.folder().len() + project.name().len() + project.url().len() + project.volunteer().len() + 4 + culprits_size
+}
+
+// Lays the projects out in one buffer, which is allocated once at its final size.
+pub fn encode_flat_snapshot(projects: &[Project]) -> Vec<u8> {
+    let culprit_count: usize = projects.iter().map(|project| project.culprits().len()).sum();
+    let strings_size: usize = projects.iter().map(project_strings_size).sum();
+    let projects_offset = FLAT_HEADER_SIZE;
+    let culprits_offset = projects_offset + projects.len() * PROJECT_RECORD_SIZE;
+    let strings_offset = culprits_offset + culprit_count * STRING_REFERENCE_SIZE;
+    assert!(strings_offset + strings_size <= u32::MAX as usize, "The projects don't fit in a snapshot.");
+
+    let mut buffer = vec![0; strings_offset + strings_size];
+    put_u32(&mut buffer, 0, FLAT_SNAPSHOT_MAGIC);
+    put_u32(&mut buffer, 4, FLAT_SNAPSHOT_VERSION);
+    put_u32(&mut buffer, 8, projects.len() as u32);
+    put_u32(&mut buffer, 12, culprit_count as u32);
+    put_u32(&mut buffer, 16, projects_offset as u32);
+    put_u32(&mut buffer, 20, culprits_offset as u32);
+    put_u32(&mut buffer, 24, strings_offset as u32);
+    put_u32(&mut buffer, 28, strings_size as u32);
+
+    let mut strings_end = strings_offset;
+    let mut culprit_index = 0;
+    for (index, project) in projects.iter().enumerate() {
+        let record = projects_offset + index * PROJECT_RECORD_SIZE;
+        put_u64(&mut buffer, record, project.id());
+        put_u64(&mut buffer, record + 8, project.last_successful_build_time());
+        put_u64(&mut buffer, record + 16, project.duration());
+        put_u64(&mut buffer, record + 24, project.estimated_duration());
+        put_u64(&mut buffer, record + 32, project.timestamp());
+        put_string(&mut buffer, record + 40, strings_offset, &mut strings_end, project.folder());
+        put_string(&mut buffer, record + 48, strings_offset, &mut strings_end, project.name());
+        put_string(&mut buffer, record + 56, strings_offset, &mut strings_end, project.url());
+        put_string(&mut buffer, record + 64, strings_offset, &mut strings_end, project.volunteer());
+        put_u32(&mut buffer, record + 72, culprit_index as u32);
+        put_u32(&mut buffer, record + 76, project.culprits().len() as u32);
+        buffer[record + 80] = status_value(project.status());
+        buffer[record + 81] = project.is_building() as u8;
+
+        for culprit in project.culprits().iter() {
+            put_string(&mut buffer, culprits_offset + culprit_index * STRING_REFERENCE_SIZE, strings_offset, &mut strings_end, culprit);
+            culprit_index += 1;
+        }
+    }
+    buffer
+}
+
+// Reads the projects of a snapshot in place, like build_monitor_snapshot.h.
+pub struct FlatSnapshot<'a> {
+    buffer: &'a [u8],
+}
+
+pub struct FlatProject<'a> {
+    buffer: &'a [u8],
+    record: usize,
+}
+
+impl<'a> FlatSnapshot<'a> {
+    // Returns None for a snapshot with a version this reader doesn't know, or whose sections don't fit
+    // in it.
+    pub fn new(buffer: &'a [u8]) -> Option<FlatSnapshot<'a>> {
+        if buffer.len() < FLAT_HEADER_SIZE || get_u32(buffer, 0) != FLAT_SNAPSHOT_MAGIC || get_u32(buffer, 4) != FLAT_SNAPSHOT_VERSION {
+            return None;
+        }
+        let section_end = |offset: usize, size: usize| get_u32(buffer, offset) as usize + size;
+        if section_end(16, get_u32(buffer, 8) as usize * PROJECT_RECORD_SIZE) > buffer.len()
+            || section_end(20, get_u32(buffer, 12) as usize * STRING_REFERENCE_SIZE) > buffer.len()
+            || section_end(24, get_u32(buffer, 28) as usize) > buffer.len() {
+            return None;
+        }
+        Some(FlatSnapshot { buffer })
+    }
+
+    pub fn project_count(&self) -> usize {
+        get_u32(self.buffer, 8) as usize
+    }
+
+    // The culprits of all projects together.
+    pub fn culprit_count(&self) -> usize {
+        get_u32(self.buffer, 12) as usize
+    }
+
+    pub fn project(&self, index: usize) -> FlatProject<'a> {
+        assert!(index < self.project_count());
+        FlatProject {
+            buffer: self.buffer,
+            record: get_u32(self.buffer, 16) as usize + index * PROJECT_RECORD_SIZE,
+        }
+    }
+}
+
+impl<'a> FlatProject<'a> {
+    pub fn id(&self) -> u64 {
+        get_u64(self.buffer, self.record)
+    }
+
+    pub fn last_successful_build_time(&self) -> u64 {
+        get_u64(self.buffer, self.record + 8)
+    }
+
+    pub fn duration(&self) -> u64 {
+        get_u64(self.buffer, self.record + 16)
+    }
+
+    pub fn estimated_duration(&self) -> u64 {
+        get_u64(self.buffer, self.record + 24)
+    }
+
+    pub fn timestamp(&self) -> u64 {
+        get_u64(self.buffer, self.record + 32)
+    }
+
+    pub fn folder(&self) -> &'a str {
+        self.string(self.record + 40)
+    }
+
+    pub fn name(&self) -> &'a str {
+        self.string(self.record + 48)
+    }
+
+    pub fn url(&self) -> &'a str {
+        self.string(self.record + 56)
+    }
+
+    pub fn volunteer(&self) -> &'a str {
+        self.string(self.record + 64)
+    }
+
+    pub fn status(&self) -> ProjectStatus {
+        status_from_value(self.buffer[self.record + 80])
+    }
+
+    pub fn is_building(&self) -> bool {
+        self.buffer[self.record + 81] != 0
+    }
+
+    pub fn culprits(&self) -> impl Iterator<Item = &'a str> + 'a {
+        let buffer = self.buffer;
+        let first_culprit = get_u32(buffer, self.record + 72) as usize;
+        let culprits_offset = get_u32(buffer, 20) as usize;
+        (0..get_u32(buffer, self.record + 76) as usize)
+            .map(move |index| FlatProject::read_string(buffer, culprits_offset + (first_culprit + index) * STRING_REFERENCE_SIZE))
+    }
+
+    fn string(&self, reference: usize) -> &'a str {
+        FlatProject::read_string(self.buffer, reference)
+    }
+
+    // The string is followed by its 0 in the buffer, so a pointer to it is also a C string. A reference
+    // outside of the strings reads as an empty string.
+    fn read_string(buffer: &'a [u8], reference: usize) -> &'a str {
+        let start = get_u32(buffer, 24) as usize + get_u32(buffer, reference) as usize;
+        let end = start + get_u32(buffer, reference + 4) as usize;
+        if end >= buffer.len() || buffer[end] != 0 {
+            return "";
+        }
+        std::str::from_utf8(&buffer[start..end]).unwrap_or("")
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::jenkins_api::{self, Job};
+
+    // Reads a string the way the C++ reader does, and checks that it ends with a 0.
+    fn get_string(buffer: &[u8], offset: usize) -> &str {
+        let strings_offset = get_u32(buffer, 24) as usize;
+        let start = strings_offset + get_u32(buffer, offset) as usize;
+        let end = start + get_u32(buffer, offset + 4) as usize;
+        assert!(buffer[end] == 0);
+        std::str::from_utf8(&buffer[start..end]).unwrap()
+    }
+
+    #[test]
+    fn flat_snapshot_test() {
+        let job: Job = jenkins_api::parse(br#"{"name":"Build","buildable":true,
+            "lastBuild":{"building":true,"result":null,"duration":61000,"estimatedDuration":90000,
+                "timestamp":1600000000000,"culprits":[{"fullName":"Jane Doe"},{"fullName":"J\u00f6hn Doe"}]},
+            "lastSuccessfulBuild":{"timestamp":1500000000000},"lastCompletedBuild":{"result":"FAILURE"}}"#).unwrap();
+        let mut failed = Project::new("Folder/Sub", "https://jenkins/job/Folder/job/Sub/job/Build/");
+        failed.refresh_status_from_job(&job).unwrap();
+        failed.set_volunteer("Sander");
+        let projects = vec![Project::new("Folder", "https://jenkins/job/Folder/job/New/"), failed];
+
+        let buffer = encode_flat_snapshot(&projects);
+        assert!(get_u32(&buffer, 0) == FLAT_SNAPSHOT_MAGIC);
+        assert!(get_u32(&buffer, 4) == FLAT_SNAPSHOT_VERSION);
+        assert!(get_u32(&buffer, 8) == 2);
+        assert!(get_u32(&buffer, 12) == 2);
+        let strings_offset = get_u32(&buffer, 24) as usize;
+        assert!(strings_offset + get_u32(&buffer, 28) as usize == buffer.len());
+        for section in [16, 20, 24].iter() {
+            assert!(get_u32(&buffer, *section) % 8 == 0);
+        }
+
+        let projects_offset = get_u32(&buffer, 16) as usize;
+        let culprits_offset = get_u32(&buffer, 20) as usize;
+        for (index, project) in projects.iter().enumerate() {
+            let record = projects_offset + index * PROJECT_RECORD_SIZE;
+            assert!(get_u64(&buffer, record) == project.id());
+            assert!(get_u64(&buffer, record + 8) == project.last_successful_build_time());
+            assert!(get_u64(&buffer, record + 16) == project.duration());
+            assert!(get_u64(&buffer, record + 24) == project.estimated_duration());
+            assert!(get_u64(&buffer, record + 32) == project.timestamp());
+            assert!(get_string(&buffer, record + 40) == project.folder());
+            assert!(get_string(&buffer, record + 48) == project.name());
+            assert!(get_string(&buffer, record + 56) == project.url());
+            assert!(get_string(&buffer, record + 64) == project.volunteer());
+            assert!(buffer[record + 80] == status_value(project.status()));
+            assert!(buffer[record + 81] == project.is_building() as u8);
+            let first_culprit = get_u32(&buffer, record + 72) as usize;
+            let culprits: Vec<&str> = (0..get_u32(&buffer, record + 76) as usize)
+                .map(|culprit| get_string(&buffer, culprits_offset + (first_culprit + culprit) * STRING_REFERENCE_SIZE))
+                .collect();
+            assert!(culprits == *project.culprits());
+        }
+        assert!(buffer[projects_offset + PROJECT_RECORD_SIZE + 80] == 2);
+        assert!(buffer[projects_offset + PROJECT_RECORD_SIZE + 81] == 1);
+        assert!(get_u32(&buffer, projects_offset + PROJECT_RECORD_SIZE + 76) == 2);
+
+        // The reader gives back the same projects.
+        let snapshot = FlatSnapshot::new(&buffer).unwrap();
+        assert!(snapshot.project_count() == 2 && snapshot.culprit_count() == 2);
+        for (index, project) in projects.iter().enumerate() {
+            let flat_project = snapshot.project(index);
+            assert!(flat_project.id() == project.id());
+            assert!(flat_project.folder() == project.folder() && flat_project.name() == project.name());
+            assert!(flat_project.url() == project.url() && flat_project.volunteer() == project.volunteer());
+            assert!(flat_project.status() == project.status() && flat_project.is_building() == project.is_building());
+            assert!(flat_project.timestamp() == project.timestamp() && flat_project.duration() == project.duration());
+            assert!(flat_project.culprits().collect::<Vec<&str>>() == *project.culprits());
+        }
+        assert!(FlatSnapshot::new(&buffer[..buffer.len() - 1]).is_none());
+        assert!(FlatSnapshot::new(&buffer[..FLAT_HEADER_SIZE - 1]).is_none());
+
+        let empty = encode_flat_snapshot(&[]);
+        assert!(empty.len() == FLAT_HEADER_SIZE);
+        assert!(get_u32(&empty, 8) == 0);
+    }
+}
@@ -0,0 +1,112 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Messages over a TCP stream are the same as the datagrams, a header followed by msg_size bytes. The
+// header's msg_size is what separates one message from the next.
+
+use crate::monitor::Header;
+
+use std::io::{ErrorKind, Read};
+
+// The largest message that is accepted, a larger size means the stream is corrupt.
+pub const MAX_FRAME_SIZE: usize = 64 * 1024 * 1024;
+
+const READ_SIZE: usize = 64 * 1024;
+
+// Collects the bytes of a stream until a whole message arrived. Works with non blocking streams and
+// read timeouts, a message that is only partially read is completed on the next call.
+pub struct FrameReader {
+    buffer: Vec<u8>,
+}
+
+impl FrameReader {
+    pub fn new() -> FrameReader {
+        FrameReader {
+            buffer: Vec::new(),
+        }
+    }
+
+    // Returns Ok(None) when no whole message can be read without blocking or before the stream's read
+    // timeout passed, and an error when the stream was closed or is corrupt.
+    pub fn read_frame<R: Read>(&mut self, stream: &mut R) -> std::io::Result<Option<(Header, Vec<u8>)>> {
+        loop {
+            match self.take_frame()? {
+                Some(frame) => return Ok(Some(frame)),
+                None => {}
+            }
+
+            let len = self.buffer.len();
+            self.buffer.resize(len + READ_SIZE, 0);
+            let result = stream.read(&mut self.buffer[len..]);
+            let bytes_read = *result.as_ref().unwrap_or(&0);
+            self.buffer.truncate(len + bytes_read);
+            match result {
+                Ok(0) => return Err(std::io::Error::new(ErrorKind::UnexpectedEof, "The stream was closed.")),
+                Ok(_) => {}
+                Err(error) if error.kind() == ErrorKind::WouldBlock || error.kind() == ErrorKind::TimedOut => return Ok(None),
+                Err(error) if error.kind() == ErrorKind::Interrupted => {}
+                Err(error) => return Err(error),
+            }
+        }
+    }
+
+    fn take_frame(&mut self) -> std::io::Result<Option<(Header, Vec<u8>)>> {
+        let (header, header_size) = match Header::from_bytes(&self.buffer) {
+            Some(header) => header,
+            None => return Ok(None),
+        };
+        let msg_size = header.msg_size as usize;
+        if msg_size > MAX_FRAME_SIZE {
+            return Err(std::io::Error::new(ErrorKind::InvalidData, "The message is too large."));
+        }
+        if self.buffer.len() < header_size + msg_size {
+            return Ok(None);
+        }
+        let body = self.buffer[header_size..header_size + msg_size].to_vec();
+        self.buffer.drain(..header_size + msg_size);
+        Ok(Some((header, body)))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::monitor::MessageType;
+    use std::io::Write;
+    use std::net::{TcpListener, TcpStream};
+    use std::time::Duration;
+
+    #[test]
+    fn read_frame_test() {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let mut sender = TcpStream::connect(listener.local_addr().unwrap()).unwrap();
+        let mut receiver = listener.accept().unwrap().0;
+        receiver.set_read_timeout(Some(Duration::from_millis(50))).unwrap();
+
+        let mut header = Header::new();
+        header.msg_type = MessageType::ProjectUpdate;
+        header.msg_size = 3 * READ_SIZE as u32;
+        let mut message = bincode::serialize(&header).unwrap();
+        assert_eq!(message, header.to_bytes());
+        message.extend((0..3 * READ_SIZE).map(|index| (index % 251) as u8));
+        header.msg_type = MessageType::Beacon;
+        header.msg_size = 0;
+        message.append(&mut bincode::serialize(&header).unwrap());
+
+        // The first half doesn't complete the message, the rest arrives after the timeout.
+        let mut reader = FrameReader::new();
+        let (first_half, second_half) = message.split_at(message.len() / 2);
+        sender.write_all(first_half).unwrap();
+        assert!(reader.read_frame(&mut receiver).unwrap().is_none());
+        sender.write_all(second_half).unwrap();
+        let (update_header, body) = reader.read_frame(&mut receiver).unwrap().unwrap();
+        assert!(update_header.msg_type == MessageType::ProjectUpdate);
+        assert_eq!(body.len(), 3 * READ_SIZE);
+        assert_eq!(body[READ_SIZE], (READ_SIZE % 251) as u8);
+        let (beacon_header, body) = reader.read_frame(&mut receiver).unwrap().unwrap();
+        assert!(beacon_header.msg_type == MessageType::Beacon);
+        assert!(body.is_empty());
+
+        drop(sender);
+        assert!(reader.read_frame(&mut receiver).is_err());
+    }
+}
@@ -0,0 +1,97 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// The parts of the Jenkins JSON api that are read while crawling. Every field that isn't listed here is
+// skipped while parsing, without building a tree of the whole response first.
+
+use serde::Deserialize;
+
+pub const FOLDER_CLASS: &str = "com.cloudbees.hudson.plugins.folder.Folder";
+pub const FREE_STYLE_PROJECT_CLASS: &str = "hudson.model.FreeStyleProject";
+
+#[derive(Deserialize)]
+pub struct JobList {
+    #[serde(default)]
+    pub jobs: Vec<Job>,
+}
+
+#[derive(Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct Job {
+    #[serde(rename = "_class", default)]
+    pub class: String,
+    pub name: Option<String>,
+    pub url: Option<String>,
+    pub buildable: Option<bool>,
+    pub last_build: Option<Build>,
+    pub last_successful_build: Option<Build>,
+    pub last_completed_build: Option<Build>,
+}
+
+#[derive(Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct Build {
+    pub number: Option<u64>,
+    pub building: Option<bool>,
+    pub result: Option<String>,
+    pub duration: Option<u64>,
+    pub estimated_duration: Option<i64>,
+    pub timestamp: Option<u64>,
+    #[serde(default)]
+    pub culprits: Vec<Culprit>,
+}
+
+#[derive(Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub struct Culprit {
+    pub full_name: String,
+}
+
+// A build notification, as posted by the Jenkins notification plugin or by a webhook.
+#[derive(Deserialize)]
+pub struct BuildNotification {
+    pub name: Option<String>,
+    // The url of the job, relative to Jenkins.
+    pub url: Option<String>,
+    pub build: Option<NotifiedBuild>,
+    // Sent by webhooks that don't nest the build.
+    #[serde(rename = "buildUrl")]
+    pub build_url: Option<String>,
+}
+
+#[derive(Deserialize)]
+pub struct NotifiedBuild {
+    pub full_url: Option<String>,
+    pub url: Option<String>,
+    pub number: Option<u64>,
+    pub phase: Option<String>,
+    pub status: Option<String>,
+}
+
+impl BuildNotification {
+    // The url of the notified job, either absolute or relative to Jenkins.
+    pub fn job_url(&self) -> Option<String> {
+        let build = self.build.as_ref();
+        match build.and_then(|build| build.full_url.as_ref()).or(self.build_url.as_ref()) {
+            Some(build_url) => return Some(strip_build_number(build_url)),
+            None => {}
+        }
+        match &self.url {
+            Some(url) => return Some(url.to_string()),
+            None => {}
+        }
+        build.and_then(|build| build.url.as_ref()).map(|build_url| strip_build_number(build_url))
+    }
+}
+
+// Turns the url of a build, like job/project/12/, into the url of its job.
+fn strip_build_number(build_url: &str) -> String {
+    let trimmed = build_url.trim_end_matches('/');
+    match trimmed.rfind('/') {
+        Some(index) if trimmed[index + 1..].chars().all(|c| c.is_ascii_digit()) => trimmed[..index + 1].to_string(),
+        _ => trimmed.to_string() + "/",
+    }
+}
+
+pub fn parse<'a, T: Deserialize<'a>>(body: &'a [u8]) -> Result<T, serde_json::Error> {
+    serde_json::from_slice(body)
+}
@@ -0,0 +1,165 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+use crate::error::BuildMonitorError;
+use crate::jenkins_api;
+
+use reqwest::header::{ETAG, IF_MODIFIED_SINCE, IF_NONE_MATCH, LAST_MODIFIED};
+use serde::de::DeserializeOwned;
+use std::any::Any;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
+
+pub const DEFAULT_REQUEST_TIMEOUT: Duration = Duration::from_secs(30);
+
+#[derive(Clone, Copy, Default)]
+pub struct CacheStatistics {
+    pub hits: u64,
+    pub misses: u64,
+    pub bytes_downloaded: u64,
+}
+
+struct CachedResponse {
+    etag: Option<String>,
+    last_modified: Option<String>,
+    value: Arc<dyn Any + Send + Sync>,
+    used_in_crawl: u64,
+}
+
+// Keeps a single connection pool alive between refreshes and remembers the validators of every
+// response, so unchanged pages are answered with a 304 and reuse the value that was parsed before.
+pub struct JenkinsClient {
+    client: reqwest::blocking::Client,
+    request_timeout: Duration,
+    cache: Mutex<HashMap<String, CachedResponse>>,
+    crawl: AtomicU64,
+    hits: AtomicU64,
+    misses: AtomicU64,
+    bytes_downloaded: AtomicU64,
+}
+
+impl JenkinsClient {
+    pub fn new() -> JenkinsClient {
+        JenkinsClient {
+            client: reqwest::blocking::Client::builder()
+                .danger_accept_invalid_certs(true)
+                .build()
+                .unwrap(),
+            request_timeout: DEFAULT_REQUEST_TIMEOUT,
+            cache: Mutex::new(HashMap::new()),
+            crawl: AtomicU64::new(0),
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+            bytes_downloaded: AtomicU64::new(0),
+        }
+    }
+
+    pub fn request_timeout(&self) -> Duration {
+        self.request_timeout
+    }
+
+    // Limits how long a single request may take, from connecting until the whole body was received.
+    pub fn set_request_timeout(&mut self, request_timeout: Duration) {
+        self.request_timeout = request_timeout;
+    }
+
+    pub fn get_json<T: DeserializeOwned + Send + Sync + 'static>(&self, api_url: &str) -> Result<Arc<T>, BuildMonitorError> {
+        let crawl = self.crawl.load(Ordering::Relaxed);
+        let mut request = self.client.get(api_url).timeout(self.request_timeout);
+        {
+            let mut cache = self.cache.lock().unwrap();
+            match cache.get_mut(api_url) {
+                Some(cached) => {
+                    cached.used_in_crawl = crawl;
+                    if let Some(etag) = &cached.etag {
+                        request = request.header(IF_NONE_MATCH, etag.as_str());
+                    }
+                    if let Some(last_modified) = &cached.last_modified {
+                        request = request.header(IF_MODIFIED_SINCE, last_modified.as_str());
+                    }
+                }
+                None => {}
+            }
+        }
+
+        let response = request.send()?;
+        if response.status() == reqwest::StatusCode::NOT_MODIFIED {
+            let cached_value = self.cache.lock().unwrap()
+                .get(api_url)
+                .and_then(|cached| cached.value.clone().downcast::<T>().ok());
+            match cached_value {
+                Some(value) => {
+                    self.hits.fetch_add(1, Ordering::Relaxed);
+                    return Ok(value);
+                }
+                // Evicted while the request was in flight, request it again without validators.
+                None => {
+                    let response = self.client.get(api_url).timeout(self.request_timeout).send()?;
+                    return self.parse_response(api_url, response, crawl);
+                }
+            }
+        }
+
+        self.parse_response(api_url, response, crawl)
+    }
+
+    fn parse_response<T: DeserializeOwned + Send + Sync + 'static>(&self, api_url: &str,
+        response: reqwest::blocking::Response, crawl: u64) -> Result<Arc<T>, BuildMonitorError> {
+        if response.status() == reqwest::StatusCode::NOT_FOUND {
+            return Err(BuildMonitorError::PageNotFoundError());
+        }
+        if response.status() != reqwest::StatusCode::OK {
+            return Err(BuildMonitorError::HttpStatusError(response.status().as_u16()));
+        }
+
+        let header_value = |name| response.headers()
+            .get(name)
+            .and_then(|value: &reqwest::header::HeaderValue| value.to_str().ok())
+            .map(|value| value.to_string());
+        let etag = header_value(ETAG);
+        let last_modified = header_value(LAST_MODIFIED);
+
+        let body = response.bytes()?;
+        self.misses.fetch_add(1, Ordering::Relaxed);
+        self.bytes_downloaded.fetch_add(body.len() as u64, Ordering::Relaxed);
+        let value = Arc::new(jenkins_api::parse::<T>(&body)?);
+
+        let mut cache = self.cache.lock().unwrap();
+        if etag.is_some() || last_modified.is_some() {
+            cache.insert(api_url.to_string(), CachedResponse {
+                etag,
+                last_modified,
+                value: value.clone(),
+                used_in_crawl: crawl,
+            });
+        }
+        else {
+            cache.remove(api_url);
+        }
+
+        Ok(value)
+    }
+
+    // Resets the statistics, so they only cover the crawl that is about to start.
+    pub fn begin_crawl(&self) {
+        self.crawl.fetch_add(1, Ordering::Relaxed);
+        self.hits.store(0, Ordering::Relaxed);
+        self.misses.store(0, Ordering::Relaxed);
+        self.bytes_downloaded.store(0, Ordering::Relaxed);
+    }
+
+    // Drops the responses of pages that weren't requested during the last crawl, like removed jobs.
+    pub fn end_crawl(&self) {
+        let crawl = self.crawl.load(Ordering::Relaxed);
+        self.cache.lock().unwrap().retain(|_, cached| cached.used_in_crawl == crawl);
+    }
+
+    pub fn cache_statistics(&self) -> CacheStatistics {
+        CacheStatistics {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            bytes_downloaded: self.bytes_downloaded.load(Ordering::Relaxed),
+        }
+    }
+}
@@ -1,16 +1,28 @@
 // Copyright Sander Brattinga. All rights reserved.
 
+pub mod chunked_message;
+pub mod flat_snapshot;
+pub mod jenkins_api;
 pub mod monitor;
 pub mod project;
+pub mod project_encoding;
 
+mod crawler;
+mod datagram_batch;
 mod error;
+mod event_receiver;
+mod framed_stream;
+mod jenkins_client;
 mod monitor_client;
 mod monitor_server;
+mod multicast_repair;
+mod refresh_signal;
+mod snapshot;
 mod utils;
 
 #[cfg(test)]
 mod tests {
-    use super::monitor::Monitor;
+    use super::monitor::{CrawlMode, Monitor};
 
     #[test]
     fn run_jenkins_test() {
@@ -24,6 +36,352 @@ mod tests {
         }
     }
 
+    #[test]
+    fn run_mock_jenkins_test() {
+        let config = mock_jenkins::MockJenkinsConfig {
+            folder_depth: 2,
+            folders_per_folder: 2,
+            jobs_per_folder: 10,
+            ..mock_jenkins::MockJenkinsConfig::default()
+        };
+        let jenkins = mock_jenkins::MockJenkins::start("127.0.0.1:0", config).unwrap();
+
+        let mut per_project_monitor = Monitor::new(jenkins.url());
+        per_project_monitor.set_crawl_mode(CrawlMode::PerProject);
+        futures::executor::block_on(per_project_monitor.refresh_projects()).unwrap();
+        assert_eq!(per_project_monitor.get_projects().read().unwrap().len(), jenkins.project_count());
+
+        let mut bulk_monitor = Monitor::new(jenkins.url());
+        bulk_monitor.set_crawl_mode(CrawlMode::Bulk);
+        futures::executor::block_on(bulk_monitor.refresh_projects()).unwrap();
+        assert_eq!(per_project_monitor.to_string(), bulk_monitor.to_string());
+
+        // Nothing changed, so the second refresh should only list the root and its six folders.
+        jenkins.reset_statistics();
+        assert!(!futures::executor::block_on(per_project_monitor.refresh_projects()).unwrap());
+        assert_eq!(jenkins.statistics().requests, 7);
+
+        // A new build changes the probe of its project in the listing of its folder, so only that
+        // project is requested, its page and its last and last successful build.
+        jenkins.finish_build(&[1, 0], 3);
+        jenkins.reset_statistics();
+        assert!(futures::executor::block_on(per_project_monitor.refresh_projects()).unwrap());
+        assert_eq!(jenkins.statistics().requests, 7 + 3);
+        futures::executor::block_on(bulk_monitor.refresh_projects()).unwrap();
+        assert_eq!(per_project_monitor.to_string(), bulk_monitor.to_string());
+    }
+
+    #[test]
+    fn run_conditional_request_test() {
+        use super::jenkins_api::Build;
+        use super::jenkins_client::JenkinsClient;
+
+        // Jenkins answers with an ETag, or only with Last-Modified behind some proxies.
+        for &(etags, last_modified) in [(true, false), (false, true)].iter() {
+            let config = mock_jenkins::MockJenkinsConfig {
+                folder_depth: 1,
+                folders_per_folder: 2,
+                jobs_per_folder: 5,
+                etags,
+                last_modified,
+                ..mock_jenkins::MockJenkinsConfig::default()
+            };
+            let jenkins = mock_jenkins::MockJenkins::start("127.0.0.1:0", config).unwrap();
+            let client = JenkinsClient::new();
+            let api_url = format!("{}job/folder0/job/project3/lastBuild/api/json", jenkins.url());
+            let build = client.get_json::<Build>(&api_url).unwrap();
+
+            // An unchanged page is answered with a 304, and the build that was parsed before is reused.
+            let cached_build = client.get_json::<Build>(&api_url).unwrap();
+            assert!(std::sync::Arc::ptr_eq(&build, &cached_build));
+            assert_eq!(jenkins.statistics().not_modified, 1);
+            assert_eq!(client.cache_statistics().hits, 1);
+
+            // A new build changes the page, and replaces the build in the cache.
+            jenkins.finish_build(&[0], 3);
+            let new_build = client.get_json::<Build>(&api_url).unwrap();
+            assert_eq!(new_build.number, build.number.map(|number| number + 1));
+            assert_eq!(jenkins.statistics().not_modified, 1);
+            assert_eq!(client.cache_statistics().misses, 2);
+            let cached_build = client.get_json::<Build>(&api_url).unwrap();
+            assert!(std::sync::Arc::ptr_eq(&new_build, &cached_build));
+            assert_eq!(jenkins.statistics().not_modified, 2);
+        }
+    }
+
+    #[test]
+    fn run_partial_crawl_test() {
+        let config = mock_jenkins::MockJenkinsConfig {
+            folder_depth: 1,
+            folders_per_folder: 2,
+            jobs_per_folder: 5,
+            rebuild_interval: Some(std::time::Duration::from_millis(1)),
+            rebuilding_jobs_percent: 100,
+            ..mock_jenkins::MockJenkinsConfig::default()
+        };
+        let jenkins = mock_jenkins::MockJenkins::start("127.0.0.1:0", config).unwrap();
+        let mut monitor = Monitor::new(jenkins.url());
+        futures::executor::block_on(monitor.refresh_projects()).unwrap();
+        let projects = monitor.to_string();
+        assert_eq!(monitor.get_projects().read().unwrap().len(), 10);
+
+        // Every project is rebuilding, so each one is requested and fails. They keep their last state.
+        jenkins.set_failing_jobs_percent(100);
+        for _ in 0..3 {
+            futures::executor::block_on(monitor.refresh_projects()).unwrap();
+            assert_eq!(monitor.to_string(), projects);
+            assert_eq!(monitor.crawl_health().failed, 10);
+        }
+
+        // After failing three times in a row the projects aren't requested anymore for a while.
+        jenkins.reset_statistics();
+        futures::executor::block_on(monitor.refresh_projects()).unwrap();
+        assert_eq!(monitor.to_string(), projects);
+        assert_eq!(monitor.crawl_health().skipped, 10);
+        assert_eq!(jenkins.statistics().requests, 3);
+    }
+
+    #[test]
+    fn run_build_event_test() {
+        let config = mock_jenkins::MockJenkinsConfig {
+            folder_depth: 1,
+            folders_per_folder: 2,
+            jobs_per_folder: 5,
+            ..mock_jenkins::MockJenkinsConfig::default()
+        };
+        let jenkins = mock_jenkins::MockJenkins::start("127.0.0.1:0", config).unwrap();
+        let mut monitor = Monitor::new(jenkins.url());
+        futures::executor::block_on(monitor.refresh_projects()).unwrap();
+        monitor.start_event_receiver("127.0.0.1:0").unwrap();
+        let notification_url = format!("http://{}/", monitor.event_receiver_address().unwrap());
+        // The last builds of this project failed and have culprits.
+        let project_url = format!("{}job/folder0/job/project3/", jenkins.url());
+        let notified_project = |monitor: &Monitor| monitor.get_projects().read().unwrap()
+            .iter().find(|project| project.url() == project_url).unwrap().clone();
+        let build_time = |monitor: &Monitor| notified_project(monitor).timestamp();
+        let previous_build_time = build_time(&monitor);
+
+        // Only the notified project is requested, without waiting for the next refresh.
+        jenkins.finish_build(&[0], 3);
+        jenkins.reset_statistics();
+        let start = std::time::Instant::now();
+        jenkins.notify_build(&notification_url, &[0], 3).unwrap();
+        assert!(monitor.refresh_notified_projects(std::time::Duration::from_secs(5)));
+        let latency = start.elapsed();
+        println!("Refreshed the notified project in {:.1} ms.", latency.as_secs_f64() * 1000.0);
+        assert!(latency < std::time::Duration::from_secs(1));
+        assert!(jenkins.statistics().requests <= 4);
+        assert!(build_time(&monitor) > previous_build_time);
+        assert!(notified_project(&monitor).status() == super::project::ProjectStatus::Failed);
+        let culprits = notified_project(&monitor).culprits().clone();
+        assert!(!culprits.is_empty());
+
+        // Another notification for the same build doesn't add its culprits again, nothing changes.
+        jenkins.notify_build(&notification_url, &[0], 3).unwrap();
+        assert!(!monitor.refresh_notified_projects(std::time::Duration::from_secs(5)));
+        assert!(*notified_project(&monitor).culprits() == culprits);
+
+        // The full refresh agrees with the notified state.
+        let mut new_monitor = Monitor::new(jenkins.url());
+        futures::executor::block_on(new_monitor.refresh_projects()).unwrap();
+        assert_eq!(monitor.to_string(), new_monitor.to_string());
+        assert!(!futures::executor::block_on(monitor.refresh_projects()).unwrap());
+
+        // Without notifications nothing is refreshed.
+        assert!(!monitor.refresh_notified_projects(std::time::Duration::from_millis(10)));
+    }
+
+    #[test]
+    fn run_large_update_test() {
+        // Far more projects than fit in a single datagram.
+        let projects: Vec<super::project::Project> = (0..20000)
+            .map(|index| {
+                let folder = format!("team{}/component{}", index / 1000, index / 100);
+                let url = format!("https://jenkins.example.com/job/team{}/job/component{}/job/project{}/", index / 1000, index / 100, index);
+                super::project::Project::new(&folder, &url)
+            })
+            .collect();
+        let path = std::env::temp_dir().join(format!("build_monitor_large_update_test_{}.bin", std::process::id()));
+        super::snapshot::save_snapshot(&path, "https://jenkins.example.com", &projects).unwrap();
+
+        let mut server_monitor = Monitor::new("https://jenkins.example.com");
+        server_monitor.set_snapshot_path(path.to_str().unwrap());
+        assert!(server_monitor.load_snapshot().unwrap());
+        std::fs::remove_file(&path).unwrap();
+        server_monitor.start_server("127.0.0.1:8092", false).unwrap();
+        // Lets the server bind its socket, the client would only ask again after 15 seconds otherwise.
+        std::thread::sleep(std::time::Duration::from_millis(100));
+
+        let mut client_monitor = Monitor::new("");
+        client_monitor.start_client("127.0.0.1:8092", "127.0.0.1:8093", false).unwrap();
+        let start = std::time::Instant::now();
+        while client_monitor.get_projects().read().unwrap().len() == 0 {
+            assert!(start.elapsed() < std::time::Duration::from_secs(10));
+            futures::executor::block_on(client_monitor.refresh_projects()).unwrap();
+            std::thread::sleep(std::time::Duration::from_millis(10));
+        }
+        println!("Received 20000 projects in {:.1} ms.", start.elapsed().as_secs_f64() * 1000.0);
+        assert_eq!(client_monitor.to_string(), server_monitor.to_string());
+
+        client_monitor.stop_client();
+        server_monitor.stop_server();
+    }
+
+    #[test]
+    fn run_server_workers_test() {
+        let config = mock_jenkins::MockJenkinsConfig {
+            folder_depth: 1,
+            folders_per_folder: 2,
+            jobs_per_folder: 5,
+            ..mock_jenkins::MockJenkinsConfig::default()
+        };
+        let jenkins = mock_jenkins::MockJenkins::start("127.0.0.1:0", config).unwrap();
+        let mut server_monitor = Monitor::new(jenkins.url());
+        futures::executor::block_on(server_monitor.refresh_projects()).unwrap();
+        server_monitor.set_server_workers(4);
+        server_monitor.start_server("127.0.0.1:8097", false).unwrap();
+        std::thread::sleep(std::time::Duration::from_millis(100));
+
+        // The clients are spread over the workers, and every one of them is answered.
+        let mut client_monitors: Vec<Monitor> = (0..16)
+            .map(|_| {
+                let mut client_monitor = Monitor::new("");
+                client_monitor.start_client("127.0.0.1:8097", "127.0.0.1:0", false).unwrap();
+                client_monitor
+            })
+            .collect();
+        let start = std::time::Instant::now();
+        for client_monitor in client_monitors.iter_mut() {
+            while client_monitor.to_string() != server_monitor.to_string() {
+                assert!(start.elapsed() < std::time::Duration::from_secs(10));
+                futures::executor::block_on(client_monitor.refresh_projects()).unwrap();
+                std::thread::sleep(std::time::Duration::from_millis(10));
+            }
+        }
+
+        client_monitors.clear();
+        let statistics = server_monitor.server_statistics();
+        assert!(statistics.requests >= 16);
+        assert!(statistics.messages_sent >= 16);
+        assert!(statistics.bytes_sent > 0);
+        server_monitor.stop_server();
+    }
+
+    #[test]
+    fn run_stream_server_test() {
+        let config = mock_jenkins::MockJenkinsConfig {
+            folder_depth: 1,
+            folders_per_folder: 2,
+            jobs_per_folder: 5,
+            ..mock_jenkins::MockJenkinsConfig::default()
+        };
+        let jenkins = mock_jenkins::MockJenkins::start("127.0.0.1:0", config).unwrap();
+        let mut server_monitor = Monitor::new(jenkins.url());
+        futures::executor::block_on(server_monitor.refresh_projects()).unwrap();
+        server_monitor.start_server("127.0.0.1:8094", false).unwrap();
+
+        let mut client_monitor = Monitor::new("");
+        client_monitor.start_stream_client("127.0.0.1:8094").unwrap();
+        let wait_for_server = |client_monitor: &mut Monitor, server_monitor: &Monitor| {
+            let start = std::time::Instant::now();
+            while client_monitor.to_string() != server_monitor.to_string() {
+                assert!(start.elapsed() < std::time::Duration::from_secs(5));
+                futures::executor::block_on(client_monitor.refresh_projects()).unwrap();
+                std::thread::sleep(std::time::Duration::from_millis(1));
+            }
+            start.elapsed()
+        };
+        wait_for_server(&mut client_monitor, &server_monitor);
+
+        // Changes are pushed right away, instead of on the next poll.
+        jenkins.finish_build(&[1], 3);
+        futures::executor::block_on(server_monitor.refresh_projects()).unwrap();
+        let latency = wait_for_server(&mut client_monitor, &server_monitor);
+        println!("Pushed the change in {:.1} ms.", latency.as_secs_f64() * 1000.0);
+        assert!(latency < std::time::Duration::from_secs(1));
+
+        // The client connects again after the server restarts, and continues from what it has.
+        server_monitor.stop_server();
+        jenkins.finish_build(&[0], 2);
+        futures::executor::block_on(server_monitor.refresh_projects()).unwrap();
+        server_monitor.start_server("127.0.0.1:8094", false).unwrap();
+        wait_for_server(&mut client_monitor, &server_monitor);
+
+        client_monitor.stop_client();
+        server_monitor.stop_server();
+    }
+
+    #[test]
+    fn run_relay_test() {
+        let config = mock_jenkins::MockJenkinsConfig {
+            folder_depth: 1,
+            folders_per_folder: 2,
+            jobs_per_folder: 5,
+            ..mock_jenkins::MockJenkinsConfig::default()
+        };
+        let jenkins = mock_jenkins::MockJenkins::start("127.0.0.1:0", config).unwrap();
+        let mut server_monitor = Monitor::new(jenkins.url());
+        futures::executor::block_on(server_monitor.refresh_projects()).unwrap();
+        server_monitor.start_server("127.0.0.1:8099", false).unwrap();
+
+        // The relay only receives the projects, and serves them to its own clients.
+        let mut relay_monitor = Monitor::new("");
+        relay_monitor.start_stream_client("127.0.0.1:8099").unwrap();
+        relay_monitor.start_server("127.0.0.1:8100", false).unwrap();
+        let mut client_monitor = Monitor::new("");
+        client_monitor.start_stream_client("127.0.0.1:8100").unwrap();
+        let wait_for_server = |relay_monitor: &mut Monitor, client_monitor: &mut Monitor, server_monitor: &Monitor| {
+            let start = std::time::Instant::now();
+            while client_monitor.to_string() != server_monitor.to_string() {
+                assert!(start.elapsed() < std::time::Duration::from_secs(5));
+                relay_monitor.refresh_received_projects(std::time::Duration::from_millis(1));
+                futures::executor::block_on(client_monitor.refresh_projects()).unwrap();
+            }
+            start.elapsed()
+        };
+        wait_for_server(&mut relay_monitor, &mut client_monitor, &server_monitor);
+        assert!(relay_monitor.client_silence().unwrap() < std::time::Duration::from_secs(2));
+
+        // Changes pass through the relay as soon as they arrive.
+        jenkins.finish_build(&[1], 3);
+        futures::executor::block_on(server_monitor.refresh_projects()).unwrap();
+        let latency = wait_for_server(&mut relay_monitor, &mut client_monitor, &server_monitor);
+        println!("Relayed the change in {:.1} ms.", latency.as_secs_f64() * 1000.0);
+        assert!(latency < std::time::Duration::from_secs(1));
+
+        // A volunteer at the relay's site reaches the server that crawls Jenkins.
+        let project_id = client_monitor.get_projects().read().unwrap()[0].id();
+        client_monitor.set_volunteering(project_id);
+        let start = std::time::Instant::now();
+        while server_monitor.get_projects().read().unwrap()[0].volunteer().is_empty() {
+            assert!(start.elapsed() < std::time::Duration::from_secs(5));
+            relay_monitor.refresh_received_projects(std::time::Duration::from_millis(1));
+        }
+        wait_for_server(&mut relay_monitor, &mut client_monitor, &server_monitor);
+
+        // When the server goes silent, the relay stops serving like the CLI does, and then its clients
+        // see that their projects are stale.
+        relay_monitor.set_max_staleness(std::time::Duration::from_secs(1));
+        client_monitor.set_max_staleness(std::time::Duration::from_secs(1));
+        assert!(!relay_monitor.is_stale());
+        assert!(!client_monitor.is_stale());
+        server_monitor.stop_server();
+        let start = std::time::Instant::now();
+        while !client_monitor.is_stale() {
+            assert!(start.elapsed() < std::time::Duration::from_secs(10));
+            relay_monitor.refresh_received_projects(std::time::Duration::from_millis(10));
+            if relay_monitor.is_stale() {
+                relay_monitor.stop_server();
+            }
+        }
+        assert!(relay_monitor.is_stale());
+        assert!(!client_monitor.get_projects().read().unwrap().is_empty());
+
+        client_monitor.stop_client();
+        relay_monitor.stop_server();
+        relay_monitor.stop_client();
+    }
+
     fn run_server_test(server_address: &str, client_address: &str, multicast: bool) {
         let jenkins = "https://jenkins";
         let mut server_monitor = Monitor::new(jenkins);
@@ -1,20 +1,28 @@
 // Copyright Sander Brattinga. All rights reserved.
 
+use crate::crawler::Crawler;
+pub use crate::crawler::{CrawlHealth, CrawlMode};
+pub use crate::jenkins_client::CacheStatistics;
+pub use crate::monitor_server::ServerStatistics;
 use crate::error::BuildMonitorError;
+use crate::event_receiver::EventReceiver;
 use crate::monitor_client::MonitorClient;
 use crate::monitor_server::MonitorServer;
-use crate::project::{Project, ProjectStatus};
+use crate::project::{Project, ProjectStatus, ProjectView};
+use crate::snapshot::{load_snapshot, save_snapshot};
 use crate::utils::get_username;
 
-use json;
+use bincode::Options;
 use serde::{Deserialize, Serialize};
 use std::collections::hash_map::DefaultHasher;
-use std::collections::VecDeque;
 use std::fmt;
-use std::hash::{Hash, Hasher};
-use std::net::ToSocketAddrs;
+use std::hash::Hasher;
+use std::net::{SocketAddr, ToSocketAddrs};
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::sync::Arc;
 use std::sync::RwLock;
+use std::time::Duration;
 
 #[derive(Deserialize, PartialEq, Serialize)]
 pub enum MessageType {
@@ -24,6 +32,10 @@ pub enum MessageType {
     NoProjectUpdate,
     ProjectUpdate,
     VolunteerAdded,
+    ProjectDelta,
+    ProjectChunk,
+    CompressedProjectUpdate,
+    UpdateNack,
 }
 
 impl std::fmt::Display for MessageType {
@@ -35,10 +47,17 @@ impl std::fmt::Display for MessageType {
             MessageType::NoProjectUpdate => write!(f, "NoProjectUpdate"),
             MessageType::ProjectUpdate => write!(f, "ProjectUpdate"),
             MessageType::VolunteerAdded => write!(f, "VolunteerAdded"),
+            MessageType::ProjectDelta => write!(f, "ProjectDelta"),
+            MessageType::ProjectChunk => write!(f, "ProjectChunk"),
+            MessageType::CompressedProjectUpdate => write!(f, "CompressedProjectUpdate"),
+            MessageType::UpdateNack => write!(f, "UpdateNack"),
         }
     }
 }
 
+// The size of a serialized Header.
+pub const HEADER_SIZE: usize = 12;
+
 #[derive(Deserialize, PartialEq, Serialize)]
 pub struct Header {
     pub version: u32,
@@ -54,31 +73,186 @@ impl Header {
             msg_type: MessageType::Invalid,
         }
     }
+
+    // Reads a header the way bincode would, except that a message type added by a newer version
+    // becomes Invalid instead of failing, so the message can be skipped. Returns the header and its
+    // size, or None when the packet is too short.
+    pub fn from_bytes(bytes: &[u8]) -> Option<(Header, usize)> {
+        if bytes.len() < HEADER_SIZE {
+            return None;
+        }
+        let (version, msg_size, msg_type) = bincode::deserialize::<(u32, u32, u32)>(&bytes[..HEADER_SIZE]).ok()?;
+        let msg_type = match msg_type {
+            1 => MessageType::Beacon,
+            2 => MessageType::ProjectUpdateRequest,
+            3 => MessageType::NoProjectUpdate,
+            4 => MessageType::ProjectUpdate,
+            5 => MessageType::VolunteerAdded,
+            6 => MessageType::ProjectDelta,
+            7 => MessageType::ProjectChunk,
+            8 => MessageType::CompressedProjectUpdate,
+            9 => MessageType::UpdateNack,
+            _ => MessageType::Invalid,
+        };
+        Some((Header { version, msg_size, msg_type }, HEADER_SIZE))
+    }
+
+    // Serializes the header the way bincode would, without allocating.
+    pub fn to_bytes(&self) -> [u8; HEADER_SIZE] {
+        let mut bytes = [0; HEADER_SIZE];
+        bincode::serialize_into(&mut bytes[..], self).unwrap();
+        bytes
+    }
+}
+
+// Puts a header with the version and message type in front of the body.
+pub fn serialize_message(version: u32, msg_type: MessageType, mut body: Vec<u8>) -> Vec<u8> {
+    let mut header = Header::new();
+    header.version = version;
+    header.msg_type = msg_type;
+    header.msg_size = body.len() as u32;
+
+    let mut message = header.to_bytes().to_vec();
+    message.append(&mut body);
+    message
+}
+
+// Reads the body of a ProjectUpdate in place, and returns its projects and the sequence that follows
+// them. Servers without deltas don't send a sequence, it's 0 then.
+pub fn deserialize_project_update(update_raw: &[u8]) -> bincode::Result<(Vec<ProjectView<'_>>, u64)> {
+    let options = bincode::DefaultOptions::new().with_fixint_encoding().allow_trailing_bytes();
+    let mut deserializer = bincode::Deserializer::from_slice(update_raw, options);
+    let views = Vec::<ProjectView>::deserialize(&mut deserializer)?;
+    let sequence = u64::deserialize(&mut deserializer).unwrap_or(0);
+    Ok((views, sequence))
+}
+
+// Splits the body of a CompressedProjectUpdate into its sequence and the projects in the encoding of
+// project_encoding, or returns None when it's too short.
+pub fn split_compressed_project_update(update_raw: &[u8]) -> Option<(u64, &[u8])> {
+    let sequence_size = bincode::serialized_size(&0u64).unwrap() as usize;
+    if update_raw.len() < sequence_size {
+        return None;
+    }
+    let sequence = bincode::deserialize::<u64>(&update_raw[..sequence_size]).ok()?;
+    Some((sequence, &update_raw[sequence_size..]))
+}
+
+// The body of a ProjectUpdateRequest. Older clients only send the hash, or the hash and sequence, and
+// older servers only read what they know.
+#[derive(Deserialize, Serialize)]
+pub struct ProjectUpdateRequest {
+    pub projects_hash: u64,
+    // The sequence of the last update the client received, or 0 when it has none.
+    pub sequence: u64,
+    // The CAPABILITY flags of the client.
+    pub capabilities: u32,
+}
+
+// The client can read a CompressedProjectUpdate, which is sent instead of a ProjectUpdate then.
+pub const CAPABILITY_COMPRESSED_UPDATES: u32 = 1;
+// The client puts ProjectChunk messages back together. Clients without it aren't sent messages that
+// don't fit in a single datagram, older clients fail on message types they don't know.
+pub const CAPABILITY_CHUNKED_MESSAGES: u32 = 2;
+
+// How long the projects of a client are current after it last heard from its server.
+pub const DEFAULT_MAX_STALENESS: Duration = Duration::from_secs(30);
+
+// The projects that were added, changed or removed since the update with base_sequence. A client that
+// doesn't have that update asks for all projects instead. A ProjectUpdate is followed by the sequence
+// of the projects in it, so clients know what the next delta applies to. A CompressedProjectUpdate
+// starts with that sequence, followed by the projects in the encoding of project_encoding.
+#[derive(Deserialize, Serialize)]
+pub struct ProjectDelta {
+    pub base_sequence: u64,
+    pub sequence: u64,
+    // The hash of all projects after applying the delta.
+    pub projects_hash: u64,
+    pub changed: Vec<Project>,
+    pub removed: Vec<u64>,
+}
+
+// The body of the Beacon of a multicast server, with the projects of its last update. A client that
+// doesn't have them missed that update, and asks for it. Older servers send beacons without a body.
+#[derive(Deserialize, Serialize)]
+pub struct BeaconInfo {
+    pub projects_hash: u64,
+    pub sequence: u64,
+}
+
+// The body of an UpdateNack, which a multicast client sends to the server for the datagrams of an
+// update it missed. The server sends them to the group again, older servers ignore it.
+#[derive(Deserialize, Serialize)]
+pub struct UpdateNack {
+    // The message id of the chunks that are missing, or 0 for the whole update with the sequence.
+    pub message_id: u64,
+    pub sequence: u64,
+    pub chunks: Vec<u32>,
+}
+
+// The hash of the current projects, shared with the server so it can answer clients without hashing
+// the projects itself. The generation goes up every time a different hash is published.
+pub struct ProjectsHash {
+    hash: AtomicU64,
+    generation: AtomicU64,
+}
+
+impl ProjectsHash {
+    pub fn new() -> ProjectsHash {
+        ProjectsHash {
+            hash: AtomicU64::new(u64::MAX),
+            generation: AtomicU64::new(0),
+        }
+    }
+
+    pub fn hash(&self) -> u64 {
+        self.hash.load(Ordering::Acquire)
+    }
+
+    pub fn generation(&self) -> u64 {
+        self.generation.load(Ordering::Acquire)
+    }
+
+    // Returns whether the hash changed.
+    pub fn publish(&self, hash: u64) -> bool {
+        if self.hash.swap(hash, Ordering::AcqRel) == hash {
+            return false;
+        }
+        self.generation.fetch_add(1, Ordering::AcqRel);
+        true
+    }
 }
 
 pub struct Monitor {
-    jenkins_server: String,
+    crawler: Crawler,
     version: u32,
     projects: Arc<RwLock<Vec<Project>>>,
-    projects_hash: u64,
+    projects_hash: Arc<ProjectsHash>,
     server: Option<MonitorServer>,
     client: Option<MonitorClient>,
-}
-
-struct RefreshedFolder {
-    folders: Vec<String>,
-    projects: Vec<Project>,
+    event_receiver: Option<EventReceiver>,
+    snapshot_path: Option<PathBuf>,
+    multicast_deltas: bool,
+    multicast_compression: bool,
+    server_workers: usize,
+    max_staleness: Duration,
 }
 
 impl Monitor {
     pub fn new(server: &str) -> Monitor {
         Monitor {
-            jenkins_server: server.to_string(),
+            crawler: Crawler::new(server),
             version: 1,
             projects: Arc::new(RwLock::new(Vec::new())),
-            projects_hash: u64::MAX,
+            projects_hash: Arc::new(ProjectsHash::new()),
             server: None,
             client: None,
+            event_receiver: None,
+            snapshot_path: None,
+            multicast_deltas: false,
+            multicast_compression: false,
+            server_workers: 1,
+            max_staleness: DEFAULT_MAX_STALENESS,
         }
     }
 
@@ -91,13 +265,6 @@ impl Monitor {
                 }
             }
             None => {
-                let reqwest_client = Arc::new(
-                    reqwest::blocking::Client::builder()
-                        .danger_accept_invalid_certs(true)
-                        .build()
-                        .unwrap(),
-                );
-
                 let mut volunteers = Vec::new();
                 {
                     let projects = self.projects.read().unwrap();
@@ -111,27 +278,8 @@ impl Monitor {
                 }
 
                 {
-                    let mut projects = Vec::<Project>::new();
-                    let mut folders_to_crawl: VecDeque<String> = VecDeque::new();
-                    folders_to_crawl.push_back(self.jenkins_server.clone());
-                    while !folders_to_crawl.is_empty() {
-                        let url = folders_to_crawl.pop_front().unwrap();
-                        let mut result = self.refresh_folder(&reqwest_client, &url).await?;
-                        for element in result.folders {
-                            folders_to_crawl.push_back(element);
-                        }
-                        projects.append(&mut result.projects);
-                    }
-
-                    projects.sort_by(|lhs, rhs| {
-                        let sort = lhs.folder().cmp(rhs.folder());
-                        if sort == std::cmp::Ordering::Equal {
-                            lhs.name().cmp(rhs.name())
-                        }
-                        else {
-                            sort
-                        }
-                    });
+                    let mut projects = self.crawler.crawl()?;
+                    Monitor::sort_projects(&mut projects);
 
                     for (id, name) in volunteers.iter() {
                         match projects.iter_mut().find(|p| p.id() == *id) {
@@ -149,31 +297,266 @@ impl Monitor {
             }
         };
 
+        Ok(self.publish_projects())
+    }
+
+    // Waits up to the timeout for build notifications and refreshes only the projects that were
+    // notified. Without an event receiver this only waits. Returns whether the projects changed.
+    pub fn refresh_notified_projects(&mut self, timeout: Duration) -> bool {
+        let job_urls = match &self.event_receiver {
+            Some(event_receiver) => event_receiver.wait_for_events(timeout),
+            None => {
+                std::thread::sleep(timeout);
+                return false;
+            }
+        };
+
+        let mut refreshed_projects = Vec::new();
+        for job_url in job_urls.iter() {
+            match self.crawler.refresh_project(job_url) {
+                Ok(Some(project)) => refreshed_projects.push(project),
+                Ok(None) => println!("Received a notification for unknown project {}.", job_url),
+                Err(e) => eprintln!("Failed to refresh {}. Error: {}", job_url, e),
+            }
+        }
+        if refreshed_projects.is_empty() {
+            return false;
+        }
+
+        {
+            let mut projects = self.projects.write().unwrap();
+            for mut refreshed_project in refreshed_projects {
+                match projects.iter_mut().find(|p| p.url() == refreshed_project.url()) {
+                    Some(project) => {
+                        if project.volunteer().len() > 0 && refreshed_project.status() != ProjectStatus::Success {
+                            refreshed_project.set_volunteer(project.volunteer());
+                        }
+                        *project = refreshed_project;
+                    },
+                    None => {}
+                }
+            }
+        }
+
+        self.publish_projects()
+    }
+
+    // Waits up to the timeout for the client to receive projects from its server, and publishes them to
+    // the clients of this monitor's server right away. This is what a relay does instead of crawling.
+    // Without a client this only waits. Returns whether the projects changed.
+    pub fn refresh_received_projects(&mut self, timeout: Duration) -> bool {
+        let new_projects = match &self.client {
+            Some(client) => {
+                if !client.wait_for_projects(timeout) {
+                    return false;
+                }
+                match client.get_projects() {
+                    (true, new_projects) => new_projects,
+                    _ => return false,
+                }
+            }
+            None => {
+                std::thread::sleep(timeout);
+                return false;
+            }
+        };
+        *self.projects.write().unwrap() = new_projects;
+        self.publish_projects()
+    }
+
+    // How long the client hasn't heard from its server. None without a client, or when the client
+    // didn't hear anything yet.
+    pub fn client_silence(&self) -> Option<Duration> {
+        self.client.as_ref()?.last_received().map(|last_received| last_received.elapsed())
+    }
+
+    // Whether the projects of the client may be out of date, because it didn't hear from its server for
+    // the max staleness, or didn't hear from it at all yet. Projects that are crawled are never stale.
+    pub fn is_stale(&self) -> bool {
+        match &self.client {
+            Some(_) => self.client_silence().map_or(true, |silence| silence >= self.max_staleness),
+            None => false,
+        }
+    }
+
+    pub fn max_staleness(&self) -> Duration {
+        self.max_staleness
+    }
+
+    pub fn set_max_staleness(&mut self, max_staleness: Duration) {
+        self.max_staleness = max_staleness;
+    }
+
+    // Publishes the hash of the projects and lets the clients know when it changed.
+    fn publish_projects(&mut self) -> bool {
         let projects_hash = Monitor::generate_projects_hash(&self.projects.read().unwrap());
-        let has_new_projects = projects_hash != self.projects_hash;
+        let has_new_projects = self.projects_hash.publish(projects_hash);
         if has_new_projects {
-            self.projects_hash = projects_hash;
             match &mut self.server {
                 Some(server) => server.update_clients(),
                 None => {}
             }
+            if self.client.is_none() {
+                self.store_snapshot();
+            }
         }
+        has_new_projects
+    }
+
+    // Remembers where the projects are stored after every crawl that changed them.
+    pub fn set_snapshot_path(&mut self, snapshot_path: &str) {
+        self.snapshot_path = Some(PathBuf::from(snapshot_path));
+    }
 
-        Ok(has_new_projects)
+    // Replaces the projects with the ones stored by a previous run for the same Jenkins server.
+    // Returns false when no snapshot was found.
+    pub fn load_snapshot(&mut self) -> Result<bool, BuildMonitorError> {
+        let snapshot_path = match &self.snapshot_path {
+            Some(snapshot_path) => snapshot_path,
+            None => return Ok(false),
+        };
+
+        match load_snapshot(snapshot_path, self.crawler.jenkins_server())? {
+            Some((projects_hash, projects)) => {
+                *self.projects.write().unwrap() = projects;
+                self.projects_hash.publish(projects_hash);
+                match &mut self.server {
+                    Some(server) => server.update_clients(),
+                    None => {}
+                }
+                Ok(true)
+            }
+            None => Ok(false),
+        }
+    }
+
+    fn store_snapshot(&self) {
+        match &self.snapshot_path {
+            Some(snapshot_path) => {
+                let projects = self.projects.read().unwrap();
+                match save_snapshot(snapshot_path, self.crawler.jenkins_server(), &projects) {
+                    Ok(()) => {}
+                    Err(e) => eprintln!("Failed to store snapshot. Error: {}", e),
+                }
+            }
+            None => {}
+        }
     }
 
     pub fn get_projects(&self) -> &Arc<RwLock<Vec<Project>>> {
         &self.projects
     }
 
+    pub fn max_concurrent_requests(&self) -> usize {
+        self.crawler.max_concurrent_requests()
+    }
+
+    pub fn set_max_concurrent_requests(&mut self, max_concurrent_requests: usize) {
+        self.crawler.set_max_concurrent_requests(max_concurrent_requests);
+    }
+
+    pub fn crawl_mode(&self) -> CrawlMode {
+        self.crawler.crawl_mode()
+    }
+
+    pub fn set_crawl_mode(&mut self, crawl_mode: CrawlMode) {
+        self.crawler.set_crawl_mode(crawl_mode);
+    }
+
+    pub fn request_timeout(&self) -> Duration {
+        self.crawler.request_timeout()
+    }
+
+    pub fn set_request_timeout(&mut self, request_timeout: Duration) {
+        self.crawler.set_request_timeout(request_timeout);
+    }
+
+    pub fn crawl_deadline(&self) -> Duration {
+        self.crawler.crawl_deadline()
+    }
+
+    // After the deadline no new requests are started. Whatever wasn't refreshed by then keeps its
+    // previous state until the next refresh.
+    pub fn set_crawl_deadline(&mut self, crawl_deadline: Duration) {
+        self.crawler.set_crawl_deadline(crawl_deadline);
+    }
+
+    // The folders and projects that couldn't be refreshed during the last refresh.
+    pub fn crawl_health(&self) -> CrawlHealth {
+        self.crawler.crawl_health()
+    }
+
+    pub fn topology_refresh_interval(&self) -> Duration {
+        self.crawler.topology_refresh_interval()
+    }
+
+    // How long the folders found while crawling are reused before the folder tree is searched again.
+    pub fn set_topology_refresh_interval(&mut self, topology_refresh_interval: Duration) {
+        self.crawler.set_topology_refresh_interval(topology_refresh_interval);
+    }
+
+    // Makes the next refresh search the whole folder tree again, for example after folders were added.
+    pub fn invalidate_topology(&self) {
+        self.crawler.invalidate_topology();
+    }
+
+    pub fn cache_statistics(&self) -> CacheStatistics {
+        self.crawler.cache_statistics()
+    }
+
+    // Combines the cached content hashes, so only projects that changed since the last call are hashed
+    // in full.
     pub fn generate_projects_hash(projects: &Vec<Project>) -> u64 {
+        Monitor::combine_content_hashes(projects.iter().map(|project| project.content_hash()))
+    }
+
+    // The projects hash of projects with these content hashes, for when they aren't Projects yet.
+    pub(crate) fn combine_content_hashes(content_hashes: impl Iterator<Item = u64>) -> u64 {
         let mut hasher = DefaultHasher::new();
-        for project in projects.iter() {
-            project.hash(&mut hasher);
+        for content_hash in content_hashes {
+            hasher.write_u64(content_hash);
         }
         hasher.finish()
     }
 
+    // The order the server sends the projects in. Clients sort the projects the same way after applying
+    // a delta. Workers finish in any order, so the url breaks ties to keep the result deterministic.
+    pub fn sort_projects(projects: &mut Vec<Project>) {
+        projects.sort_by(|lhs, rhs| {
+            lhs.folder().cmp(rhs.folder())
+                .then_with(|| lhs.name().cmp(rhs.name()))
+                .then_with(|| lhs.url().cmp(rhs.url()))
+        });
+    }
+
+    // Multicasts only the projects that changed, instead of all projects. Clients that are older than
+    // deltas can't read them, so only enable this once every client was updated. Clients that query
+    // the server always get deltas when they support them.
+    pub fn set_multicast_deltas(&mut self, multicast_deltas: bool) {
+        self.multicast_deltas = multicast_deltas;
+        match &mut self.server {
+            Some(server) => server.set_multicast_deltas(multicast_deltas),
+            None => {}
+        }
+    }
+
+    // Multicasts all projects in the compressed encoding. Like deltas, only enable this once every
+    // client supports it. Clients that query the server get it whenever they support it.
+    pub fn set_multicast_compression(&mut self, multicast_compression: bool) {
+        self.multicast_compression = multicast_compression;
+        match &mut self.server {
+            Some(server) => server.set_multicast_compression(multicast_compression),
+            None => {}
+        }
+    }
+
+    // How many threads answer the clients of a server that is started without multicast. On systems
+    // with SO_REUSEPORT each has its own socket on the server's address, elsewhere there's always one.
+    // Only applies to servers that are started after this.
+    pub fn set_server_workers(&mut self, server_workers: usize) {
+        self.server_workers = std::cmp::max(server_workers, 1);
+    }
+
     pub fn start_server(&mut self, address: &str, multicast: bool) -> Result<(), String> {
         let address = match address.to_socket_addrs() {
             Ok(mut address) =>
@@ -185,20 +568,63 @@ impl Monitor {
             Err(_) => return Err("Failed to convert address to ip.".to_string())
         };
 
-        self.server = Some(MonitorServer::new(
+        let mut server = MonitorServer::new(
             address,
             self.version,
             self.projects.clone(),
-            multicast
-        ));
+            self.projects_hash.clone(),
+            multicast,
+            self.server_workers
+        );
+        server.set_multicast_deltas(self.multicast_deltas);
+        server.set_multicast_compression(self.multicast_compression);
+        self.server = Some(server);
+        self.connect_relay();
 
         return Ok(());
     }
 
+    // What the running server received and sent since it started, zero without a server.
+    pub fn server_statistics(&self) -> ServerStatistics {
+        match &self.server {
+            Some(server) => server.statistics(),
+            None => ServerStatistics::default(),
+        }
+    }
+
     pub fn stop_server(self: &mut Monitor) {
         self.server = None;
     }
 
+    // Listens for build notifications from Jenkins on the address, for example from the notification
+    // plugin with an HTTP endpoint of http://{address}/. Use port 0 to pick a free port.
+    pub fn start_event_receiver(&mut self, address: &str) -> Result<(), String> {
+        let address = match address.to_socket_addrs() {
+            Ok(mut address) =>
+                match address.next() {
+                    Some(address) => address,
+                    None => return Err("Failed to fetch first address.".to_string())
+                }
+            ,
+            Err(_) => return Err("Failed to convert address to ip.".to_string())
+        };
+
+        self.event_receiver = match EventReceiver::new(address) {
+            Ok(event_receiver) => Some(event_receiver),
+            Err(e) => return Err(format!("Failed to listen on {}: {}", address, e)),
+        };
+
+        return Ok(());
+    }
+
+    pub fn stop_event_receiver(&mut self) {
+        self.event_receiver = None;
+    }
+
+    pub fn event_receiver_address(&self) -> Option<SocketAddr> {
+        self.event_receiver.as_ref().map(|event_receiver| event_receiver.address())
+    }
+
     pub fn start_client(&mut self, server_address: &str, client_address: &str, multicast: bool) -> Result<(), String> {
         let server_address = match server_address.to_socket_addrs() {
             Ok(mut address) =>
@@ -226,12 +652,41 @@ impl Monitor {
             self.version,
             multicast
         ));
+        self.connect_relay();
 
         return Ok(())
     }
 
+    // Keeps a TCP connection open to a server that was started without multicast, which pushes the
+    // projects as soon as they change. The connection is made again when it's lost.
+    pub fn start_stream_client(&mut self, server_address: &str) -> Result<(), String> {
+        let server_address = match server_address.to_socket_addrs() {
+            Ok(mut address) =>
+                match address.next() {
+                    Some(address) => address,
+                    None => return Err("Failed to fetch first address of server_address.".to_string())
+                }
+            ,
+            Err(_) => return Err("Failed to convert server address to ip.".to_string())
+        };
+
+        self.client = Some(MonitorClient::new_stream(server_address, self.version));
+        self.connect_relay();
+        Ok(())
+    }
+
     pub fn stop_client(&mut self) {
         self.client = None;
+        self.connect_relay();
+    }
+
+    // A monitor with both a client and a server is a relay, the volunteers that its server receives
+    // are passed on to the server its client receives the projects from.
+    fn connect_relay(&mut self) {
+        match &mut self.server {
+            Some(server) => server.set_volunteer_forwarder(self.client.as_ref().map(|client| client.volunteer_forwarder())),
+            None => {}
+        }
     }
 
     pub fn set_volunteering(&self, project_id: u64) {
@@ -251,59 +706,6 @@ impl Monitor {
             None => eprintln!("Failed to set volunteering on project. Client hasn't been created."),
         }
     }
-
-    async fn refresh_folder(
-        &self,
-        reqwest_client: &Arc<reqwest::blocking::Client>,
-        refresh_url: &str,
-    ) -> Result<RefreshedFolder, BuildMonitorError> {
-        let refresh_url = refresh_url.to_owned();
-        let json = self.get_json(&reqwest_client, &refresh_url).await?;
-        let mut folder_start = self.jenkins_server.len();
-        if self.jenkins_server.chars().nth(folder_start - 1).unwrap() != '/' {
-            folder_start += 1;
-        }
-        let mut folder_name = String::new();
-        if folder_start < refresh_url.len() {
-            folder_name = refresh_url[folder_start..].replace("job/", "");
-        }
-
-        let mut folders: Vec<String> = Vec::new();
-        let mut projects: Vec<Project> = Vec::new();
-        for job in json["jobs"].members() {
-            let class = &job["_class"];
-            if class == "com.cloudbees.hudson.plugins.folder.Folder" {
-                let url = job["url"]
-                    .as_str()
-                    .ok_or_else(|| BuildMonitorError::FieldError {})
-                    .unwrap();
-                folders.push(url.to_string());
-            } else if class == "hudson.model.FreeStyleProject" {
-                let url = job["url"]
-                    .as_str()
-                    .ok_or_else(|| BuildMonitorError::FieldError {})
-                    .unwrap();
-                let project = Project::new(&folder_name, url);
-                projects.push(project);
-            }
-        }
-
-        for project in projects.iter_mut() {
-            project.refresh_status(reqwest_client.clone()).await?;
-        }
-
-        Ok(RefreshedFolder { folders, projects })
-    }
-
-    async fn get_json(
-        &self,
-        reqwest_client: &Arc<reqwest::blocking::Client>,
-        url: &str,
-    ) -> Result<json::JsonValue, BuildMonitorError> {
-        let api_url = url.to_string() + "/api/json";
-        let text = reqwest_client.get(&api_url).send()?.text()?;
-        Ok(json::parse(&text)?)
-    }
 }
 
 impl fmt::Display for Monitor {
@@ -1,46 +1,243 @@
 // Copyright Sander Brattinga. All rights reserved.
 
-use crate::monitor::{Header, MessageType, Monitor};
+use crate::chunked_message::{Reassembler, MAX_RECEIVE_SIZE, SOCKET_RECV_BUFFER_SIZE};
+use crate::framed_stream::FrameReader;
+use crate::monitor::{
+    deserialize_project_update, serialize_message, split_compressed_project_update, BeaconInfo, Header, MessageType, Monitor,
+    ProjectDelta, ProjectUpdateRequest, UpdateNack, CAPABILITY_CHUNKED_MESSAGES, CAPABILITY_COMPRESSED_UPDATES,
+};
 use crate::project::{Project, Volunteer};
+use crate::project_encoding::decode_projects;
+use crate::refresh_signal::RefreshSignal;
 use crate::utils::{get_username, get_local_addresses};
 
+use mio::net::UdpSocket;
+use mio::{Events, Interest, Poll, Token, Waker};
 use socket2::{Domain, Protocol, Socket, Type};
-use std::net::{IpAddr, Ipv4Addr, Ipv6Addr, SocketAddr, UdpSocket};
+use std::borrow::Cow;
+use std::collections::HashMap;
+use std::collections::hash_map::RandomState;
+use std::hash::{BuildHasher, Hasher};
+use std::io::Write;
+use std::net::{IpAddr, Ipv4Addr, Ipv6Addr, SocketAddr, TcpStream};
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::sync::{Arc, RwLock};
 use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+
+// How long a client waits for the answer to a request.
+const RESPONSE_TIMEOUT: Duration = Duration::from_secs(1);
+// How often a client that queries the server asks for an update.
+const QUERY_INTERVAL: Duration = Duration::from_secs(15);
+// The server sends a beacon every second, a stream that is silent for longer than this is lost.
+const STREAM_TIMEOUT: Duration = Duration::from_secs(5);
+// How long a stream client waits before connecting again, doubled after every failed attempt.
+const MIN_RECONNECT_DELAY: Duration = Duration::from_millis(250);
+const MAX_RECONNECT_DELAY: Duration = Duration::from_secs(15);
+// How long a multicast client waits before it asks for datagrams it missed, plus a random part of it
+// again. The chunks of a message follow each other within a millisecond, and the clients that missed
+// the same datagrams don't all ask at once. Most see the repair another client asked for first.
+const NACK_DELAY: Duration = Duration::from_millis(20);
+
+// The events the client threads wait for.
+const SOCKET_TOKEN: Token = Token(0);
+const WAKE_TOKEN: Token = Token(1);
 
 struct MonitorClientThreadData {
     running: bool,
     version: u32,
     projects: RwLock<Vec<Project>>,
+    // Requested every time projects were received.
+    received_signal: Arc<RefreshSignal>,
+    // When the last message of the server arrived, beacons included.
+    last_received: Option<Instant>,
     volunteers: Arc<RwLock<Vec<Volunteer>>>,
     server_address: SocketAddr,
     client_address: SocketAddr,
 }
 
-fn client_request_server_update(socket: &UdpSocket, version: u32, address: &SocketAddr, projects_hash: u64) {
+// Passes volunteers that arrived at the server of a relay on to the server the relay's client
+// receives its projects from.
+#[derive(Clone)]
+pub struct VolunteerForwarder {
+    volunteers: Arc<RwLock<Vec<Volunteer>>>,
+    waker: Arc<Waker>,
+}
+
+impl VolunteerForwarder {
+    pub fn forward(&self, volunteer: Volunteer) {
+        self.volunteers.write().unwrap().push(volunteer);
+        match self.waker.wake() {
+            Ok(()) => {},
+            Err(e) => eprintln!("Failed to wake the connection thread. Error: {}", e)
+        }
+    }
+}
+
+// The projects as they were last received from the server, deltas are applied to these.
+struct ReceivedProjects {
+    projects: Vec<Project>,
+    // The sequence of the received projects, or 0 when the next update has to contain all projects.
+    sequence: u64,
+    projects_hash: u64,
+}
+
+impl ReceivedProjects {
+    fn new() -> ReceivedProjects {
+        ReceivedProjects {
+            projects: Vec::new(),
+            sequence: 0,
+            projects_hash: 0,
+        }
+    }
+
+    // Returns false when the projects are the same as the received ones, like a multicast update that
+    // another client asked for. Those are only read in place, and not copied.
+    fn apply_update(&mut self, projects_raw: &[u8]) -> bool {
+        let views = match deserialize_project_update(projects_raw) {
+            Ok((views, sequence)) => {
+                self.sequence = sequence;
+                views
+            }
+            Err(e) => {
+                eprintln!("Failed to read the project update. Error: {}", e);
+                return false;
+            }
+        };
+
+        let projects_hash = Monitor::combine_content_hashes(views.iter().map(|view| view.content_hash()));
+        if projects_hash == self.projects_hash {
+            return false;
+        }
+        self.projects_hash = projects_hash;
+        self.projects = views.iter().map(|view| view.to_project()).collect();
+        true
+    }
+
+    fn apply_compressed_update(&mut self, update_raw: &[u8]) -> bool {
+        let (sequence, encoded_projects) = match split_compressed_project_update(update_raw) {
+            Some(update) => update,
+            None => {
+                eprintln!("Failed to read the compressed project update, it's too short.");
+                return false;
+            }
+        };
+        let projects = match decode_projects(encoded_projects) {
+            Ok(projects) => projects,
+            Err(e) => {
+                eprintln!("Failed to read the compressed project update. Error: {}", e);
+                return false;
+            }
+        };
+        self.sequence = sequence;
+        self.projects_hash = Monitor::generate_projects_hash(&projects);
+        self.projects = projects;
+        true
+    }
+
+    // Applies a ProjectUpdate or a CompressedProjectUpdate.
+    fn apply_any_update(&mut self, msg_type: &MessageType, update_raw: &[u8]) -> bool {
+        if *msg_type == MessageType::CompressedProjectUpdate {
+            self.apply_compressed_update(update_raw)
+        }
+        else {
+            self.apply_update(update_raw)
+        }
+    }
+
+    // Returns false when the delta doesn't apply to the received projects, for example because an
+    // earlier delta was missed. All projects have to be requested again then.
+    fn apply_delta(&mut self, delta_raw: &[u8]) -> bool {
+        let delta = match bincode::deserialize::<ProjectDelta>(delta_raw) {
+            Ok(delta) => delta,
+            Err(e) => {
+                eprintln!("Failed to read the project delta. Error: {}", e);
+                self.sequence = 0;
+                return false;
+            }
+        };
+        if self.sequence == 0 || delta.base_sequence != self.sequence {
+            println!("Missed an update, the delta is based on {} instead of {}.", delta.base_sequence, self.sequence);
+            self.sequence = 0;
+            return false;
+        }
+
+        self.projects.retain(|project| !delta.removed.contains(&project.id()));
+        let indices: HashMap<u64, usize> = self.projects
+            .iter()
+            .enumerate()
+            .map(|(index, project)| (project.id(), index))
+            .collect();
+        for project in delta.changed {
+            match indices.get(&project.id()) {
+                Some(index) => self.projects[*index] = project,
+                None => self.projects.push(project),
+            }
+        }
+        Monitor::sort_projects(&mut self.projects);
+
+        self.projects_hash = Monitor::generate_projects_hash(&self.projects);
+        if self.projects_hash != delta.projects_hash {
+            eprintln!("The projects don't match the server after applying the delta.");
+            self.sequence = 0;
+            return false;
+        }
+        self.sequence = delta.sequence;
+        true
+    }
+}
+
+fn client_update_request_message(version: u32, projects_hash: u64, sequence: u64) -> Vec<u8> {
     println!("Sending hash {}", projects_hash);
+    let request = ProjectUpdateRequest {
+        projects_hash,
+        sequence,
+        capabilities: CAPABILITY_COMPRESSED_UPDATES | CAPABILITY_CHUNKED_MESSAGES,
+    };
+    serialize_message(version, MessageType::ProjectUpdateRequest, bincode::serialize(&request).unwrap())
+}
+
+fn client_request_server_update(socket: &UdpSocket, version: u32, address: &SocketAddr, projects_hash: u64, sequence: u64) {
+    let write_buffer = client_update_request_message(version, projects_hash, sequence);
+    println!("Requesting a project update. Address {}", address);
+    match socket.send_to(&write_buffer, *address) {
+        Ok(_) => {},
+        Err(e) => eprintln!("Failed to request a project update. Error: {}", e),
+    }
+}
+
+// Somewhere between the NACK delay and twice that, different for every call.
+fn client_nack_delay() -> Duration {
+    let random = RandomState::new().build_hasher().finish();
+    NACK_DELAY + Duration::from_micros(random % NACK_DELAY.as_micros() as u64)
+}
+
+fn client_send_nack(socket: &UdpSocket, version: u32, address: &SocketAddr, nack: &UpdateNack) {
     let mut header = Header::new();
     header.version = version;
-    header.msg_type = MessageType::ProjectUpdateRequest;
-    let mut serialized_msg = bincode::serialize(&projects_hash).unwrap();
+    header.msg_type = MessageType::UpdateNack;
+    let mut serialized_msg = bincode::serialize(nack).unwrap();
     header.msg_size = serialized_msg.len() as u32;
 
     let mut write_buffer: Vec<u8> = Vec::new();
     write_buffer.append(&mut bincode::serialize(&header).unwrap());
     write_buffer.append(&mut serialized_msg);
-    println!("Requesting a project update. Address {}", address);
-    socket.send_to(&write_buffer, address).unwrap();
+    println!("Asking for {} missed datagrams again. Address {}", if nack.message_id != 0 { nack.chunks.len().to_string() } else { "all".to_string() }, address);
+    match socket.send_to(&write_buffer, *address) {
+        Ok(_) => {},
+        Err(e) => eprintln!("Failed to ask for missed datagrams. Error: {}", e),
+    }
 }
 
-fn client_receive_packet(socket: &UdpSocket, recv_buffer: &mut [u8]) -> Result<(Header, Vec<u8>, SocketAddr), ()> {
-    let mut deserialize_buffer = Vec::new();
-    let from_address;
-    match socket.recv_from(recv_buffer) {
+// Returns Ok(None) for a chunk of a message that didn't arrive completely yet, and the whole message
+// once its last chunk arrives. The body of a message that fit in one datagram is borrowed from the
+// receive buffer.
+fn client_receive_packet<'a>(socket: &UdpSocket, recv_buffer: &'a mut [u8], reassembler: &mut Reassembler) ->
+    Result<Option<(Header, Cow<'a, [u8]>, SocketAddr)>, ()> {
+    let (bytes_read, from_address) = match socket.recv_from(recv_buffer) {
         Ok((bytes_read, from)) => {
             println!("Received {} bytes", bytes_read);
-            deserialize_buffer.extend_from_slice(&recv_buffer[..bytes_read]);
-            from_address = from;
+            (bytes_read, from)
         }
         Err(error) => {
             if error.kind() != std::io::ErrorKind::WouldBlock {
@@ -48,18 +245,70 @@ fn client_receive_packet(socket: &UdpSocket, recv_buffer: &mut [u8]) -> Result<(
             }
             return Err(());
         }
+    };
+
+    // Packets that are too short or from a newer version are skipped as Invalid.
+    let packet = &recv_buffer[..bytes_read];
+    let (header, header_size) = match Header::from_bytes(packet) {
+        Some(header) => header,
+        None => return Ok(Some((Header::new(), Cow::Borrowed(&[]), from_address))),
+    };
+    if header.msg_type != MessageType::ProjectChunk {
+        return Ok(Some((header, Cow::Borrowed(&packet[header_size..]), from_address)));
     }
 
-    let mut header = Header::new();
-    let header_raw: Vec<u8> = deserialize_buffer
-        .drain(..bincode::serialized_size(&header).unwrap() as usize)
-        .collect();
-    header = bincode::deserialize::<Header>(&header_raw).unwrap();
+    match reassembler.add_chunk(from_address, &packet[header_size..]) {
+        Some(mut message) => match Header::from_bytes(&message) {
+            Some((header, header_size)) => {
+                message.drain(..header_size);
+                Ok(Some((header, Cow::Owned(message), from_address)))
+            }
+            None => Ok(None),
+        },
+        None => Ok(None),
+    }
+}
 
-    return Ok((header, deserialize_buffer, from_address));
+// Waits until the socket can be read, the client is woken up or the timeout passed.
+fn client_wait(poll: &mut Poll, events: &mut Events, timeout: Option<Duration>) {
+    match poll.poll(events, timeout) {
+        Ok(()) => {},
+        Err(e) if e.kind() == std::io::ErrorKind::Interrupted => {},
+        Err(e) => eprintln!("Failed to wait for the socket. Error: {}", e),
+    }
 }
 
-fn client_send_volunteers(data: &Arc<RwLock<MonitorClientThreadData>>, socket: &UdpSocket, address: &Option<SocketAddr>) {
+fn client_set_recv_buffer_size(socket: &Socket) {
+    match socket.set_recv_buffer_size(SOCKET_RECV_BUFFER_SIZE) {
+        Ok(()) => {},
+        Err(e) => eprintln!("Failed to enlarge the receive buffer. Error: {}", e),
+    }
+}
+
+fn client_publish_projects(data: &Arc<RwLock<MonitorClientThreadData>>, received_projects: &ReceivedProjects) {
+    let read_locked = data.read().unwrap();
+    *read_locked.projects.write().unwrap() = received_projects.projects.clone();
+    read_locked.received_signal.request();
+}
+
+// Whether the beacon shows that the client doesn't have the last update of the server. Beacons of older
+// servers don't say, the client only asks them for projects when it has none.
+fn client_missed_update(beacon_raw: &[u8], received_projects: &ReceivedProjects, has_received_projects: bool) -> bool {
+    if !has_received_projects {
+        return true;
+    }
+    match bincode::deserialize::<BeaconInfo>(beacon_raw) {
+        Ok(beacon) => beacon.projects_hash != received_projects.projects_hash,
+        Err(_) => false,
+    }
+}
+
+fn client_heard_from_server(data: &Arc<RwLock<MonitorClientThreadData>>) {
+    data.write().unwrap().last_received = Some(Instant::now());
+}
+
+// Takes the pending volunteers, and returns a VolunteerAdded message for each of them.
+fn client_volunteer_messages(data: &Arc<RwLock<MonitorClientThreadData>>) -> Vec<Vec<u8>> {
     let volunteers: Vec<Volunteer>;
     let version;
     {
@@ -68,21 +317,29 @@ fn client_send_volunteers(data: &Arc<RwLock<MonitorClientThreadData>>, socket: &
         let volunteer_write_lock = data_read_lock.volunteers.write();
         volunteers = volunteer_write_lock.unwrap().drain(..).collect();
     }
-    for volunteer in volunteers {
-        let mut send_header = Header::new();
-        send_header.version = version;
-        send_header.msg_type = MessageType::VolunteerAdded;
-
-        let mut volunteer_data: Vec<u8> = bincode::serialize(&volunteer).unwrap();
-        send_header.msg_size = volunteer_data.len() as u32;
-
-        let mut write_buffer: Vec<u8> = Vec::new();
-        write_buffer.append(&mut bincode::serialize(&send_header).unwrap());
-        write_buffer.append(&mut volunteer_data);
+    volunteers
+        .iter()
+        .map(|volunteer| {
+            let mut send_header = Header::new();
+            send_header.version = version;
+            send_header.msg_type = MessageType::VolunteerAdded;
+
+            let mut volunteer_data: Vec<u8> = bincode::serialize(volunteer).unwrap();
+            send_header.msg_size = volunteer_data.len() as u32;
+
+            let mut write_buffer: Vec<u8> = Vec::new();
+            write_buffer.append(&mut bincode::serialize(&send_header).unwrap());
+            write_buffer.append(&mut volunteer_data);
+            write_buffer
+        })
+        .collect()
+}
 
+fn client_send_volunteers(data: &Arc<RwLock<MonitorClientThreadData>>, socket: &UdpSocket, address: &Option<SocketAddr>) {
+    for write_buffer in client_volunteer_messages(data) {
         match address {
             Some(address) => {
-                match socket.send_to(&write_buffer, &address) {
+                match socket.send_to(&write_buffer, *address) {
                     Ok(_bytes_written) => {},
                     Err(e) => eprintln!("Failed to send volunteer list. {}", e)
                 }
@@ -92,7 +349,7 @@ fn client_send_volunteers(data: &Arc<RwLock<MonitorClientThreadData>>, socket: &
     }
 }
 
-fn client_multicast_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>>) {
+fn client_multicast_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>>, mut poll: Poll) {
     let multicast_address;
     {
         let lock = data.read();
@@ -108,6 +365,7 @@ fn client_multicast_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>
     socket
         .set_nonblocking(true)
         .expect("Failed to set non blocking.");
+    client_set_recv_buffer_size(&socket);
 
     let bind_address = match multicast_address.ip() {
         IpAddr::V4(_ip) => SocketAddr::new(IpAddr::V4(Ipv4Addr::UNSPECIFIED), multicast_address.port()),
@@ -146,9 +404,19 @@ fn client_multicast_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>
         }
     };
 
-    let socket: UdpSocket = socket.into();
+    let mut socket = UdpSocket::from_std(socket.into());
+    poll.registry()
+        .register(&mut socket, SOCKET_TOKEN, Interest::READABLE)
+        .expect("Failed to register socket.");
+    let mut events = Events::with_capacity(16);
+    let mut received_projects = ReceivedProjects::new();
+    let mut reassembler = Reassembler::new();
     let mut has_received_projects = false;
     let mut from_address = None;
+    let mut recv_buffer = vec![0; MAX_RECEIVE_SIZE];
+    // The update a beacon showed was missed, which is asked for once its delay passed.
+    let mut pending_nack: Option<(Instant, SocketAddr, BeaconInfo)> = None;
+    let mut nacked_sequence = 0;
     loop {
         let running;
         let version;
@@ -162,43 +430,84 @@ fn client_multicast_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>
             break;
         }
 
-        const RECV_BUFFER_SIZE: usize = 1 * 1024 * 1024;
-        let mut recv_buffer: [u8; RECV_BUFFER_SIZE] = [0; RECV_BUFFER_SIZE];
         loop {
-            match client_receive_packet(&socket, &mut recv_buffer) {
-                Ok((header, mut deserialize_buffer, address)) => {
+            match client_receive_packet(&socket, &mut recv_buffer, &mut reassembler) {
+                Ok(Some((header, deserialize_buffer, address))) => {
                     if header.version == version {
+                        client_heard_from_server(data);
                         println!("Version matched! {} | {}", header.msg_type, header.msg_size);
-                        if header.msg_type == MessageType::ProjectUpdate {
+                        if header.msg_type == MessageType::ProjectUpdate || header.msg_type == MessageType::CompressedProjectUpdate {
                             println!("Message type is project update!");
                             // Ensure the full message fit into the packet.
                             if header.msg_size >= deserialize_buffer.len() as u32 {
                                 println!("Received a project update");
-                                let projects_raw: Vec<u8> = deserialize_buffer
-                                    .drain(..header.msg_size as usize)
-                                    .collect();
-                                let projects = bincode::deserialize::<Vec<Project>>(&projects_raw).unwrap();
-                                let read_locked = data.read().unwrap();
-                                *read_locked.projects.write().unwrap() = projects;
-                                has_received_projects = true;
+                                if received_projects.apply_any_update(&header.msg_type, &deserialize_buffer) {
+                                    client_publish_projects(data, &received_projects);
+                                    has_received_projects = true;
+                                }
                             }
-                        } else if !has_received_projects && header.msg_type == MessageType::Beacon {
+                        } else if header.msg_type == MessageType::ProjectDelta {
+                            if header.msg_size >= deserialize_buffer.len() as u32 {
+                                if received_projects.apply_delta(&deserialize_buffer) {
+                                    client_publish_projects(data, &received_projects);
+                                }
+                                else if has_received_projects {
+                                    client_request_server_update(&socket, version, &address, received_projects.projects_hash, 0);
+                                }
+                            }
+                        } else if header.msg_type == MessageType::Beacon {
                             from_address = Some(address);
-                            client_request_server_update(&socket, version, &address, 0);
+                            // An update that is still arriving in chunks is not asked for again.
+                            if client_missed_update(&deserialize_buffer, &received_projects, has_received_projects) && !reassembler.is_reassembling() {
+                                match bincode::deserialize::<BeaconInfo>(&deserialize_buffer) {
+                                    // The server sends the update to the group again. Only an update that
+                                    // still didn't arrive, or all projects, are asked for directly.
+                                    Ok(beacon) if has_received_projects && beacon.sequence != nacked_sequence => {
+                                        if pending_nack.is_none() {
+                                            pending_nack = Some((Instant::now() + client_nack_delay(), address, beacon));
+                                        }
+                                    }
+                                    _ => client_request_server_update(&socket, version, &address, received_projects.projects_hash, received_projects.sequence),
+                                }
+                            }
                         }
                     }
                 },
+                Ok(None) => {},
                 Err(()) => break
             }
         }
 
         client_send_volunteers(data, &socket, &from_address);
 
-        std::thread::sleep(std::time::Duration::from_millis(500));
+        // Unless another client asked for the missed update first, and it arrived while waiting.
+        match pending_nack {
+            Some((due, _, _)) if Instant::now() >= due => {
+                let (_, address, beacon) = pending_nack.take().unwrap();
+                if beacon.projects_hash != received_projects.projects_hash && !reassembler.is_reassembling() {
+                    client_send_nack(&socket, version, &address, &UpdateNack { message_id: 0, sequence: beacon.sequence, chunks: Vec::new() });
+                    nacked_sequence = beacon.sequence;
+                }
+            }
+            _ => {}
+        }
+        for (address, message_id, chunks) in reassembler.missing_chunks(client_nack_delay()) {
+            client_send_nack(&socket, version, &address, &UpdateNack { message_id, sequence: 0, chunks });
+        }
+
+        reassembler.remove_expired();
+        // Only wakes up by itself to ask for what was missed, and to drop messages whose chunks didn't
+        // all arrive.
+        let timeout = match &pending_nack {
+            Some((due, _, _)) => Some(due.saturating_duration_since(Instant::now())),
+            None if reassembler.is_reassembling() => Some(NACK_DELAY),
+            None => None,
+        };
+        client_wait(&mut poll, &mut events, timeout);
     }
 }
 
-fn client_query_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>>) {
+fn client_query_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>>, mut poll: Poll) {
     let server_address;
     let client_address;
     {
@@ -216,13 +525,26 @@ fn client_query_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>>) {
     socket
         .set_nonblocking(true)
         .expect("Failed to set non blocking.");
+    client_set_recv_buffer_size(&socket);
 
     socket
         .bind(&client_address.into())
         .expect("Failed to bind socket.");
 
-    let socket: UdpSocket = socket.into();
-    let mut projects_hash = 0;
+    let mut socket = UdpSocket::from_std(socket.into());
+    poll.registry()
+        .register(&mut socket, SOCKET_TOKEN, Interest::READABLE)
+        .expect("Failed to register socket.");
+    let mut events = Events::with_capacity(16);
+    let mut received_projects = ReceivedProjects::new();
+    let mut reassembler = Reassembler::new();
+    let mut recv_buffer = vec![0; MAX_RECEIVE_SIZE];
+    let mut next_request = Instant::now();
+    // Set while waiting for the answer to a request. Larger answers arrive in chunks, the wait is
+    // extended for as long as chunks keep arriving.
+    let mut response_deadline: Option<Instant> = None;
+    let mut is_retry = false;
+    let mut retry_next = false;
     loop {
         let running;
         let version;
@@ -236,72 +558,271 @@ fn client_query_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>>) {
             break;
         }
 
-        const RECV_BUFFER_SIZE: usize = 1 * 1024 * 1024;
-        let mut recv_buffer: [u8; RECV_BUFFER_SIZE] = [0; RECV_BUFFER_SIZE];
-        client_request_server_update(&socket, version, &server_address, projects_hash);
-        // Give the server some time to respond, before going into the slower delay
-        std::thread::sleep(std::time::Duration::from_millis(100));
+        if Instant::now() >= next_request {
+            client_request_server_update(&socket, version, &server_address, received_projects.projects_hash, received_projects.sequence);
+            response_deadline = Some(Instant::now() + RESPONSE_TIMEOUT);
+            next_request = Instant::now() + QUERY_INTERVAL;
+            is_retry = std::mem::replace(&mut retry_next, false);
+        }
 
-        match client_receive_packet(&socket, &mut recv_buffer) {
-            Ok((header, mut deserialize_buffer, _from_address)) => {
-                println!("Version matched! {} | {}", header.msg_type, header.msg_size);
-                if header.msg_type == MessageType::ProjectUpdate {
-                    println!("Message type is project update!");
-                    // Ensure the full message fit into the packet.
-                    if header.msg_size >= deserialize_buffer.len() as u32 {
+        loop {
+            match client_receive_packet(&socket, &mut recv_buffer, &mut reassembler) {
+                Ok(Some((header, deserialize_buffer, _from_address))) => {
+                    response_deadline = None;
+                    client_heard_from_server(data);
+                    println!("Version matched! {} | {}", header.msg_type, header.msg_size);
+                    if header.msg_type == MessageType::ProjectUpdate || header.msg_type == MessageType::CompressedProjectUpdate {
+                        println!("Message type is project update!");
+                        // Ensure the full message fit into the packet.
+                        if header.msg_size >= deserialize_buffer.len() as u32 {
+                            println!("Received a project update");
+                            if received_projects.apply_any_update(&header.msg_type, &deserialize_buffer) {
+                                client_publish_projects(data, &received_projects);
+                            }
+                        }
+                    }
+                    else if header.msg_type == MessageType::ProjectDelta {
+                        if header.msg_size >= deserialize_buffer.len() as u32 {
+                            println!("Received a project delta");
+                            if received_projects.apply_delta(&deserialize_buffer) {
+                                client_publish_projects(data, &received_projects);
+                            }
+                            else {
+                                // The sequence was reset, so asking again returns all projects.
+                                retry_next = true;
+                                next_request = Instant::now();
+                            }
+                        }
+                    }
+                    else if header.msg_type == MessageType::NoProjectUpdate {
+                        println!("No project update needed.");
+                    }
+                },
+                Ok(None) => {
+                    if response_deadline.is_some() {
+                        response_deadline = Some(Instant::now() + RESPONSE_TIMEOUT);
+                    }
+                },
+                Err(()) => break
+            }
+        }
+
+        match response_deadline {
+            Some(deadline) if Instant::now() >= deadline => {
+                response_deadline = None;
+                // Chunks of the response got lost, ask once more right away instead of after the interval.
+                if reassembler.is_reassembling() && !is_retry {
+                    retry_next = true;
+                    next_request = Instant::now();
+                }
+                reassembler.remove_expired();
+            }
+            _ => {}
+        }
+
+        client_send_volunteers(data, &socket, &Some(server_address));
+
+        let wake_at = response_deadline.map_or(next_request, |deadline| std::cmp::min(deadline, next_request));
+        client_wait(&mut poll, &mut events, Some(wake_at.saturating_duration_since(Instant::now())));
+    }
+}
+
+// Writes as much of the unsent messages as the stream takes without blocking. The rest stays for the
+// next writable event.
+fn client_stream_flush(stream: &mut mio::net::TcpStream, unsent: &mut Vec<u8>) -> std::io::Result<()> {
+    let mut written = 0;
+    while written < unsent.len() {
+        match stream.write(&unsent[written..]) {
+            Ok(0) => return Err(std::io::ErrorKind::WriteZero.into()),
+            Ok(bytes_written) => written += bytes_written,
+            Err(e) if e.kind() == std::io::ErrorKind::WouldBlock => break,
+            Err(e) if e.kind() == std::io::ErrorKind::Interrupted => {}
+            Err(e) => return Err(e),
+        }
+    }
+    unsent.drain(..written);
+    Ok(())
+}
+
+// Reads what the server pushes over a connected stream, until the stream is lost or the client stops.
+fn client_stream_session(
+    data: &Arc<RwLock<MonitorClientThreadData>>,
+    poll: &mut Poll,
+    events: &mut Events,
+    stream: &mut mio::net::TcpStream,
+    received_projects: &mut ReceivedProjects,
+) {
+    let version = data.read().unwrap().version;
+    let _ = stream.set_nodelay(true);
+    // The stream doesn't block, what it doesn't take right away is sent when it's writable again.
+    let mut unsent = Vec::new();
+    // Continues from the projects that were received before the stream was lost.
+    unsent.extend_from_slice(&client_update_request_message(version, received_projects.projects_hash, received_projects.sequence));
+
+    let mut frame_reader = FrameReader::new();
+    let mut last_received = Instant::now();
+    loop {
+        if !data.read().unwrap().running {
+            return;
+        }
+
+        loop {
+            match frame_reader.read_frame(stream) {
+                Ok(Some((header, deserialize_buffer))) => {
+                    last_received = Instant::now();
+                    if header.version != version {
+                        continue;
+                    }
+                    client_heard_from_server(data);
+                    if header.msg_type == MessageType::ProjectUpdate || header.msg_type == MessageType::CompressedProjectUpdate {
                         println!("Received a project update");
-                        let projects_raw: Vec<u8> = deserialize_buffer
-                            .drain(..header.msg_size as usize)
-                            .collect();
-                        let projects = bincode::deserialize::<Vec<Project>>(&projects_raw).unwrap();
-                        projects_hash = Monitor::generate_projects_hash(&projects);
-                        let read_locked = data.read().unwrap();
-                        *read_locked.projects.write().unwrap() = projects;
+                        if received_projects.apply_any_update(&header.msg_type, &deserialize_buffer) {
+                            client_publish_projects(data, received_projects);
+                        }
+                    }
+                    else if header.msg_type == MessageType::ProjectDelta {
+                        println!("Received a project delta");
+                        if received_projects.apply_delta(&deserialize_buffer) {
+                            client_publish_projects(data, received_projects);
+                        }
+                        // The sequence was reset, so asking again returns all projects.
+                        else {
+                            unsent.extend_from_slice(&client_update_request_message(version, received_projects.projects_hash, 0));
+                        }
                     }
                 }
-                else if header.msg_type == MessageType::NoProjectUpdate {
-                    println!("No project update needed.");
+                Ok(None) => break,
+                Err(e) => {
+                    eprintln!("Lost the stream to the server. Error: {}", e);
+                    return;
                 }
-            },
-            Err(()) => {}
+            }
+        }
+        if last_received.elapsed() >= STREAM_TIMEOUT {
+            eprintln!("Didn't hear from the server in {} seconds.", STREAM_TIMEOUT.as_secs());
+            return;
         }
 
-        client_send_volunteers(data, &socket, &Some(server_address));
+        for write_buffer in client_volunteer_messages(data) {
+            unsent.extend_from_slice(&write_buffer);
+        }
+        match client_stream_flush(stream, &mut unsent) {
+            Ok(()) => {},
+            Err(e) => {
+                eprintln!("Lost the stream to the server. Error: {}", e);
+                return;
+            }
+        }
+
+        client_wait(poll, events, Some(STREAM_TIMEOUT.saturating_sub(last_received.elapsed())));
+    }
+}
+
+fn client_stream_connection_thread(data: &Arc<RwLock<MonitorClientThreadData>>, mut poll: Poll) {
+    let server_address = data.read().unwrap().server_address;
+    let mut events = Events::with_capacity(16);
+    let mut received_projects = ReceivedProjects::new();
+    let mut reconnect_delay = MIN_RECONNECT_DELAY;
+    loop {
+        if !data.read().unwrap().running {
+            break;
+        }
+
+        match TcpStream::connect_timeout(&server_address, RESPONSE_TIMEOUT).and_then(|stream| {
+            stream.set_nonblocking(true)?;
+            Ok(mio::net::TcpStream::from_std(stream))
+        }) {
+            Ok(mut stream) => {
+                println!("Connected to {}.", server_address);
+                reconnect_delay = MIN_RECONNECT_DELAY;
+                match poll.registry().register(&mut stream, SOCKET_TOKEN, Interest::READABLE | Interest::WRITABLE) {
+                    Ok(()) => {
+                        client_stream_session(data, &mut poll, &mut events, &mut stream, &mut received_projects);
+                        let _ = poll.registry().deregister(&mut stream);
+                    }
+                    Err(e) => eprintln!("Failed to register the stream. Error: {}", e),
+                }
+            }
+            Err(e) => eprintln!("Failed to connect to {}. Error: {}", server_address, e),
+        }
 
-        std::thread::park_timeout(std::time::Duration::from_secs(15));
+        if !data.read().unwrap().running {
+            break;
+        }
+        client_wait(&mut poll, &mut events, Some(reconnect_delay));
+        reconnect_delay = std::cmp::min(reconnect_delay * 2, MAX_RECONNECT_DELAY);
     }
 }
 
 pub struct MonitorClient {
     connection_thread: Option<JoinHandle<()>>,
     thread_data: Arc<RwLock<MonitorClientThreadData>>,
+    received_signal: Arc<RefreshSignal>,
+    // The receives that wait_for_projects saw.
+    seen_receives: AtomicU64,
+    // Wakes the connection thread when there are volunteers to send or when the client stops.
+    waker: Arc<Waker>,
 }
 
 impl MonitorClient {
     pub fn new(server_address: SocketAddr, client_address: SocketAddr, version: u32, multicast: bool) -> MonitorClient {
-        let thread_data = Arc::new(RwLock::new(MonitorClientThreadData {
-            running: true,
-            version,
-            projects: RwLock::new(Vec::new()),
-            volunteers: Arc::new(RwLock::new(Vec::<Volunteer>::new())),
-            server_address,
-            client_address,
-        }));
+        let thread_data = MonitorClient::new_thread_data(server_address, client_address, version);
         let thread_data_for_thread = thread_data.clone();
+        let received_signal = thread_data.read().unwrap().received_signal.clone();
+        let (poll, waker) = MonitorClient::new_poll();
 
         MonitorClient {
             connection_thread: Some(std::thread::spawn(move || {
                 if multicast {
-                    client_multicast_connection_thread(&thread_data_for_thread);
+                    client_multicast_connection_thread(&thread_data_for_thread, poll);
                 }
                 else {
-                    client_query_connection_thread(&thread_data_for_thread);
+                    client_query_connection_thread(&thread_data_for_thread, poll);
                 }
             })),
+            received_signal,
+            seen_receives: AtomicU64::new(0),
+            thread_data,
+            waker,
+        }
+    }
+
+    // Keeps a stream to the server open, which pushes the projects whenever they change.
+    pub fn new_stream(server_address: SocketAddr, version: u32) -> MonitorClient {
+        let client_address = SocketAddr::new(IpAddr::V4(Ipv4Addr::UNSPECIFIED), 0);
+        let thread_data = MonitorClient::new_thread_data(server_address, client_address, version);
+        let thread_data_for_thread = thread_data.clone();
+        let received_signal = thread_data.read().unwrap().received_signal.clone();
+        let (poll, waker) = MonitorClient::new_poll();
+
+        MonitorClient {
+            connection_thread: Some(std::thread::spawn(move || client_stream_connection_thread(&thread_data_for_thread, poll))),
+            received_signal,
+            seen_receives: AtomicU64::new(0),
             thread_data,
+            waker,
         }
     }
 
+    fn new_poll() -> (Poll, Arc<Waker>) {
+        let poll = Poll::new().expect("Failed to create poll.");
+        let waker = Waker::new(poll.registry(), WAKE_TOKEN).expect("Failed to create waker.");
+        (poll, Arc::new(waker))
+    }
+
+    fn new_thread_data(server_address: SocketAddr, client_address: SocketAddr, version: u32) -> Arc<RwLock<MonitorClientThreadData>> {
+        Arc::new(RwLock::new(MonitorClientThreadData {
+            running: true,
+            version,
+            projects: RwLock::new(Vec::new()),
+            received_signal: Arc::new(RefreshSignal::new()),
+            last_received: None,
+            volunteers: Arc::new(RwLock::new(Vec::<Volunteer>::new())),
+            server_address,
+            client_address,
+        }))
+    }
+
     pub fn set_volunteering(&self, project_id: u64) {
         let username = get_username();
         let volunteer = Volunteer {
@@ -313,6 +834,40 @@ impl MonitorClient {
         let guard2 = guard.volunteers.write();
         let mut pending_volunteers = guard2.unwrap();
         pending_volunteers.push(volunteer);
+        self.wake();
+    }
+
+    fn wake(&self) {
+        match self.waker.wake() {
+            Ok(()) => {},
+            Err(e) => eprintln!("Failed to wake the connection thread. Error: {}", e)
+        }
+    }
+
+    // Lets a server that is started next to this client pass the volunteers it receives on.
+    pub fn volunteer_forwarder(&self) -> VolunteerForwarder {
+        VolunteerForwarder {
+            volunteers: self.thread_data.read().unwrap().volunteers.clone(),
+            waker: self.waker.clone(),
+        }
+    }
+
+    // Waits until projects were received that get_projects didn't return yet, or the timeout passed.
+    // Returns whether there are such projects.
+    pub fn wait_for_projects(&self, timeout: Duration) -> bool {
+        let has_projects = || !self.thread_data.read().unwrap().projects.read().unwrap().is_empty();
+        if has_projects() {
+            return true;
+        }
+        let mut seen_receives = self.seen_receives.load(Ordering::Relaxed);
+        self.received_signal.wait(&mut seen_receives, timeout);
+        self.seen_receives.store(seen_receives, Ordering::Relaxed);
+        has_projects()
+    }
+
+    // When the last message of the server arrived, or None when nothing arrived yet.
+    pub fn last_received(&self) -> Option<Instant> {
+        self.thread_data.read().unwrap().last_received
     }
 
     pub fn get_projects(&self) -> (bool, Vec<Project>) {
@@ -330,11 +885,108 @@ impl Drop for MonitorClient {
     fn drop(&mut self) {
         self.thread_data.write().unwrap().running = false;
 
+        self.wake();
+
         let join_handle = self.connection_thread.take().unwrap();
-        join_handle.thread().unpark();
         let join_result = join_handle.join();
         if join_result.is_err() {
             eprintln!("Failed to join the connection thread thread.")
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn project(index: usize) -> Project {
+        Project::new("folder", &format!("https://jenkins/job/folder/job/project{}/", index))
+    }
+
+    #[test]
+    fn apply_delta_test() {
+        let projects = vec![project(0), project(1), project(3)];
+        let mut update = bincode::serialize(&projects).unwrap();
+        update.append(&mut bincode::serialize(&5u64).unwrap());
+        let mut received_projects = ReceivedProjects::new();
+        assert!(received_projects.apply_update(&update));
+        assert_eq!(received_projects.sequence, 5);
+        assert_eq!(received_projects.projects_hash, Monitor::generate_projects_hash(&projects));
+        // The same projects again don't have to be published.
+        assert!(!received_projects.apply_update(&update));
+        assert_eq!(received_projects.projects.len(), projects.len());
+
+        // The compressed update results in the same projects.
+        let mut compressed_update = bincode::serialize(&5u64).unwrap();
+        compressed_update.append(&mut crate::project_encoding::encode_projects(&projects));
+        let mut compressed_projects = ReceivedProjects::new();
+        assert!(compressed_projects.apply_any_update(&MessageType::CompressedProjectUpdate, &compressed_update));
+        assert_eq!(compressed_projects.sequence, 5);
+        assert_eq!(compressed_projects.projects_hash, received_projects.projects_hash);
+
+        let mut changed_project = project(1);
+        changed_project.set_volunteer("volunteer");
+        let mut expected_projects = vec![project(0), changed_project.clone(), project(2)];
+        Monitor::sort_projects(&mut expected_projects);
+        let delta = ProjectDelta {
+            base_sequence: 5,
+            sequence: 6,
+            projects_hash: Monitor::generate_projects_hash(&expected_projects),
+            changed: vec![project(2), changed_project],
+            removed: vec![project(3).id()],
+        };
+        assert!(received_projects.apply_delta(&bincode::serialize(&delta).unwrap()));
+        assert_eq!(received_projects.sequence, 6);
+        assert_eq!(received_projects.projects_hash, delta.projects_hash);
+        assert_eq!(received_projects.projects[1].volunteer(), "volunteer");
+
+        // A delta after a missed update resets the sequence, so all projects are requested again.
+        assert!(!received_projects.apply_delta(&bincode::serialize(&delta).unwrap()));
+        assert_eq!(received_projects.sequence, 0);
+    }
+
+    #[test]
+    fn missed_update_test() {
+        let projects = vec![project(0), project(1)];
+        let mut update = bincode::serialize(&projects).unwrap();
+        update.append(&mut bincode::serialize(&5u64).unwrap());
+        let mut received_projects = ReceivedProjects::new();
+        assert!(received_projects.apply_update(&update));
+
+        // Only a beacon with other projects than the client has means it missed an update.
+        let beacon = |projects_hash: u64, sequence: u64| bincode::serialize(&BeaconInfo { projects_hash, sequence }).unwrap();
+        let projects_hash = Monitor::generate_projects_hash(&projects);
+        assert!(!client_missed_update(&beacon(projects_hash, 5), &received_projects, true));
+        assert!(client_missed_update(&beacon(projects_hash + 1, 6), &received_projects, true));
+        // Beacons of older servers don't have a body.
+        assert!(!client_missed_update(&[], &received_projects, true));
+        assert!(client_missed_update(&[], &ReceivedProjects::new(), false));
+    }
+
+    #[test]
+    fn stream_flush_test() {
+        let listener = std::net::TcpListener::bind("127.0.0.1:0").unwrap();
+        let client = TcpStream::connect(listener.local_addr().unwrap()).unwrap();
+        client.set_nonblocking(true).unwrap();
+        let mut client = mio::net::TcpStream::from_std(client);
+        let (mut server, _) = listener.accept().unwrap();
+
+        // More than the socket buffers take while the server doesn't read, the rest is kept.
+        let message: Vec<u8> = (0..16 * 1024 * 1024).map(|index| (index % 251) as u8).collect();
+        let mut unsent = message.clone();
+        client_stream_flush(&mut client, &mut unsent).unwrap();
+        assert!(!unsent.is_empty() && unsent.len() < message.len());
+
+        let reader = std::thread::spawn(move || {
+            let mut received = Vec::new();
+            std::io::Read::read_to_end(&mut server, &mut received).unwrap();
+            received
+        });
+        while !unsent.is_empty() {
+            std::thread::sleep(Duration::from_millis(1));
+            client_stream_flush(&mut client, &mut unsent).unwrap();
+        }
+        drop(client);
+        assert!(reader.join().unwrap() == message);
+    }
+}
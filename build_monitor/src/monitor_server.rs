@@ -1,96 +1,353 @@
 // Copyright Sander Brattinga. All rights reserved.
 
-use crate::monitor::{Header, MessageType, Monitor};
-use crate::project::{Project, Volunteer};
+use crate::chunked_message::{send_datagram, send_datagrams, send_message, split_message, MAX_DATAGRAM_SIZE, MAX_RECEIVE_SIZE, SOCKET_RECV_BUFFER_SIZE};
+use crate::datagram_batch::{send_to_all, ReceiveBatch, BATCH_SIZE};
+use crate::framed_stream::FrameReader;
+use crate::monitor::{serialize_message, BeaconInfo, Header, MessageType, HEADER_SIZE, Monitor, ProjectDelta, ProjectUpdateRequest, ProjectsHash, UpdateNack, CAPABILITY_CHUNKED_MESSAGES, CAPABILITY_COMPRESSED_UPDATES};
+use crate::multicast_repair::MulticastRepair;
+use crate::monitor_client::VolunteerForwarder;
+use crate::project::{Project, Volunteer, VolunteerView};
+use crate::project_encoding::encode_projects;
+use crate::refresh_signal::RefreshSignal;
 use crate::utils::get_local_addresses;
 
+use mio::net::UdpSocket;
+use mio::{Events, Interest, Poll, Token, Waker};
 use socket2::{Domain, Protocol, Socket, Type};
+use std::collections::{HashMap, VecDeque};
+use std::io::Write;
 use std::iter::Iterator;
-use std::net::{IpAddr, Ipv4Addr, Ipv6Addr, SocketAddr, UdpSocket};
-use std::sync::{Arc, RwLock};
+use std::net::{IpAddr, Ipv4Addr, Ipv6Addr, Shutdown, SocketAddr, TcpListener, TcpStream};
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, RwLock};
 use std::thread::JoinHandle;
-use std::time::{Duration, SystemTime, UNIX_EPOCH};
+use std::time::{Duration, Instant};
+
+// How often a message is sent to clients when nothing changed, so they know the server is still there.
+const BEACON_UPDATE_INTERVAL: Duration = Duration::from_secs(1);
+// Stream clients that can't take a message within this time are disconnected.
+const STREAM_WRITE_TIMEOUT: Duration = Duration::from_secs(10);
+// Every stream client has two threads, more clients than this are refused. They can query the server
+// instead.
+const MAX_STREAM_CLIENTS: usize = 1024;
+
+// The events the server threads wait for.
+const SOCKET_TOKEN: Token = Token(0);
+const WAKE_TOKEN: Token = Token(1);
+
+// Waits for the socket to become readable, the server to be woken up or the timeout to pass.
+fn server_wait(poll: &mut Poll, events: &mut Events, timeout: Option<Duration>) {
+    match poll.poll(events, timeout) {
+        Ok(()) => {},
+        Err(e) if e.kind() == std::io::ErrorKind::Interrupted => {},
+        Err(e) => eprintln!("Failed to wait for the socket. Error: {}", e),
+    }
+}
+
+// What the server received and sent since it started. The bytes include the headers of the messages
+// and their chunks, but not those of UDP and TCP.
+#[derive(Clone, Copy, Default)]
+pub struct ServerStatistics {
+    pub requests: u64,
+    pub messages_sent: u64,
+    pub bytes_sent: u64,
+}
+
+#[derive(Default)]
+struct ServerCounters {
+    requests: AtomicU64,
+    messages_sent: AtomicU64,
+    bytes_sent: AtomicU64,
+}
+
+impl ServerCounters {
+    fn received_request(&self) {
+        self.requests.fetch_add(1, Ordering::Relaxed);
+    }
+
+    fn sent(&self, messages: usize, bytes: usize) {
+        self.messages_sent.fetch_add(messages as u64, Ordering::Relaxed);
+        self.bytes_sent.fetch_add(bytes as u64, Ordering::Relaxed);
+    }
+}
 
 struct MonitorServerThreadData {
     running: bool,
-    needs_refresh: bool,
+    counters: Arc<ServerCounters>,
+    refresh_signal: Arc<RefreshSignal>,
     version: u32,
     projects: Arc<RwLock<Vec<Project>>>,
+    projects_hash: Arc<ProjectsHash>,
+    multicast_deltas: bool,
+    multicast_compression: bool,
     address: SocketAddr,
+    // Set on a relay, which passes the volunteers on to its own server.
+    volunteer_forwarder: Option<VolunteerForwarder>,
 }
 
-fn server_get_header(listener: &UdpSocket, recv_buffer: &mut [u8]) ->
-    Result<(Header, SocketAddr, Vec<u8>), ()> {
-    let mut header = Header::new();
-    let from_address: SocketAddr;
-    let mut deserialize_buffer = Vec::new();
-    match listener.recv_from(recv_buffer) {
-        Ok((bytes_read, from)) => {
-            println!("Received {} bytes.", bytes_read);
-            deserialize_buffer.extend_from_slice(&recv_buffer[..bytes_read]);
-            from_address = from;
+const MAX_PROJECTS_HISTORY: usize = 32;
+
+// The content hash of every project, at one sequence.
+struct ProjectsVersion {
+    sequence: u64,
+    projects_hash: u64,
+    content_hashes: HashMap<u64, u64>,
+}
+
+// The last versions of the projects that were sent, so a client that is a few updates behind only
+// gets the projects that changed since its version.
+struct ProjectsHistory {
+    versions: VecDeque<ProjectsVersion>,
+    // The generation of the published projects hash that the last version was checked for.
+    generation: Option<u64>,
+    // The message with all projects of the last version, without and with compression. It's built
+    // for the first client that needs it, and shared with every client after that.
+    full_updates: [Option<Arc<Vec<u8>>>; 2],
+}
+
+impl ProjectsHistory {
+    fn new() -> ProjectsHistory {
+        ProjectsHistory {
+            versions: VecDeque::new(),
+            generation: None,
+            full_updates: [None, None],
+        }
+    }
+
+    // Adds a version when the projects changed since the last one. The projects are only looked at
+    // again once a new hash was published for them. Returns the current sequence and hash.
+    fn update(&mut self, generation: u64, projects: &Vec<Project>) -> (u64, u64) {
+        match self.versions.back() {
+            Some(version) if self.generation == Some(generation) => return (version.sequence, version.projects_hash),
+            _ => {}
+        }
+        self.generation = Some(generation);
+
+        let projects_hash = Monitor::generate_projects_hash(projects);
+        let sequence = match self.versions.back() {
+            Some(version) if version.projects_hash == projects_hash => return (version.sequence, projects_hash),
+            Some(version) => version.sequence + 1,
+            None => 1,
+        };
+
+        if self.versions.len() == MAX_PROJECTS_HISTORY {
+            self.versions.pop_front();
+        }
+        self.full_updates = [None, None];
+        self.versions.push_back(ProjectsVersion {
+            sequence,
+            projects_hash,
+            content_hashes: projects.iter().map(|project| (project.id(), project.content_hash())).collect(),
+        });
+        (sequence, projects_hash)
+    }
+
+    // The changes since the client's version. Returns None when that version isn't known anymore, or
+    // when so much changed that sending all projects is about as small. Call update first.
+    fn delta(&self, base_sequence: u64, base_hash: u64, projects: &Vec<Project>) -> Option<ProjectDelta> {
+        let current = self.versions.back()?;
+        let base = self.versions
+            .iter()
+            .find(|version| version.sequence == base_sequence && version.projects_hash == base_hash)?;
+        let changed: Vec<Project> = projects
+            .iter()
+            .filter(|project| base.content_hashes.get(&project.id()) != Some(&project.content_hash()))
+            .cloned()
+            .collect();
+        if changed.len() * 2 > projects.len() {
+            return None;
         }
+        let removed = base.content_hashes
+            .keys()
+            .filter(|id| !current.content_hashes.contains_key(id))
+            .copied()
+            .collect();
+
+        Some(ProjectDelta {
+            base_sequence,
+            sequence: current.sequence,
+            projects_hash: current.projects_hash,
+            changed,
+            removed,
+        })
+    }
+}
+
+// Returns the header of the datagram, and its body which is read from the receive buffer in place.
+fn server_get_header<'a>(listener: &UdpSocket, recv_buffer: &'a mut [u8]) ->
+    Result<(Header, SocketAddr, &'a [u8]), ()> {
+    let (bytes_read, from_address) = match listener.recv_from(recv_buffer) {
+        Ok((bytes_read, from)) => (bytes_read, from),
         Err(error) => {
             if error.kind() != std::io::ErrorKind::WouldBlock {
                 eprintln!("Failed to receive data: {}", error);
             }
             return Err(());
         }
-    }
+    };
 
-    let header_raw: Vec<u8> = deserialize_buffer
-        .drain(..bincode::serialized_size(&header).unwrap() as usize)
-        .collect();
-    header = bincode::deserialize::<Header>(&header_raw).unwrap();
-    return Ok((header, from_address, deserialize_buffer));
+    let (header, body) = server_parse_header(&recv_buffer[..bytes_read]);
+    Ok((header, from_address, body))
 }
 
-fn server_handle_project_update(data: &Arc<RwLock<MonitorServerThreadData>>, listener: &UdpSocket, address: &SocketAddr) {
-    let mut projects_buffer;
-    let version;
-    {
-        let data_read_lock = data.read().unwrap();
-        projects_buffer = bincode::serialize(&*data_read_lock.projects).unwrap();
-        version = data_read_lock.version;
+// Packets that are too short or from a newer version are skipped as Invalid.
+fn server_parse_header(packet: &[u8]) -> (Header, &[u8]) {
+    match Header::from_bytes(packet) {
+        Some((header, header_size)) => (header, &packet[header_size..]),
+        None => (Header::new(), &[]),
+    }
+}
+
+// Returns the request of the client. The sequence is 0 for clients that don't support deltas, and the
+// capabilities are 0 for clients that don't send them.
+fn server_read_update_request(deserialize_buffer: &[u8]) -> Option<ProjectUpdateRequest> {
+    let request_size = bincode::serialized_size(&ProjectUpdateRequest { projects_hash: 0, sequence: 0, capabilities: 0 }).unwrap() as usize;
+    if deserialize_buffer.len() >= request_size {
+        bincode::deserialize::<ProjectUpdateRequest>(deserialize_buffer).ok()
+    }
+    else if deserialize_buffer.len() >= bincode::serialized_size(&(0u64, 0u64)).unwrap() as usize {
+        let (projects_hash, sequence) = bincode::deserialize::<(u64, u64)>(deserialize_buffer).ok()?;
+        Some(ProjectUpdateRequest { projects_hash, sequence, capabilities: 0 })
     }
+    else {
+        let projects_hash = bincode::deserialize::<u64>(deserialize_buffer).ok()?;
+        Some(ProjectUpdateRequest { projects_hash, sequence: 0, capabilities: 0 })
+    }
+}
+
+fn server_header_only_message(version: u32, msg_type: MessageType) -> [u8; HEADER_SIZE] {
     let mut header = Header::new();
     header.version = version;
-    header.msg_type = MessageType::ProjectUpdate;
-    header.msg_size = projects_buffer.len() as u32;
-
-    let mut write_buffer = Vec::<u8>::new();
-    write_buffer.append(&mut bincode::serialize(&header).unwrap());
-    write_buffer.append(&mut projects_buffer);
-    println!("Sending projects to {}.", address);
-    match listener.send_to(&write_buffer, address) {
-        Ok(_) => {},
-        Err(e) => { eprintln!("Failed to send to {}. Error: {}", address, e); }
+    header.msg_type = msg_type;
+    header.to_bytes()
+}
+
+// Builds a message with only the projects that changed since the client's version when the server
+// still knows that version, or else with all projects, compressed when the client can read that.
+// Returns the message and the sequence and hash of the projects in it.
+fn server_build_project_update(
+    data: &Arc<RwLock<MonitorServerThreadData>>,
+    history: &mut ProjectsHistory,
+    client_version: Option<(u64, u64)>,
+    compression: bool,
+) -> (Arc<Vec<u8>>, (u64, u64)) {
+    let data_read_lock = data.read().unwrap();
+    let version = data_read_lock.version;
+    let projects = data_read_lock.projects.read().unwrap();
+    let sequence_and_hash = history.update(data_read_lock.projects_hash.generation(), &projects);
+    match client_version.and_then(|(sequence, projects_hash)| history.delta(sequence, projects_hash, &projects)) {
+        Some(delta) => {
+            let message = serialize_message(version, MessageType::ProjectDelta, bincode::serialize(&delta).unwrap());
+            return (Arc::new(message), sequence_and_hash);
+        }
+        None => {}
+    }
+
+    let full_update = &mut history.full_updates[compression as usize];
+    match full_update {
+        Some(message) => (message.clone(), sequence_and_hash),
+        None => {
+            let message = if compression {
+                let mut projects_buffer = bincode::serialize(&sequence_and_hash.0).unwrap();
+                projects_buffer.append(&mut encode_projects(&projects));
+                serialize_message(version, MessageType::CompressedProjectUpdate, projects_buffer)
+            }
+            else {
+                let mut projects_buffer = bincode::serialize(&*projects).unwrap();
+                // Older clients only read the projects, and ignore the sequence after them.
+                projects_buffer.append(&mut bincode::serialize(&sequence_and_hash.0).unwrap());
+                serialize_message(version, MessageType::ProjectUpdate, projects_buffer)
+            };
+            let message = Arc::new(message);
+            *full_update = Some(message.clone());
+            (message, sequence_and_hash)
+        }
     }
 }
 
-fn server_handle_no_project_update(data: &Arc<RwLock<MonitorServerThreadData>>, listener: &UdpSocket, address: &SocketAddr) {
-    let version;
-    {
-        let data_read_lock = data.read().unwrap();
-        version = data_read_lock.version;
+// Sends the projects that the client doesn't have yet. Returns the sequence and hash of the projects
+// that were sent.
+fn server_handle_project_update(
+    data: &Arc<RwLock<MonitorServerThreadData>>,
+    history: &mut ProjectsHistory,
+    listener: &UdpSocket,
+    address: &SocketAddr,
+    client_version: Option<(u64, u64)>,
+    capabilities: u32,
+) -> (u64, u64) {
+    let compression = capabilities & CAPABILITY_COMPRESSED_UPDATES != 0;
+    let (write_buffer, sequence_and_hash) = server_build_project_update(data, history, client_version, compression);
+    server_send_project_update(data, listener, address, &write_buffer, capabilities);
+    sequence_and_hash
+}
+
+// Messages that don't fit in a datagram are split into chunks, for the clients that can read them.
+fn server_send_project_update(data: &Arc<RwLock<MonitorServerThreadData>>, listener: &UdpSocket, address: &SocketAddr, write_buffer: &[u8], capabilities: u32) {
+    if write_buffer.len() > MAX_DATAGRAM_SIZE && capabilities & CAPABILITY_CHUNKED_MESSAGES == 0 {
+        eprintln!("The projects don't fit in a datagram for {}, which can't read chunks.", address);
+        return;
     }
-    let mut header = Header::new();
-    header.version = version;
-    header.msg_type = MessageType::NoProjectUpdate;
-    header.msg_size = 0;
-
-    let mut write_buffer = Vec::<u8>::new();
-    write_buffer.append(&mut bincode::serialize(&header).unwrap());
-    println!("Sending no need for update to {}.", address);
-    match listener.send_to(&write_buffer, address) {
-        Ok(_) => {},
+    let data_read_lock = data.read().unwrap();
+    match send_message(listener, data_read_lock.version, write_buffer, address) {
+        Ok(bytes_sent) => data_read_lock.counters.sent(1, bytes_sent),
         Err(e) => { eprintln!("Failed to send to {}. Error: {}", address, e); }
     }
 }
 
-fn server_handle_volunteer_added(data: &Arc<RwLock<MonitorServerThreadData>>, deserialize_buffer: &mut Vec<u8>) -> bool {
-    let volunteer_raw: Vec<u8> = deserialize_buffer.drain(..).collect();
-    let volunteer = bincode::deserialize::<Volunteer>(&volunteer_raw).unwrap();
+// Sends the projects to the group, and keeps the datagrams to send them again to the clients that
+// missed them. Returns the sequence and hash of the projects that were sent.
+fn server_multicast_project_update(
+    data: &Arc<RwLock<MonitorServerThreadData>>,
+    history: &mut ProjectsHistory,
+    repair: &mut MulticastRepair,
+    listener: &UdpSocket,
+    address: &SocketAddr,
+    client_version: Option<(u64, u64)>,
+    compression: bool,
+) -> (u64, u64) {
+    let (write_buffer, (sequence, projects_hash)) = server_build_project_update(data, history, client_version, compression);
+    let data_read_lock = data.read().unwrap();
+    let (message_id, datagrams) = split_message(data_read_lock.version, &write_buffer);
+    match send_datagrams(listener, &datagrams, address) {
+        Ok(bytes_sent) => data_read_lock.counters.sent(1, bytes_sent),
+        Err(e) => { eprintln!("Failed to send to {}. Error: {}", address, e); }
+    }
+    repair.add_update(sequence, message_id, datagrams);
+    (sequence, projects_hash)
+}
+
+fn server_handle_update_nack(repair: &mut MulticastRepair, nack_raw: &[u8]) {
+    match bincode::deserialize::<UpdateNack>(nack_raw) {
+        Ok(nack) => {
+            repair.add_nack(&nack);
+        }
+        Err(e) => eprintln!("Received an invalid nack. Error: {}", e),
+    }
+}
+
+// Lets the clients know they have the latest projects, with as few calls as possible.
+fn server_handle_no_project_updates(data: &Arc<RwLock<MonitorServerThreadData>>, listener: &UdpSocket, addresses: &[SocketAddr]) {
+    if addresses.is_empty() {
+        return;
+    }
+    let data_read_lock = data.read().unwrap();
+    let write_buffer = server_header_only_message(data_read_lock.version, MessageType::NoProjectUpdate);
+    let (sent, result) = send_to_all(listener, &write_buffer, addresses);
+    data_read_lock.counters.sent(sent, sent * write_buffer.len());
+    match result {
+        Ok(()) => {},
+        Err(e) => { eprintln!("Failed to send to {}. Error: {}", addresses[sent], e); }
+    }
+}
+
+fn server_handle_volunteer_added(data: &Arc<RwLock<MonitorServerThreadData>>, volunteer_raw: &[u8]) -> bool {
+    let volunteer = match bincode::deserialize::<VolunteerView>(volunteer_raw) {
+        Ok(volunteer) => volunteer,
+        Err(e) => {
+            eprintln!("Received an invalid volunteer. Error: {}", e);
+            return false;
+        }
+    };
     let data_read_lock = data.read().unwrap();
     let mut project_read_lock = data_read_lock.projects.write().unwrap();
     match project_read_lock
@@ -98,8 +355,15 @@ fn server_handle_volunteer_added(data: &Arc<RwLock<MonitorServerThreadData>>, de
         .find(|x| x.id() == volunteer.id)
     {
         Some(project) => {
-            println!("Setting volunteer for project with id {}. Requested by {}", volunteer.id, volunteer.volunteer);
-            project.set_volunteer(&volunteer.volunteer);
+            project.set_volunteer(volunteer.volunteer);
+            data_read_lock.projects_hash.publish(Monitor::generate_projects_hash(&project_read_lock));
+            match &data_read_lock.volunteer_forwarder {
+                Some(volunteer_forwarder) => volunteer_forwarder.forward(Volunteer {
+                    id: volunteer.id,
+                    volunteer: volunteer.volunteer.to_string(),
+                }),
+                None => {}
+            }
             return true;
         }
         None => {
@@ -109,7 +373,7 @@ fn server_handle_volunteer_added(data: &Arc<RwLock<MonitorServerThreadData>>, de
     }
 }
 
-fn server_multicast_thread(data: &Arc<RwLock<MonitorServerThreadData>>) {
+fn server_multicast_thread(data: &Arc<RwLock<MonitorServerThreadData>>, mut poll: Poll) {
     let address;
     {
         let data_read_lock = data.read().unwrap();
@@ -162,77 +426,110 @@ fn server_multicast_thread(data: &Arc<RwLock<MonitorServerThreadData>>) {
         .bind(&bind_address.into())
         .expect("Failed to bind socket.");
 
-    let listener: UdpSocket = socket.into();
-    let mut last_beacon_update: SystemTime = UNIX_EPOCH;
+    let mut listener = UdpSocket::from_std(socket.into());
+    poll.registry()
+        .register(&mut listener, SOCKET_TOKEN, Interest::READABLE)
+        .expect("Failed to register socket.");
+    let mut events = Events::with_capacity(16);
+    // Reused for every datagram, the body of a message is read from it in place.
+    let mut recv_buffer = vec![0; MAX_RECEIVE_SIZE];
+    let refresh_signal = data.read().unwrap().refresh_signal.clone();
+    let counters = data.read().unwrap().counters.clone();
+    let mut history = ProjectsHistory::new();
+    let mut repair = MulticastRepair::new();
+    let mut last_multicast = None;
+    let mut last_beacon_update: Option<Instant> = None;
+    let mut seen_refreshes = 0;
+    // The first pass sends the projects to the clients that are already listening.
+    let mut needs_refresh = true;
     loop {
-        let mut needs_refresh;
         let version;
         let running;
+        let multicast_deltas;
+        let multicast_compression;
         {
             let data_read_lock = data.read().unwrap();
             running = data_read_lock.running;
-            needs_refresh = data_read_lock.needs_refresh;
             version = data_read_lock.version;
+            multicast_deltas = data_read_lock.multicast_deltas;
+            multicast_compression = data_read_lock.multicast_compression;
         }
 
         if !running {
             break;
         }
 
-        {
-            let mut recv_buffer = [0; 1 * 1024 * 1024];
-            loop {
-                match server_get_header(&listener, &mut recv_buffer) {
-                    Ok((header, from_address, mut deserialize_buffer)) => {
-                        if header.version == version {
-                            if header.msg_type == MessageType::ProjectUpdateRequest {
-                                let _dummy: u64 = 0;
-                                let _dummy2: Vec<_> = deserialize_buffer
-                                    .drain(..bincode::serialized_size(&_dummy).unwrap() as usize)
-                                    .collect();
-                                server_handle_project_update(data, &listener, &from_address);
-                            } else if header.msg_type == MessageType::VolunteerAdded {
-                                needs_refresh = server_handle_volunteer_added(data, &mut deserialize_buffer);
-                            }
+        loop {
+            match server_get_header(&listener, &mut recv_buffer) {
+                Ok((header, from_address, deserialize_buffer)) => {
+                    if header.version == version {
+                        // Clients ask for all projects when they start, and for what they missed when a delta
+                        // or beacon shows their projects are out of date.
+                        if header.msg_type == MessageType::ProjectUpdateRequest {
+                            counters.received_request();
+                            // Clients that missed an update only need what changed since the one they have.
+                            let (client_version, capabilities) = match server_read_update_request(deserialize_buffer) {
+                                Some(request) => (
+                                    if request.sequence != 0 { Some((request.sequence, request.projects_hash)) } else { None },
+                                    request.capabilities,
+                                ),
+                                None => (None, 0),
+                            };
+                            server_handle_project_update(data, &mut history, &listener, &from_address, client_version, capabilities);
+                        } else if header.msg_type == MessageType::VolunteerAdded {
+                            needs_refresh |= server_handle_volunteer_added(data, deserialize_buffer);
+                        } else if header.msg_type == MessageType::UpdateNack {
+                            counters.received_request();
+                            server_handle_update_nack(&mut repair, deserialize_buffer);
                         }
-                    },
-                    Err(_) => {
-                        break;
                     }
+                },
+                Err(_) => {
+                    break;
                 }
             }
         }
 
+        needs_refresh |= refresh_signal.refreshed_since(&mut seen_refreshes);
         if needs_refresh {
-            server_handle_project_update(data, &listener, &address);
-            let mut data_write_lock = data.write().unwrap();
-            data_write_lock.needs_refresh = false;
+            let client_version = if multicast_deltas { last_multicast } else { None };
+            last_multicast = Some(server_multicast_project_update(data, &mut history, &mut repair, &listener, &address, client_version, multicast_compression));
+            needs_refresh = false;
         }
 
-        const BEACON_UPDATE_INTERVAL: Duration = Duration::from_secs(1);
-        if SystemTime::now()
-            .duration_since(last_beacon_update)
-            .unwrap()
-            >= BEACON_UPDATE_INTERVAL
-        {
-            let mut header = Header::new();
-            header.version = version;
-            header.msg_type = MessageType::Beacon;
-            header.msg_size = 0;
+        // The datagrams that clients missed go to the whole group again, paced.
+        while let Some(datagram) = repair.take_due(Instant::now()) {
+            match send_datagram(&listener, datagram, &address) {
+                Ok(()) => counters.sent(1, datagram.len()),
+                Err(e) => eprintln!("Failed to send to {}. Error: {}", address, e),
+            }
+        }
 
-            let mut write_buffer = Vec::<u8>::new();
-            write_buffer.append(&mut bincode::serialize(&header).unwrap());
-            listener
-                .send_to(&write_buffer, address)
-                .expect(&format!("Failed to send to {}.", address));
-            last_beacon_update = SystemTime::now();
+        if last_beacon_update.map_or(true, |last_beacon_update| last_beacon_update.elapsed() >= BEACON_UPDATE_INTERVAL) {
+            // Lets the clients that missed the last update know that they did.
+            let write_buffer = match last_multicast {
+                Some((sequence, projects_hash)) =>
+                    serialize_message(version, MessageType::Beacon, bincode::serialize(&BeaconInfo { projects_hash, sequence }).unwrap()),
+                None => server_header_only_message(version, MessageType::Beacon).to_vec(),
+            };
+            match listener.send_to(&write_buffer, address) {
+                Ok(bytes_sent) => counters.sent(1, bytes_sent),
+                Err(e) => eprintln!("Failed to send to {}. Error: {}", address, e),
+            }
+            last_beacon_update = Some(Instant::now());
         }
 
-        std::thread::sleep(Duration::from_millis(500));
+        // Sleeps until the next beacon or repair, unless a client sends something or the projects change
+        // first.
+        let next_beacon = last_beacon_update.unwrap() + BEACON_UPDATE_INTERVAL;
+        let next_wake = repair.next_send().map_or(next_beacon, |next_send| next_send.min(next_beacon));
+        server_wait(&mut poll, &mut events, Some(next_wake.saturating_duration_since(Instant::now())));
     }
 }
 
-fn server_query_thread(data: &Arc<RwLock<MonitorServerThreadData>>) {
+// One of the workers that answer the clients that query the server. With more than one worker, each
+// binds its own socket to the address and the system spreads the clients over them.
+fn server_query_thread(data: &Arc<RwLock<MonitorServerThreadData>>, mut poll: Poll, history: &Mutex<ProjectsHistory>, reuse_port: bool) {
     let address;
     {
         let data_read_lock = data.read().unwrap();
@@ -244,15 +541,35 @@ fn server_query_thread(data: &Arc<RwLock<MonitorServerThreadData>>) {
     socket
         .set_reuse_address(true)
         .expect("Failed to apply reuse address");
+    if reuse_port {
+        #[cfg(unix)]
+        socket
+            .set_reuse_port(true)
+            .expect("Failed to apply reuse port");
+    }
     socket
         .set_nonblocking(true)
         .expect("Failed to set non blocking.");
+    // Holds the burst of requests of many clients that start at the same time.
+    match socket.set_recv_buffer_size(SOCKET_RECV_BUFFER_SIZE) {
+        Ok(()) => {},
+        Err(e) => eprintln!("Failed to enlarge the receive buffer. Error: {}", e),
+    }
 
     socket
         .bind(&address.into())
         .expect("Failed to bind socket.");
 
-    let listener: UdpSocket = socket.into();
+    let mut listener = UdpSocket::from_std(socket.into());
+    poll.registry()
+        .register(&mut listener, SOCKET_TOKEN, Interest::READABLE)
+        .expect("Failed to register socket.");
+    let mut events = Events::with_capacity(16);
+    // Reused for every batch of datagrams, the body of a message is read from it in place.
+    let mut receive_batch = ReceiveBatch::new();
+    let mut no_update_addresses = Vec::with_capacity(BATCH_SIZE);
+    let counters = data.read().unwrap().counters.clone();
+    let refresh_signal = data.read().unwrap().refresh_signal.clone();
     loop {
         let version;
         let running;
@@ -261,53 +578,255 @@ fn server_query_thread(data: &Arc<RwLock<MonitorServerThreadData>>) {
             let data_read_lock = data.read().unwrap();
             running = data_read_lock.running;
             version = data_read_lock.version;
-            let projects = data_read_lock.projects.read().unwrap();
-            projects_hash = Monitor::generate_projects_hash(&projects);
+            projects_hash = data_read_lock.projects_hash.hash();
         }
 
         if !running {
             break;
         }
 
-        let mut recv_buffer = [0; 1 * 1024 * 1024];
         loop {
-            match server_get_header(&listener, &mut recv_buffer) {
-                Ok((header, from_address, mut deserialize_buffer)) => {
-                    if header.version == version {
-                        // Ensure the full message fit into the packet.
-                        if header.msg_size >= deserialize_buffer.len() as u32 {
-                            if header.msg_type == MessageType::ProjectUpdateRequest {
-                                let mut client_project_hash: u64 = 0;
-                                let client_project_hash_raw: Vec<u8> = deserialize_buffer
-                                    .drain(..bincode::serialized_size(&client_project_hash).unwrap() as usize)
-                                    .collect();
-                                client_project_hash = bincode::deserialize::<u64>(&client_project_hash_raw).unwrap();
-                                if projects_hash == client_project_hash {
-                                    server_handle_no_project_update(data, &listener, &from_address);
+            let count = match receive_batch.receive(&listener) {
+                Ok(count) => count,
+                Err(error) => {
+                    if error.kind() != std::io::ErrorKind::WouldBlock {
+                        eprintln!("Failed to receive data: {}", error);
+                    }
+                    break;
+                }
+            };
+
+            for index in 0..count {
+                let (packet, from_address) = receive_batch.datagram(index);
+                let (header, deserialize_buffer) = server_parse_header(packet);
+                if header.version == version {
+                    // Ensure the full message fit into the packet.
+                    if header.msg_size >= deserialize_buffer.len() as u32 {
+                        if header.msg_type == MessageType::ProjectUpdateRequest {
+                            counters.received_request();
+                            match server_read_update_request(deserialize_buffer) {
+                                Some(request) if projects_hash == request.projects_hash => {
+                                    no_update_addresses.push(from_address);
                                 }
-                                else {
-                                    server_handle_project_update(data, &listener, &from_address);
+                                Some(request) => {
+                                    let client_version = if request.sequence != 0 { Some((request.sequence, request.projects_hash)) } else { None };
+                                    let compression = request.capabilities & CAPABILITY_COMPRESSED_UPDATES != 0;
+                                    // The message is shared, so the other workers only wait while it's built.
+                                    let (write_buffer, _) = server_build_project_update(data, &mut history.lock().unwrap(), client_version, compression);
+                                    server_send_project_update(data, &listener, &from_address, &write_buffer, request.capabilities);
                                 }
-                            } else if header.msg_type == MessageType::VolunteerAdded {
-                                server_handle_volunteer_added(data, &mut deserialize_buffer);
+                                None => eprintln!("Received an invalid update request from {}.", from_address),
+                            }
+                        } else if header.msg_type == MessageType::VolunteerAdded {
+                            if server_handle_volunteer_added(data, deserialize_buffer) {
+                                refresh_signal.request();
                             }
                         }
                     }
-                },
-                Err(_) => {
-                    break;
                 }
             }
+            server_handle_no_project_updates(data, &listener, &no_update_addresses);
+            no_update_addresses.clear();
+        }
+
+        server_wait(&mut poll, &mut events, None);
+    }
+}
+
+// What a stream client has, so only what changed since is pushed to it.
+struct StreamClient {
+    projects_hash: u64,
+    // The sequence and hash of the last update it received, when it supports deltas.
+    version: Option<(u64, u64)>,
+    compression: bool,
+}
+
+// Accepts clients that keep a TCP connection open, and pushes the projects to them as soon as they
+// change instead of waiting for them to ask.
+fn server_stream_thread(data: &Arc<RwLock<MonitorServerThreadData>>, listener: TcpListener, history: Arc<Mutex<ProjectsHistory>>) {
+    let connections = Arc::new(AtomicUsize::new(0));
+    for stream in listener.incoming() {
+        if !data.read().unwrap().running {
+            break;
+        }
+        match stream {
+            // Only this thread adds connections, so the count can't go past the limit.
+            Ok(stream) if connections.load(Ordering::Relaxed) >= MAX_STREAM_CLIENTS => {
+                eprintln!("Refusing stream client {:?}, there are {} already.", stream.peer_addr(), MAX_STREAM_CLIENTS);
+                let _ = stream.shutdown(Shutdown::Both);
+            }
+            Ok(stream) => {
+                let connection_data = data.clone();
+                let connection_history = history.clone();
+                let connection_count = connections.clone();
+                connection_count.fetch_add(1, Ordering::Relaxed);
+                std::thread::spawn(move || {
+                    server_stream_connection(&connection_data, &connection_history, stream);
+                    connection_count.fetch_sub(1, Ordering::Relaxed);
+                });
+            }
+            Err(e) => eprintln!("Failed to accept stream client. Error: {}", e),
+        }
+    }
+}
+
+// Reads the requests and volunteers of a stream client. The projects are sent by
+// server_stream_connection, which the connection signal wakes up for every request.
+fn server_stream_reader(
+    data: &Arc<RwLock<MonitorServerThreadData>>,
+    mut stream: TcpStream,
+    pending_request: &Mutex<Option<ProjectUpdateRequest>>,
+    closed: &AtomicBool,
+    connection_signal: &RefreshSignal,
+) {
+    let (version, refresh_signal) = {
+        let data_read_lock = data.read().unwrap();
+        (data_read_lock.version, data_read_lock.refresh_signal.clone())
+    };
+    let mut frame_reader = FrameReader::new();
+    loop {
+        match frame_reader.read_frame(&mut stream) {
+            Ok(Some((header, deserialize_buffer))) => {
+                if header.version != version {
+                    continue;
+                }
+                if header.msg_type == MessageType::ProjectUpdateRequest {
+                    match server_read_update_request(&deserialize_buffer) {
+                        Some(request) => {
+                            *pending_request.lock().unwrap() = Some(request);
+                            connection_signal.request();
+                        }
+                        None => eprintln!("Received an invalid update request from a stream client."),
+                    }
+                } else if header.msg_type == MessageType::VolunteerAdded {
+                    if server_handle_volunteer_added(data, &deserialize_buffer) {
+                        refresh_signal.request();
+                    }
+                }
+            }
+            Ok(None) => {}
+            Err(_) => break,
+        }
+    }
+    closed.store(true, Ordering::Relaxed);
+    connection_signal.request();
+}
+
+fn server_stream_connection(data: &Arc<RwLock<MonitorServerThreadData>>, history: &Mutex<ProjectsHistory>, mut stream: TcpStream) {
+    let address = match stream.peer_addr() {
+        Ok(address) => address,
+        Err(_) => return,
+    };
+    let reader_stream = match stream.try_clone() {
+        Ok(reader_stream) => reader_stream,
+        Err(e) => {
+            eprintln!("Failed to set up the stream of {}. Error: {}", address, e);
+            return;
+        }
+    };
+    let _ = stream.set_nodelay(true);
+    let _ = stream.set_write_timeout(Some(STREAM_WRITE_TIMEOUT));
+    println!("Stream client {} connected.", address);
+
+    // Requested when the projects change, like the refresh signal of the server, but also by the reader
+    // of this connection only, so a request doesn't wake the other connections.
+    let connection_signal = Arc::new(RefreshSignal::new());
+    data.read().unwrap().refresh_signal.add_follower(&connection_signal);
+    let pending_request = Arc::new(Mutex::new(None));
+    let closed = Arc::new(AtomicBool::new(false));
+    {
+        let reader_data = data.clone();
+        let reader_pending_request = pending_request.clone();
+        let reader_closed = closed.clone();
+        let reader_signal = connection_signal.clone();
+        std::thread::spawn(move || server_stream_reader(&reader_data, reader_stream, &reader_pending_request, &reader_closed, &reader_signal));
+    }
+
+    let counters = data.read().unwrap().counters.clone();
+    let mut seen_refreshes = 0;
+    let mut client: Option<StreamClient> = None;
+    let mut last_message = Instant::now();
+    loop {
+        let version;
+        let running;
+        let projects_hash;
+        {
+            let data_read_lock = data.read().unwrap();
+            running = data_read_lock.running;
+            version = data_read_lock.version;
+            projects_hash = data_read_lock.projects_hash.hash();
+        }
+
+        if !running || closed.load(Ordering::Relaxed) {
+            break;
+        }
+
+        // A request replaces what the client had, it asks again after it missed a delta.
+        match pending_request.lock().unwrap().take() {
+            Some(request) => {
+                client = Some(StreamClient {
+                    projects_hash: request.projects_hash,
+                    version: if request.sequence != 0 { Some((request.sequence, request.projects_hash)) } else { None },
+                    compression: request.capabilities & CAPABILITY_COMPRESSED_UPDATES != 0,
+                });
+                counters.received_request();
+                if request.projects_hash == projects_hash {
+                    last_message = Instant::now();
+                    if stream.write_all(&server_header_only_message(version, MessageType::NoProjectUpdate)).is_err() {
+                        break;
+                    }
+                    counters.sent(1, HEADER_SIZE);
+                }
+            }
+            None => {}
+        }
 
+        let mut write_buffer = None;
+        match &mut client {
+            Some(client) if client.projects_hash != projects_hash => {
+                let (message, (sequence, sent_hash)) = server_build_project_update(
+                    data, &mut history.lock().unwrap(), client.version, client.compression);
+                client.projects_hash = sent_hash;
+                client.version = Some((sequence, sent_hash));
+                write_buffer = Some(message);
+            }
+            _ => {
+                if last_message.elapsed() >= BEACON_UPDATE_INTERVAL {
+                    write_buffer = Some(Arc::new(server_header_only_message(version, MessageType::Beacon).to_vec()));
+                }
+            }
+        }
+        match write_buffer {
+            Some(write_buffer) => {
+                last_message = Instant::now();
+                match stream.write_all(&write_buffer) {
+                    Ok(()) => counters.sent(1, write_buffer.len()),
+                    Err(e) => {
+                        eprintln!("Failed to send to {}. Error: {}", address, e);
+                        break;
+                    }
+                }
+            }
+            None => {}
         }
 
-        std::thread::sleep(Duration::from_millis(5));
+        connection_signal.wait(&mut seen_refreshes, BEACON_UPDATE_INTERVAL);
     }
+
+    println!("Stream client {} disconnected.", address);
+    let _ = stream.shutdown(Shutdown::Both);
 }
 
 pub struct MonitorServer {
-    server_thread: Option<JoinHandle<()>>,
+    server_threads: Vec<JoinHandle<()>>,
+    stream_thread: Option<JoinHandle<()>>,
+    // The address to connect to, to wake up the stream thread.
+    stream_address: Option<SocketAddr>,
     thread_data: Arc<RwLock<MonitorServerThreadData>>,
+    refresh_signal: Arc<RefreshSignal>,
+    counters: Arc<ServerCounters>,
+    // Wake up the server threads when the projects changed or they have to stop.
+    wakers: Vec<Waker>,
 }
 
 impl MonitorServer {
@@ -315,42 +834,237 @@ impl MonitorServer {
         address: SocketAddr,
         version: u32,
         projects: Arc<RwLock<Vec<Project>>>,
+        projects_hash: Arc<ProjectsHash>,
         multicast: bool,
+        workers: usize,
     ) -> MonitorServer {
+        let refresh_signal = Arc::new(RefreshSignal::new());
+        let counters = Arc::new(ServerCounters::default());
         let thread_data = Arc::new(RwLock::new(MonitorServerThreadData {
             running: true,
-            needs_refresh: true,
+            counters: counters.clone(),
+            refresh_signal: refresh_signal.clone(),
             version,
             projects,
+            projects_hash,
+            multicast_deltas: false,
+            multicast_compression: false,
             address,
+            volunteer_forwarder: None,
         }));
-        let thread_data_for_thread = thread_data.clone();
 
-        MonitorServer {
-            server_thread: Some(std::thread::spawn(move || {
+        // Shared by the query workers and the stream connections, so the versions aren't remembered
+        // once per client, and every client gets the same sequence for the same projects.
+        let history = Arc::new(Mutex::new(ProjectsHistory::new()));
+
+        // Clients that query the server can also keep a stream open, on the same port over TCP.
+        let mut stream_thread = None;
+        let mut stream_address = None;
+        if !multicast {
+            match TcpListener::bind(address).and_then(|listener| Ok((listener.local_addr()?, listener))) {
+                Ok((mut local_address, listener)) => {
+                    if local_address.ip().is_unspecified() {
+                        local_address.set_ip(IpAddr::V4(Ipv4Addr::LOCALHOST));
+                    }
+                    stream_address = Some(local_address);
+                    let thread_data_for_stream = thread_data.clone();
+                    let history_for_stream = history.clone();
+                    stream_thread = Some(std::thread::spawn(move || server_stream_thread(&thread_data_for_stream, listener, history_for_stream)));
+                }
+                Err(e) => eprintln!("Failed to listen for stream clients on {}. Error: {}", address, e),
+            }
+        }
+
+        // The system only spreads the clients over several sockets on the same address where it
+        // supports SO_REUSEPORT.
+        let workers = if multicast || cfg!(not(unix)) { 1 } else { std::cmp::max(workers, 1) };
+        let mut server_threads = Vec::new();
+        let mut wakers = Vec::new();
+        for _ in 0..workers {
+            let thread_data_for_thread = thread_data.clone();
+            let history_for_thread = history.clone();
+            let poll = Poll::new().expect("Unable to create the event loop.");
+            wakers.push(Waker::new(poll.registry(), WAKE_TOKEN).expect("Unable to create the event loop."));
+            server_threads.push(std::thread::spawn(move || {
                 if multicast {
-                    server_multicast_thread(&thread_data_for_thread)
+                    server_multicast_thread(&thread_data_for_thread, poll)
                 }
                 else {
-                    server_query_thread(&thread_data_for_thread)
+                    server_query_thread(&thread_data_for_thread, poll, &history_for_thread, workers > 1)
                 }
-            })),
+            }));
+        }
+
+        MonitorServer {
+            server_threads,
+            stream_thread,
+            stream_address,
             thread_data,
+            refresh_signal,
+            counters,
+            wakers,
+        }
+    }
+
+    pub fn set_multicast_deltas(&mut self, multicast_deltas: bool) {
+        self.thread_data.write().unwrap().multicast_deltas = multicast_deltas;
+    }
+
+    pub fn set_multicast_compression(&mut self, multicast_compression: bool) {
+        self.thread_data.write().unwrap().multicast_compression = multicast_compression;
+    }
+
+    pub fn set_volunteer_forwarder(&mut self, volunteer_forwarder: Option<VolunteerForwarder>) {
+        self.thread_data.write().unwrap().volunteer_forwarder = volunteer_forwarder;
+    }
+
+    pub fn statistics(&self) -> ServerStatistics {
+        ServerStatistics {
+            requests: self.counters.requests.load(Ordering::Relaxed),
+            messages_sent: self.counters.messages_sent.load(Ordering::Relaxed),
+            bytes_sent: self.counters.bytes_sent.load(Ordering::Relaxed),
         }
     }
 
     pub fn update_clients(&mut self) {
-        self.thread_data.write().unwrap().needs_refresh = true;
+        self.refresh_signal.request();
+        self.wake();
+    }
+
+    fn wake(&self) {
+        for waker in self.wakers.iter() {
+            match waker.wake() {
+                Ok(()) => {},
+                Err(e) => eprintln!("Failed to wake up a server thread. Error: {}", e),
+            }
+        }
     }
 }
 
 impl Drop for MonitorServer {
     fn drop(&mut self) {
         self.thread_data.write().unwrap().running = false;
+        self.refresh_signal.request();
+        self.wake();
 
-        let join_result = self.server_thread.take().unwrap().join();
-        if join_result.is_err() {
-            eprintln!("Failed to join the multicasting thread.")
+        for server_thread in self.server_threads.drain(..) {
+            if server_thread.join().is_err() {
+                eprintln!("Failed to join a server thread.")
+            }
         }
+
+        match (self.stream_thread.take(), self.stream_address) {
+            (Some(stream_thread), Some(stream_address)) => {
+                // Wakes up the listener, so it notices it has to stop.
+                let _ = TcpStream::connect(stream_address);
+                if stream_thread.join().is_err() {
+                    eprintln!("Failed to join the stream thread.")
+                }
+            }
+            _ => {}
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn projects_history_test() {
+        let mut projects: Vec<Project> = (0..4)
+            .map(|index| Project::new("folder", &format!("https://jenkins/job/folder/job/project{}/", index)))
+            .collect();
+        let mut history = ProjectsHistory::new();
+        let (first_sequence, first_hash) = history.update(1, &projects);
+        assert_eq!(history.update(2, &projects), (first_sequence, first_hash));
+
+        projects[1].set_volunteer("volunteer");
+        let removed_id = projects.remove(3).id();
+        // The projects aren't looked at until a new hash was published for them.
+        assert_eq!(history.update(2, &projects), (first_sequence, first_hash));
+        let (sequence, projects_hash) = history.update(3, &projects);
+        assert_eq!(sequence, first_sequence + 1);
+
+        let delta = history.delta(first_sequence, first_hash, &projects).unwrap();
+        assert_eq!(delta.sequence, sequence);
+        assert_eq!(delta.projects_hash, projects_hash);
+        assert_eq!(delta.changed.len(), 1);
+        assert_eq!(delta.changed[0].id(), projects[1].id());
+        assert_eq!(delta.removed, vec![removed_id]);
+
+        // A version the server doesn't know gets all projects.
+        assert!(history.delta(first_sequence, projects_hash, &projects).is_none());
+        assert!(history.delta(sequence + 1, projects_hash, &projects).is_none());
+    }
+
+    #[test]
+    fn full_update_cache_test() {
+        let projects: Vec<Project> = (0..4)
+            .map(|index| Project::new("folder", &format!("https://jenkins/job/folder/job/project{}/", index)))
+            .collect();
+        let projects_hash = Arc::new(ProjectsHash::new());
+        projects_hash.publish(Monitor::generate_projects_hash(&projects));
+        let data = Arc::new(RwLock::new(MonitorServerThreadData {
+            running: true,
+            counters: Arc::new(ServerCounters::default()),
+            refresh_signal: Arc::new(RefreshSignal::new()),
+            version: 1,
+            projects: Arc::new(RwLock::new(projects)),
+            projects_hash: projects_hash.clone(),
+            multicast_deltas: false,
+            multicast_compression: false,
+            address: "127.0.0.1:0".parse().unwrap(),
+            volunteer_forwarder: None,
+        }));
+        let mut history = ProjectsHistory::new();
+
+        // Every client gets the same message, until a new hash is published.
+        let (first_update, first_version) = server_build_project_update(&data, &mut history, None, false);
+        let (update, version) = server_build_project_update(&data, &mut history, None, false);
+        assert!(Arc::ptr_eq(&first_update, &update));
+        assert_eq!(version, first_version);
+        let (compressed_update, _) = server_build_project_update(&data, &mut history, None, true);
+        assert!(!Arc::ptr_eq(&first_update, &compressed_update));
+
+        {
+            let data_read_lock = data.read().unwrap();
+            let mut projects = data_read_lock.projects.write().unwrap();
+            projects[0].set_volunteer("volunteer");
+            projects_hash.publish(Monitor::generate_projects_hash(&projects));
+        }
+        let (update, version) = server_build_project_update(&data, &mut history, None, false);
+        assert!(update != first_update);
+        assert_eq!(version.0, first_version.0 + 1);
+    }
+
+    #[test]
+    fn chunk_capability_test() {
+        let data = Arc::new(RwLock::new(MonitorServerThreadData {
+            running: true,
+            counters: Arc::new(ServerCounters::default()),
+            refresh_signal: Arc::new(RefreshSignal::new()),
+            version: 1,
+            projects: Arc::new(RwLock::new(Vec::new())),
+            projects_hash: Arc::new(ProjectsHash::new()),
+            multicast_deltas: false,
+            multicast_compression: false,
+            address: "127.0.0.1:0".parse().unwrap(),
+            volunteer_forwarder: None,
+        }));
+        let listener = UdpSocket::bind("127.0.0.1:0".parse().unwrap()).unwrap();
+        let receiver = std::net::UdpSocket::bind("127.0.0.1:0").unwrap();
+        receiver.set_read_timeout(Some(Duration::from_millis(200))).unwrap();
+        let address = receiver.local_addr().unwrap();
+        let message = serialize_message(1, MessageType::ProjectUpdate, vec![0; MAX_DATAGRAM_SIZE]);
+        let mut recv_buffer = vec![0; MAX_RECEIVE_SIZE];
+
+        // Older clients would fail on the chunks, and couldn't receive the message any other way.
+        server_send_project_update(&data, &listener, &address, &message, CAPABILITY_COMPRESSED_UPDATES);
+        assert!(receiver.recv_from(&mut recv_buffer).is_err());
+
+        server_send_project_update(&data, &listener, &address, &message, CAPABILITY_CHUNKED_MESSAGES);
+        let (bytes_read, _) = receiver.recv_from(&mut recv_buffer).unwrap();
+        assert!(Header::from_bytes(&recv_buffer[..bytes_read]).unwrap().0.msg_type == MessageType::ProjectChunk);
     }
 }
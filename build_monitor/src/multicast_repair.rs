@@ -0,0 +1,172 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// A multicast server keeps the datagrams of its last updates, so it can send the ones that clients
+// missed again when they ask for them with an UpdateNack. They're sent to the whole group, so every
+// client that missed the same datagrams is repaired at once, and paced, so a repair isn't a burst that
+// is lost again.
+
+use crate::monitor::UpdateNack;
+
+use std::collections::VecDeque;
+use std::time::{Duration, Instant};
+
+// How many updates are kept. Clients that missed older ones ask the server for its projects instead.
+const MAX_SENT_UPDATES: usize = 8;
+// A datagram that was queued this recently isn't queued again. The clients that ask for it didn't see
+// the repair yet.
+const REPAIR_HOLDOFF: Duration = Duration::from_millis(250);
+// The time between two datagrams that are sent again.
+pub const REPAIR_INTERVAL: Duration = Duration::from_millis(2);
+
+struct SentUpdate {
+    sequence: u64,
+    message_id: u64,
+    datagrams: Vec<Vec<u8>>,
+    // When each datagram was last queued to be sent again.
+    queued_at: Vec<Option<Instant>>,
+}
+
+pub struct MulticastRepair {
+    updates: VecDeque<SentUpdate>,
+    // The sequence of the update and the index of the datagram, in the order they're sent again.
+    queue: VecDeque<(u64, usize)>,
+    next_send: Instant,
+}
+
+impl MulticastRepair {
+    pub fn new() -> MulticastRepair {
+        MulticastRepair {
+            updates: VecDeque::new(),
+            queue: VecDeque::new(),
+            next_send: Instant::now(),
+        }
+    }
+
+    // Keeps the datagrams of an update that was sent to the group, from split_message. They replace
+    // those of an update with the same sequence, which had the same projects.
+    pub fn add_update(&mut self, sequence: u64, message_id: u64, datagrams: Vec<Vec<u8>>) {
+        let replaced = self.updates.iter().position(|update| update.sequence == sequence);
+        let dropped = match replaced {
+            Some(index) => self.updates.remove(index),
+            None if self.updates.len() == MAX_SENT_UPDATES => self.updates.pop_front(),
+            None => None,
+        };
+        match dropped {
+            Some(dropped) => self.queue.retain(|(sequence, _)| *sequence != dropped.sequence),
+            None => {}
+        }
+        let queued_at = vec![None; datagrams.len()];
+        self.updates.push_back(SentUpdate { sequence, message_id, datagrams, queued_at });
+    }
+
+    // Queues the datagrams the client asks for, unless they were queued within the holdoff. Returns how
+    // many were queued.
+    pub fn add_nack(&mut self, nack: &UpdateNack) -> usize {
+        let now = Instant::now();
+        let update = match self.updates.iter_mut().find(|update| {
+            if nack.message_id != 0 { update.message_id == nack.message_id } else { update.sequence == nack.sequence }
+        }) {
+            Some(update) => update,
+            None => return 0,
+        };
+        let indices: Vec<usize> = if nack.message_id != 0 {
+            nack.chunks.iter().map(|index| *index as usize).filter(|index| *index < update.datagrams.len()).collect()
+        }
+        else {
+            (0..update.datagrams.len()).collect()
+        };
+
+        if self.queue.is_empty() {
+            self.next_send = self.next_send.max(now);
+        }
+        let mut queued = 0;
+        for index in indices {
+            if update.queued_at[index].map_or(false, |queued_at| now.duration_since(queued_at) < REPAIR_HOLDOFF) {
+                continue;
+            }
+            update.queued_at[index] = Some(now);
+            self.queue.push_back((update.sequence, index));
+            queued += 1;
+        }
+        queued
+    }
+
+    // When the next datagram is due, or None when nothing is queued.
+    pub fn next_send(&self) -> Option<Instant> {
+        if self.queue.is_empty() { None } else { Some(self.next_send) }
+    }
+
+    // Returns the next datagram to send again once it's due, one per repair interval.
+    pub fn take_due(&mut self, now: Instant) -> Option<&[u8]> {
+        if now < self.next_send {
+            return None;
+        }
+        while let Some((sequence, index)) = self.queue.pop_front() {
+            match self.updates.iter().find(|update| update.sequence == sequence) {
+                Some(update) => {
+                    self.next_send = now + REPAIR_INTERVAL;
+                    return Some(&update.datagrams[index]);
+                }
+                None => {}
+            }
+        }
+        None
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn datagrams(count: u8) -> Vec<Vec<u8>> {
+        (0..count).map(|index| vec![index]).collect()
+    }
+
+    #[test]
+    fn repair_test() {
+        let mut repair = MulticastRepair::new();
+        repair.add_update(1, 0, datagrams(1));
+        repair.add_update(2, 42, datagrams(4));
+        assert!(repair.next_send().is_none());
+
+        // Chunks are asked for by message id, whole updates by sequence.
+        assert!(repair.add_nack(&UpdateNack { message_id: 42, sequence: 0, chunks: vec![1, 3, 7] }) == 2);
+        assert!(repair.add_nack(&UpdateNack { message_id: 0, sequence: 1, chunks: Vec::new() }) == 1);
+        assert!(repair.add_nack(&UpdateNack { message_id: 0, sequence: 5, chunks: Vec::new() }) == 0);
+
+        // Other clients that missed the same chunks don't make them go out twice.
+        assert!(repair.add_nack(&UpdateNack { message_id: 0, sequence: 2, chunks: Vec::new() }) == 2);
+        assert!(repair.add_nack(&UpdateNack { message_id: 42, sequence: 0, chunks: vec![1, 3] }) == 0);
+
+        // One datagram goes out per interval.
+        let now = repair.next_send().unwrap();
+        assert!(repair.take_due(now).unwrap() == [1]);
+        assert!(repair.take_due(now).is_none());
+        let mut sent = Vec::new();
+        let mut time = now;
+        while repair.next_send().is_some() {
+            time += REPAIR_INTERVAL;
+            sent.push(repair.take_due(time).unwrap()[0]);
+        }
+        assert!(sent == [3, 0, 0, 2]);
+    }
+
+    #[test]
+    fn repair_history_test() {
+        let mut repair = MulticastRepair::new();
+        for sequence in 1..=MAX_SENT_UPDATES as u64 {
+            repair.add_update(sequence, 0, datagrams(1));
+        }
+        assert!(repair.add_nack(&UpdateNack { message_id: 0, sequence: 1, chunks: Vec::new() }) == 1);
+
+        // The queued datagrams of an update that is dropped from the history aren't sent anymore.
+        repair.add_update(MAX_SENT_UPDATES as u64 + 1, 0, datagrams(1));
+        assert!(repair.take_due(Instant::now() + REPAIR_INTERVAL).is_none());
+        assert!(repair.add_nack(&UpdateNack { message_id: 0, sequence: 1, chunks: Vec::new() }) == 0);
+
+        // An update that is sent again with the same projects replaces the one that was kept.
+        repair.add_update(MAX_SENT_UPDATES as u64 + 1, 0, datagrams(2));
+        assert!(repair.add_nack(&UpdateNack { message_id: 0, sequence: MAX_SENT_UPDATES as u64 + 1, chunks: Vec::new() }) == 2);
+        assert!(repair.add_nack(&UpdateNack { message_id: 0, sequence: 2, chunks: Vec::new() }) == 1);
+    }
+}
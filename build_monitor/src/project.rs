@@ -1,14 +1,23 @@
 // Copyright Sander Brattinga. All rights reserved.
 
 use crate::error::BuildMonitorError;
+use crate::jenkins_api::{Build, Job};
+use crate::jenkins_client::JenkinsClient;
+use crate::project_encoding::{CompactReader, CompactWriter, NAME_COLUMN, URL_COLUMN};
 
-use json;
+use serde::de::DeserializeOwned;
 use serde::{Deserialize, Serialize};
 use std::collections::hash_map::DefaultHasher;
 use std::fmt;
 use std::hash::{Hash, Hasher};
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::sync::Arc;
 
+// The fields of a job that refresh_status_from_job reads, in the format of Jenkins' tree parameter.
+pub const JOB_TREE: &str = concat!("name,url,buildable,",
+    "lastBuild[building,result,duration,estimatedDuration,timestamp,culprits[fullName]],",
+    "lastSuccessfulBuild[timestamp],lastCompletedBuild[result]");
+
 #[derive(Clone, Deserialize, Hash, PartialEq, Serialize)]
 pub enum ProjectStatus {
     Success,
@@ -48,6 +57,19 @@ pub struct Project {
     timestamp: u64,
     culprits: Vec<String>,
     volunteer: String,
+    // Not sent to clients, they compute it themselves when it's first needed.
+    #[serde(skip)]
+    content_hash: ContentHash,
+}
+
+// The hash of everything a client can see of a project, or 0 when it has to be computed again.
+#[derive(Default)]
+struct ContentHash(AtomicU64);
+
+impl Clone for ContentHash {
+    fn clone(&self) -> ContentHash {
+        ContentHash(AtomicU64::new(self.0.load(Ordering::Relaxed)))
+    }
 }
 
 #[derive(Deserialize, Serialize)]
@@ -56,6 +78,32 @@ pub struct Volunteer {
     pub volunteer: String,
 }
 
+// A Volunteer that borrows its name from the message it was read from.
+#[derive(Deserialize)]
+pub struct VolunteerView<'a> {
+    pub id: u64,
+    pub volunteer: &'a str,
+}
+
+// A Project that borrows its strings from the ProjectUpdate it was read from, the fields are in the
+// same order. Clients only turn it into a Project once they keep it.
+#[derive(Deserialize)]
+pub struct ProjectView<'a> {
+    id: u64,
+    name: &'a str,
+    folder: &'a str,
+    url: &'a str,
+    status: ProjectStatus,
+    is_building: bool,
+    last_successful_build_time: u64,
+    duration: u64,
+    estimated_duration: u64,
+    timestamp: u64,
+    #[serde(borrow)]
+    culprits: Vec<&'a str>,
+    volunteer: &'a str,
+}
+
 impl Project {
     pub fn new(folder: &str, url: &str) -> Project {
         let mut hasher = DefaultHasher::new();
@@ -74,20 +122,52 @@ impl Project {
             timestamp: 0,
             culprits: Vec::new(),
             volunteer: String::new(),
+            content_hash: ContentHash::default(),
         }
     }
 
-    pub async fn refresh_status(self: &mut Project, client: Arc<reqwest::blocking::Client>) -> Result<(), BuildMonitorError> {
-        self.refresh_project(client.clone()).await?;
+    pub async fn refresh_status(self: &mut Project, client: &JenkinsClient) -> Result<(), BuildMonitorError> {
+        self.mark_dirty();
+        self.refresh_project(client).await?;
 
         if self.status() != ProjectStatus::Disabled {
-            self.refresh_last_build(client.clone()).await?;
+            self.refresh_last_build(client).await?;
             self.refresh_last_successful_build(client).await?;
         }
 
         Ok(())
     }
 
+    // Does the same as refresh_status, but takes everything from a job that was already retrieved with
+    // the fields in JOB_TREE, instead of requesting the project and its builds separately.
+    pub fn refresh_status_from_job(self: &mut Project, job: &Job) -> Result<(), BuildMonitorError> {
+        self.mark_dirty();
+        self.apply_project(job)?;
+
+        if self.status() != ProjectStatus::Disabled {
+            match &job.last_build {
+                Some(last_build) => {
+                    self.apply_last_build(last_build)?;
+                    if self.is_building {
+                        if let Some(last_completed_build) = &job.last_completed_build {
+                            self.apply_last_completed_build(last_completed_build);
+                        }
+                    }
+                }
+                None => {
+                    self.status = ProjectStatus::NotBuilt;
+                    self.is_building = false;
+                }
+            }
+
+            if let Some(last_successful_build) = &job.last_successful_build {
+                self.apply_last_successful_build(last_successful_build)?;
+            }
+        }
+
+        Ok(())
+    }
+
     pub fn id(self: &Project) -> u64 {
         self.id
     }
@@ -137,39 +217,39 @@ impl Project {
     }
 
     pub fn set_volunteer(self: &mut Project, volunteer: &str) {
+        self.mark_dirty();
         self.volunteer = volunteer.to_string();
     }
 
-    async fn get_json(self: &Project, client: Arc<reqwest::blocking::Client>, url: &str) -> Result<json::JsonValue, BuildMonitorError> {
-        let api_url = url.to_string() + "/api/json";
-        let response = client.get(&api_url).send()?;
-        if response.status() != reqwest::StatusCode::OK {
-            Err(BuildMonitorError::PageNotFoundError())
-        } else {
-            let text = response.text()?;
-            Ok(json::parse(&text)?)
+    // The same as hashing the project, but only computed again after the project changed.
+    pub fn content_hash(self: &Project) -> u64 {
+        let content_hash = self.content_hash.0.load(Ordering::Relaxed);
+        if content_hash != 0 {
+            return content_hash;
         }
+
+        let mut hasher = DefaultHasher::new();
+        self.hash(&mut hasher);
+        let content_hash = hasher.finish();
+        self.content_hash.0.store(content_hash, Ordering::Relaxed);
+        content_hash
     }
 
-    async fn refresh_project(self: &mut Project, client: Arc<reqwest::blocking::Client>) -> Result<(), BuildMonitorError> {
-        let json_result = self.get_json(client, &self.url).await;
-        match json_result {
-            Ok(json) => {
-                self.name = json["name"]
-                    .as_str()
-                    .ok_or_else(|| BuildMonitorError::FieldError {})
-                    .unwrap()
-                    .to_string();
-                let buildable = json["buildable"]
-                    .as_bool()
-                    .ok_or_else(|| BuildMonitorError::FieldError {})
-                    .unwrap();
-                if !buildable {
-                    self.status = ProjectStatus::Disabled;
-                    self.is_building = false;
-                }
-                Ok(())
-            }
+    // Every function that changes what Hash covers has to call this first.
+    fn mark_dirty(self: &mut Project) {
+        self.content_hash.0.store(0, Ordering::Relaxed);
+    }
+
+    async fn get_json<T: DeserializeOwned + Send + Sync + 'static>(self: &Project, client: &JenkinsClient, url: &str) ->
+        Result<Arc<T>, BuildMonitorError> {
+        let api_url = url.to_string() + "/api/json";
+        client.get_json(&api_url)
+    }
+
+    async fn refresh_project(self: &mut Project, client: &JenkinsClient) -> Result<(), BuildMonitorError> {
+        let job_result = self.get_json::<Job>(client, &self.url).await;
+        match job_result {
+            Ok(job) => self.apply_project(&job),
             Err(error) => match error {
                 BuildMonitorError::PageNotFoundError() => {
                     self.name = self.url.clone();
@@ -182,71 +262,15 @@ impl Project {
         }
     }
 
-    async fn refresh_last_build(self: &mut Project, client: Arc<reqwest::blocking::Client>) -> Result<(), BuildMonitorError> {
+    async fn refresh_last_build(self: &mut Project, client: &JenkinsClient) -> Result<(), BuildMonitorError> {
         let last_built_url = self.url.clone() + "/lastBuild";
-        let json_result = self.get_json(client.clone(), &last_built_url).await;
-        match json_result {
-            Ok(json) => {
-                self.is_building = json["building"]
-                    .as_bool()
-                    .ok_or_else(|| BuildMonitorError::FieldError {})
-                    .unwrap();
+        let build_result = self.get_json::<Build>(client, &last_built_url).await;
+        match build_result {
+            Ok(build) => {
+                self.apply_last_build(&build)?;
                 if self.is_building {
                     self.refresh_last_completed_build(client).await?;
                 }
-                else {
-                    let result = json["result"]
-                        .as_str()
-                        .ok_or_else(|| BuildMonitorError::FieldError {})
-                        .unwrap_or_else(|_| "");
-                    if result == "SUCCESS" {
-                        self.status = ProjectStatus::Success;
-                    } else if result == "UNSTABLE" {
-                        self.status = ProjectStatus::Unstable;
-                    } else if result == "FAILURE" {
-                        self.status = ProjectStatus::Failed;
-                    } else if result == "ABORTED" {
-                        self.status = ProjectStatus::Aborted;
-                    } else {
-                        self.status = ProjectStatus::Unknown;
-                    }
-                }
-
-                if json.has_key("duration") {
-                    self.duration = json["duration"]
-                        .as_u64()
-                        .ok_or_else(|| BuildMonitorError::FieldError {})
-                        .unwrap();
-                    self.estimated_duration = 0;
-                }
-
-                if json.has_key("estimatedDuration") {
-                    let estimated_duration = json["estimatedDuration"]
-                        .as_i64()
-                        .ok_or_else(|| BuildMonitorError::FieldError {})
-                        .unwrap();
-                    if estimated_duration >= 0 {
-                        self.estimated_duration = estimated_duration as u64;
-                    }
-                }
-
-                if json.has_key("timestamp") {
-                    self.timestamp = json["timestamp"]
-                        .as_u64()
-                        .ok_or_else(|| BuildMonitorError::FieldError {})
-                        .unwrap();
-                }
-
-                for culprit in json["culprits"].members() {
-                    self.culprits.push(
-                        culprit["fullName"]
-                            .as_str()
-                            .ok_or_else(|| BuildMonitorError::FieldError {})
-                            .unwrap()
-                            .into(),
-                    );
-                }
-
                 Ok(())
             }
             Err(error) => match error {
@@ -260,17 +284,11 @@ impl Project {
         }
     }
 
-    async fn refresh_last_successful_build(self: &mut Project, client: Arc<reqwest::blocking::Client>) -> Result<(), BuildMonitorError> {
+    async fn refresh_last_successful_build(self: &mut Project, client: &JenkinsClient) -> Result<(), BuildMonitorError> {
         let last_successful_build_url = self.url.clone() + "/lastSuccessfulBuild";
-        let json_result = self.get_json(client, &last_successful_build_url).await;
-        match json_result {
-            Ok(json) => {
-                self.last_successful_build_time = json["timestamp"]
-                    .as_u64()
-                    .ok_or_else(|| BuildMonitorError::FieldError {})
-                    .unwrap();
-                Ok(())
-            }
+        let build_result = self.get_json::<Build>(client, &last_successful_build_url).await;
+        match build_result {
+            Ok(build) => self.apply_last_successful_build(&build),
             Err(error) => match error {
                 BuildMonitorError::PageNotFoundError() => Ok(()),
                 _ => Err(error),
@@ -278,26 +296,12 @@ impl Project {
         }
     }
 
-    async fn refresh_last_completed_build(self: &mut Project, client: Arc<reqwest::blocking::Client>) -> Result<(), BuildMonitorError> {
+    async fn refresh_last_completed_build(self: &mut Project, client: &JenkinsClient) -> Result<(), BuildMonitorError> {
         let last_completed_build_url = self.url.clone() + "/lastCompletedBuild";
-        let json_result = self.get_json(client, &last_completed_build_url).await;
-        match json_result {
-            Ok(json) => {
-                let result = json["result"]
-                    .as_str()
-                    .ok_or_else(|| BuildMonitorError::FieldError {})
-                    .unwrap_or_else(|_| "");
-                if result == "SUCCESS" {
-                    self.status = ProjectStatus::Success;
-                } else if result == "UNSTABLE" {
-                    self.status = ProjectStatus::Unstable;
-                } else if result == "FAILURE" {
-                    self.status = ProjectStatus::Failed;
-                } else if result == "ABORTED" {
-                    self.status = ProjectStatus::Aborted;
-                } else {
-                    self.status = ProjectStatus::Unknown;
-                }
+        let build_result = self.get_json::<Build>(client, &last_completed_build_url).await;
+        match build_result {
+            Ok(build) => {
+                self.apply_last_completed_build(&build);
                 Ok(())
             }
             Err(error) => match error {
@@ -306,6 +310,138 @@ impl Project {
             },
         }
     }
+
+    fn apply_project(self: &mut Project, job: &Job) -> Result<(), BuildMonitorError> {
+        self.name = job.name.clone().ok_or_else(|| BuildMonitorError::FieldError {})?;
+        let buildable = job.buildable.ok_or_else(|| BuildMonitorError::FieldError {})?;
+        if !buildable {
+            self.status = ProjectStatus::Disabled;
+            self.is_building = false;
+        }
+        Ok(())
+    }
+
+    // Applies everything but the status of a build that is still in progress. That status comes from
+    // the last completed build instead.
+    fn apply_last_build(self: &mut Project, build: &Build) -> Result<(), BuildMonitorError> {
+        self.is_building = build.building.ok_or_else(|| BuildMonitorError::FieldError {})?;
+        if !self.is_building {
+            self.status = Project::status_from_result(&build.result);
+        }
+
+        if let Some(duration) = build.duration {
+            self.duration = duration;
+            self.estimated_duration = 0;
+        }
+
+        if let Some(estimated_duration) = build.estimated_duration {
+            if estimated_duration >= 0 {
+                self.estimated_duration = estimated_duration as u64;
+            }
+        }
+
+        if let Some(timestamp) = build.timestamp {
+            self.timestamp = timestamp;
+        }
+
+        for culprit in build.culprits.iter() {
+            self.culprits.push(culprit.full_name.clone());
+        }
+
+        Ok(())
+    }
+
+    fn apply_last_successful_build(self: &mut Project, build: &Build) -> Result<(), BuildMonitorError> {
+        self.last_successful_build_time = build.timestamp.ok_or_else(|| BuildMonitorError::FieldError {})?;
+        Ok(())
+    }
+
+    fn apply_last_completed_build(self: &mut Project, build: &Build) {
+        self.status = Project::status_from_result(&build.result);
+    }
+
+    // Writes the project in the compact encoding of project_encoding. read_compact reads the fields in
+    // the same order.
+    pub fn write_compact(self: &Project, writer: &mut CompactWriter) {
+        writer.write_u64(self.id);
+        writer.write_prefixed(URL_COLUMN, &self.url);
+        writer.write_prefixed(NAME_COLUMN, &self.name);
+        writer.write_shared(&self.folder);
+        writer.write_byte(Project::status_to_byte(&self.status) | if self.is_building { 0x80 } else { 0 });
+        writer.write_varint(self.last_successful_build_time);
+        writer.write_varint(self.duration);
+        writer.write_varint(self.estimated_duration);
+        writer.write_varint(self.timestamp);
+        writer.write_varint(self.culprits.len() as u64);
+        for culprit in self.culprits.iter() {
+            writer.write_shared(culprit);
+        }
+        writer.write_shared(&self.volunteer);
+    }
+
+    pub fn read_compact(reader: &mut CompactReader) -> Result<Project, BuildMonitorError> {
+        let id = reader.read_u64()?;
+        let url = reader.read_prefixed(URL_COLUMN)?;
+        let name = reader.read_prefixed(NAME_COLUMN)?;
+        let folder = reader.read_shared()?;
+        let status_byte = reader.read_byte()?;
+        let mut project = Project {
+            id,
+            name,
+            folder,
+            url,
+            status: Project::status_from_byte(status_byte & 0x7f)?,
+            is_building: status_byte & 0x80 != 0,
+            last_successful_build_time: reader.read_varint()?,
+            duration: reader.read_varint()?,
+            estimated_duration: reader.read_varint()?,
+            timestamp: reader.read_varint()?,
+            culprits: Vec::new(),
+            volunteer: String::new(),
+            content_hash: ContentHash::default(),
+        };
+        let culprit_count = reader.read_varint()?;
+        for _ in 0..culprit_count {
+            project.culprits.push(reader.read_shared()?);
+        }
+        project.volunteer = reader.read_shared()?;
+        Ok(project)
+    }
+
+    fn status_to_byte(status: &ProjectStatus) -> u8 {
+        match status {
+            ProjectStatus::Success => 0,
+            ProjectStatus::Unstable => 1,
+            ProjectStatus::Failed => 2,
+            ProjectStatus::NotBuilt => 3,
+            ProjectStatus::Aborted => 4,
+            ProjectStatus::Disabled => 5,
+            ProjectStatus::Unknown => 6,
+        }
+    }
+
+    fn status_from_byte(byte: u8) -> Result<ProjectStatus, BuildMonitorError> {
+        match byte {
+            0 => Ok(ProjectStatus::Success),
+            1 => Ok(ProjectStatus::Unstable),
+            2 => Ok(ProjectStatus::Failed),
+            3 => Ok(ProjectStatus::NotBuilt),
+            4 => Ok(ProjectStatus::Aborted),
+            5 => Ok(ProjectStatus::Disabled),
+            6 => Ok(ProjectStatus::Unknown),
+            _ => Err(BuildMonitorError::DecodeError()),
+        }
+    }
+
+    fn status_from_result(result: &Option<String>) -> ProjectStatus {
+        match result.as_deref() {
+            Some("SUCCESS") => ProjectStatus::Success,
+            Some("UNSTABLE") => ProjectStatus::Unstable,
+            Some("FAILURE") => ProjectStatus::Failed,
+            Some("ABORTED") => ProjectStatus::Aborted,
+            _ => ProjectStatus::Unknown,
+        }
+    }
 }
 
 impl fmt::Display for Project {
@@ -343,6 +479,46 @@ impl Hash for Project {
     }
 }
 
+impl<'a> ProjectView<'a> {
+    // The same as the content hash of the Project it turns into.
+    pub fn content_hash(self: &ProjectView<'a>) -> u64 {
+        let mut hasher = DefaultHasher::new();
+        self.hash(&mut hasher);
+        hasher.finish()
+    }
+
+    pub fn to_project(self: &ProjectView<'a>) -> Project {
+        Project {
+            id: self.id,
+            name: self.name.to_string(),
+            folder: self.folder.to_string(),
+            url: self.url.to_string(),
+            status: self.status.clone(),
+            is_building: self.is_building,
+            last_successful_build_time: self.last_successful_build_time,
+            duration: self.duration,
+            estimated_duration: self.estimated_duration,
+            timestamp: self.timestamp,
+            culprits: self.culprits.iter().map(|culprit| culprit.to_string()).collect(),
+            volunteer: self.volunteer.to_string(),
+            content_hash: ContentHash::default(),
+        }
+    }
+}
+
+// Hashes the same fields as a Project does, strings hash the same whether they're borrowed or not.
+impl<'a> Hash for ProjectView<'a> {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.id.hash(state);
+        self.status.hash(state);
+        self.is_building.hash(state);
+        self.volunteer.hash(state);
+        self.last_successful_build_time.hash(state);
+        self.duration.hash(state);
+        self.culprits.hash(state);
+    }
+}
+
 impl PartialEq for Project {
     fn eq(&self, other: &Project) -> bool {
         self.id == other.id
@@ -351,3 +527,67 @@ impl PartialEq for Project {
             && self.volunteer == other.volunteer
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::{Project, ProjectStatus, ProjectView};
+    use crate::jenkins_api::{self, Job};
+
+    #[test]
+    fn content_hash_test() {
+        let mut project = Project::new("Folder/", "https://jenkins/job/Folder/job/Build/");
+        let content_hash = project.content_hash();
+        assert_eq!(project.clone().content_hash(), content_hash);
+
+        project.set_volunteer("Sander");
+        assert_ne!(project.content_hash(), content_hash);
+        project.set_volunteer("");
+        assert_eq!(project.content_hash(), content_hash);
+
+        // A project read without copying its strings has the same hash.
+        project.culprits = vec!["Jane Doe".to_string(), "John Doe".to_string()];
+        project.mark_dirty();
+        let serialized = bincode::serialize(&project).unwrap();
+        let view = bincode::deserialize::<ProjectView>(&serialized).unwrap();
+        assert_eq!(view.content_hash(), project.content_hash());
+        let copied_project = view.to_project();
+        assert_eq!(copied_project.to_string(), project.to_string());
+        assert_eq!(bincode::serialize(&copied_project).unwrap(), serialized);
+    }
+
+    #[test]
+    fn refresh_status_from_job_test() {
+        let job: Job = jenkins_api::parse(br#"{
+            "_class": "hudson.model.FreeStyleProject",
+            "name": "Build",
+            "url": "https://jenkins/job/Folder/job/Build/",
+            "buildable": true,
+            "lastBuild": {
+                "building": true,
+                "result": null,
+                "duration": 0,
+                "estimatedDuration": 60000,
+                "timestamp": 1600000000000,
+                "culprits": [{ "fullName": "Sander" }]
+            },
+            "lastSuccessfulBuild": { "timestamp": 1500000000000 },
+            "lastCompletedBuild": { "result": "FAILURE" }
+        }"#).unwrap();
+
+        let mut project = Project::new("Folder/", "https://jenkins/job/Folder/job/Build/");
+        project.refresh_status_from_job(&job).unwrap();
+        assert_eq!(project.name(), "Build");
+        assert!(project.status() == ProjectStatus::Failed);
+        assert!(project.is_building());
+        assert_eq!(project.estimated_duration(), 60000);
+        assert_eq!(project.timestamp(), 1600000000000);
+        assert_eq!(project.last_successful_build_time(), 1500000000000);
+        assert_eq!(project.culprits(), &vec!["Sander".to_string()]);
+
+        let never_built: Job = jenkins_api::parse(br#"{ "name": "New", "buildable": true, "lastBuild": null }"#).unwrap();
+        let mut project = Project::new("", "https://jenkins/job/New/");
+        project.refresh_status_from_job(&never_built).unwrap();
+        assert!(project.status() == ProjectStatus::NotBuilt);
+        assert!(!project.is_building());
+    }
+}
@@ -0,0 +1,232 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// A compact encoding of the projects for clients that support it. Strings that repeat between
+// projects, like folders and culprits, are stored once in a dictionary. Urls and names are stored as
+// the part that differs from the previous project, which shares most of it since the projects are
+// sorted. Numbers are stored in as few bytes as their value needs.
+
+use crate::error::BuildMonitorError;
+use crate::project::Project;
+
+use std::collections::HashMap;
+
+const FORMAT_VERSION: u8 = 1;
+
+// Strings that are compared to the string of the previous project.
+pub const URL_COLUMN: usize = 0;
+pub const NAME_COLUMN: usize = 1;
+const COLUMN_COUNT: usize = 2;
+
+pub struct CompactWriter {
+    records: Vec<u8>,
+    dictionary: Vec<String>,
+    dictionary_indices: HashMap<String, u64>,
+    previous: [String; COLUMN_COUNT],
+}
+
+pub struct CompactReader<'a> {
+    bytes: &'a [u8],
+    dictionary: Vec<String>,
+    previous: [String; COLUMN_COUNT],
+}
+
+pub fn encode_projects(projects: &Vec<Project>) -> Vec<u8> {
+    let mut writer = CompactWriter {
+        records: Vec::new(),
+        dictionary: Vec::new(),
+        dictionary_indices: HashMap::new(),
+        previous: Default::default(),
+    };
+    for project in projects.iter() {
+        project.write_compact(&mut writer);
+    }
+
+    let mut encoded = vec![FORMAT_VERSION];
+    write_varint(&mut encoded, writer.dictionary.len() as u64);
+    for value in writer.dictionary.iter() {
+        write_varint(&mut encoded, value.len() as u64);
+        encoded.extend_from_slice(value.as_bytes());
+    }
+    write_varint(&mut encoded, projects.len() as u64);
+    encoded.extend_from_slice(&writer.records);
+    encoded
+}
+
+pub fn decode_projects(encoded: &[u8]) -> Result<Vec<Project>, BuildMonitorError> {
+    let mut reader = CompactReader {
+        bytes: encoded,
+        dictionary: Vec::new(),
+        previous: Default::default(),
+    };
+    if reader.read_byte()? != FORMAT_VERSION {
+        return Err(BuildMonitorError::DecodeError());
+    }
+    let dictionary_len = reader.read_varint()?;
+    for _ in 0..dictionary_len {
+        let len = reader.read_varint()? as usize;
+        let value = reader.read_string(len)?;
+        reader.dictionary.push(value);
+    }
+
+    let project_count = reader.read_varint()? as usize;
+    // Every project takes at least a byte, this keeps a corrupt count from reserving lots of memory.
+    let mut projects = Vec::with_capacity(std::cmp::min(project_count, reader.bytes.len()));
+    for _ in 0..project_count {
+        projects.push(Project::read_compact(&mut reader)?);
+    }
+    Ok(projects)
+}
+
+fn write_varint(output: &mut Vec<u8>, mut value: u64) {
+    while value >= 0x80 {
+        output.push((value as u8) | 0x80);
+        value >>= 7;
+    }
+    output.push(value as u8);
+}
+
+fn shared_prefix_len(lhs: &str, rhs: &str) -> usize {
+    let mut len = 0;
+    for (lhs_char, rhs_char) in lhs.chars().zip(rhs.chars()) {
+        if lhs_char != rhs_char {
+            break;
+        }
+        len += lhs_char.len_utf8();
+    }
+    len
+}
+
+impl CompactWriter {
+    pub fn write_byte(&mut self, value: u8) {
+        self.records.push(value);
+    }
+
+    pub fn write_u64(&mut self, value: u64) {
+        self.records.extend_from_slice(&value.to_le_bytes());
+    }
+
+    pub fn write_varint(&mut self, value: u64) {
+        write_varint(&mut self.records, value);
+    }
+
+    // For strings that many projects have in common.
+    pub fn write_shared(&mut self, value: &str) {
+        let index = match self.dictionary_indices.get(value) {
+            Some(index) => *index,
+            None => {
+                let index = self.dictionary.len() as u64;
+                self.dictionary.push(value.to_string());
+                self.dictionary_indices.insert(value.to_string(), index);
+                index
+            }
+        };
+        write_varint(&mut self.records, index);
+    }
+
+    // For strings that start like the same string of the previous project.
+    pub fn write_prefixed(&mut self, column: usize, value: &str) {
+        let prefix_len = shared_prefix_len(&self.previous[column], value);
+        write_varint(&mut self.records, prefix_len as u64);
+        write_varint(&mut self.records, (value.len() - prefix_len) as u64);
+        self.records.extend_from_slice(value[prefix_len..].as_bytes());
+        self.previous[column].clear();
+        self.previous[column].push_str(value);
+    }
+}
+
+impl<'a> CompactReader<'a> {
+    fn take(&mut self, len: usize) -> Result<&'a [u8], BuildMonitorError> {
+        if len > self.bytes.len() {
+            return Err(BuildMonitorError::DecodeError());
+        }
+        let (taken, rest) = self.bytes.split_at(len);
+        self.bytes = rest;
+        Ok(taken)
+    }
+
+    fn read_string(&mut self, len: usize) -> Result<String, BuildMonitorError> {
+        let bytes = self.take(len)?;
+        String::from_utf8(bytes.to_vec()).map_err(|_| BuildMonitorError::DecodeError())
+    }
+
+    pub fn read_byte(&mut self) -> Result<u8, BuildMonitorError> {
+        Ok(self.take(1)?[0])
+    }
+
+    pub fn read_u64(&mut self) -> Result<u64, BuildMonitorError> {
+        let mut bytes = [0; 8];
+        bytes.copy_from_slice(self.take(8)?);
+        Ok(u64::from_le_bytes(bytes))
+    }
+
+    pub fn read_varint(&mut self) -> Result<u64, BuildMonitorError> {
+        let mut value = 0;
+        for shift in (0..64).step_by(7) {
+            let byte = self.read_byte()?;
+            value |= ((byte & 0x7f) as u64) << shift;
+            if byte & 0x80 == 0 {
+                return Ok(value);
+            }
+        }
+        Err(BuildMonitorError::DecodeError())
+    }
+
+    pub fn read_shared(&mut self) -> Result<String, BuildMonitorError> {
+        let index = self.read_varint()? as usize;
+        self.dictionary.get(index).cloned().ok_or(BuildMonitorError::DecodeError())
+    }
+
+    pub fn read_prefixed(&mut self, column: usize) -> Result<String, BuildMonitorError> {
+        let prefix_len = self.read_varint()? as usize;
+        let suffix_len = self.read_varint()? as usize;
+        let previous = &self.previous[column];
+        if prefix_len > previous.len() || !previous.is_char_boundary(prefix_len) {
+            return Err(BuildMonitorError::DecodeError());
+        }
+        let mut value = previous[..prefix_len].to_string();
+        value += &self.read_string(suffix_len)?;
+        self.previous[column] = value.clone();
+        Ok(value)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::jenkins_api::{self, Job};
+    use crate::monitor::Monitor;
+
+    #[test]
+    fn encode_and_decode_test() {
+        let job_json = r#"{"name":"project","buildable":true,
+            "lastBuild":{"building":false,"result":"FAILURE","duration":61000,"estimatedDuration":90000,
+                "timestamp":1600000000000,"culprits":[{"fullName":"Jane Doe"},{"fullName":"Jöhn Doe"}]},
+            "lastSuccessfulBuild":{"timestamp":1500000000000}}"#;
+        let job = jenkins_api::parse::<Job>(job_json.as_bytes()).unwrap();
+        let mut projects = Vec::new();
+        for index in 0..50 {
+            let mut project = Project::new("folder/sub folder", &format!("https://jenkins/job/folder/job/sub%20folder/job/project{}/", index));
+            if index % 3 == 0 {
+                project.refresh_status_from_job(&job).unwrap();
+            }
+            if index % 7 == 0 {
+                project.set_volunteer("Jane Doe");
+            }
+            projects.push(project);
+        }
+
+        let encoded = encode_projects(&projects);
+        assert!(encoded.len() * 3 < bincode::serialize(&projects).unwrap().len());
+        let decoded = decode_projects(&encoded).unwrap();
+        assert_eq!(Monitor::generate_projects_hash(&decoded), Monitor::generate_projects_hash(&projects));
+        // The hash doesn't cover every field, but the description does.
+        for (decoded_project, project) in decoded.iter().zip(projects.iter()) {
+            assert_eq!(decoded_project.to_string(), project.to_string());
+        }
+
+        // Truncated input fails instead of panicking.
+        for len in 0..encoded.len() {
+            assert!(decode_projects(&encoded[..len]).is_err());
+        }
+    }
+}
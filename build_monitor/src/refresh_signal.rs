@@ -0,0 +1,88 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+use std::sync::{Arc, Condvar, Mutex, Weak};
+use std::time::Duration;
+
+// Requested when the projects changed, and wakes up the threads that wait for them. The server uses it
+// so its clients don't have to wait for their next poll, a relay so it passes on what its client
+// received right away.
+pub struct RefreshSignal {
+    // Goes up with every request, so each thread can tell whether it saw the last one.
+    refreshes: Mutex<u64>,
+    changed: Condvar,
+    // Signals that are requested along with this one, so a thread that waits for more than this signal
+    // can wait on its own.
+    followers: Mutex<Vec<Weak<RefreshSignal>>>,
+}
+
+impl RefreshSignal {
+    pub fn new() -> RefreshSignal {
+        RefreshSignal {
+            refreshes: Mutex::new(0),
+            changed: Condvar::new(),
+            followers: Mutex::new(Vec::new()),
+        }
+    }
+
+    pub fn request(&self) {
+        *self.refreshes.lock().unwrap() += 1;
+        self.changed.notify_all();
+        self.followers.lock().unwrap().retain(|follower| match follower.upgrade() {
+            Some(follower) => {
+                follower.request();
+                true
+            }
+            None => false,
+        });
+    }
+
+    // Requests the follower as well for every request of this signal, until the follower is dropped.
+    pub fn add_follower(&self, follower: &Arc<RefreshSignal>) {
+        self.followers.lock().unwrap().push(Arc::downgrade(follower));
+    }
+
+    // Waits until a refresh was requested since the seen one or the timeout passed, and returns whether
+    // one was requested.
+    pub fn wait(&self, seen_refreshes: &mut u64, timeout: Duration) -> bool {
+        let last_seen = *seen_refreshes;
+        let refreshes = self.refreshes.lock().unwrap();
+        let (refreshes, _) = self.changed
+            .wait_timeout_while(refreshes, timeout, |refreshes| *refreshes == last_seen)
+            .unwrap();
+        *seen_refreshes = *refreshes;
+        *refreshes != last_seen
+    }
+
+    // Returns whether a refresh was requested since the seen one, without waiting.
+    pub fn refreshed_since(&self, seen_refreshes: &mut u64) -> bool {
+        let refreshes = *self.refreshes.lock().unwrap();
+        std::mem::replace(seen_refreshes, refreshes) != refreshes
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn follower_test() {
+        let signal = RefreshSignal::new();
+        let follower = Arc::new(RefreshSignal::new());
+        signal.add_follower(&follower);
+        let mut seen_refreshes = 0;
+        let mut seen_follower_refreshes = 0;
+
+        // A request of the follower doesn't wake the threads that wait for the signal.
+        follower.request();
+        assert!(follower.refreshed_since(&mut seen_follower_refreshes));
+        assert!(!signal.refreshed_since(&mut seen_refreshes));
+
+        signal.request();
+        assert!(signal.refreshed_since(&mut seen_refreshes));
+        assert!(follower.wait(&mut seen_follower_refreshes, Duration::from_secs(0)));
+
+        drop(follower);
+        signal.request();
+        assert!(signal.followers.lock().unwrap().is_empty());
+    }
+}
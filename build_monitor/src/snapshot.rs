@@ -0,0 +1,122 @@
+// Copyright Sander Brattinga. All rights reserved.
+
+// Stores the projects of the last successful crawl on disk, so a restarted server can serve them to
+// clients right away instead of waiting for the first crawl to finish.
+
+use crate::error::BuildMonitorError;
+use crate::monitor::Monitor;
+use crate::project::Project;
+
+use serde::{Deserialize, Serialize};
+use std::fs::{self, File};
+use std::io::{BufReader, BufWriter, Read, Write};
+use std::path::Path;
+
+const SNAPSHOT_MAGIC: [u8; 4] = *b"BMSN";
+// Version 2 has an FNV-1a checksum of the projects, which is the same for every build.
+const SNAPSHOT_VERSION: u32 = 2;
+
+#[derive(Deserialize, Serialize)]
+struct SnapshotHeader {
+    magic: [u8; 4],
+    version: u32,
+    jenkins_server: String,
+    checksum: u64,
+}
+
+// The 64 bit FNV-1a hash of the data. The hasher of the standard library may change between Rust
+// releases, so a snapshot written by another build would look damaged.
+fn checksum(data: &[u8]) -> u64 {
+    data.iter().fold(0xcbf29ce484222325, |hash, byte| (hash ^ *byte as u64).wrapping_mul(0x100000001b3))
+}
+
+// Writes the snapshot next to the destination first and renames it afterwards, so a crash while
+// writing never leaves a partial snapshot behind.
+pub fn save_snapshot(path: &Path, jenkins_server: &str, projects: &Vec<Project>) -> Result<(), BuildMonitorError> {
+    let projects_buffer = bincode::serialize(projects)?;
+    let header = SnapshotHeader {
+        magic: SNAPSHOT_MAGIC,
+        version: SNAPSHOT_VERSION,
+        jenkins_server: jenkins_server.to_string(),
+        checksum: checksum(&projects_buffer),
+    };
+
+    let mut temporary_path = path.as_os_str().to_owned();
+    temporary_path.push(".tmp");
+    {
+        let mut writer = BufWriter::new(File::create(&temporary_path)?);
+        bincode::serialize_into(&mut writer, &header)?;
+        writer.write_all(&projects_buffer)?;
+        writer.flush()?;
+        writer.get_ref().sync_all()?;
+    }
+    fs::rename(&temporary_path, path)?;
+    Ok(())
+}
+
+// Returns the projects and their hash, or None when there is no snapshot for this Jenkins server. The
+// hash is that of generate_projects_hash in this build.
+pub fn load_snapshot(path: &Path, jenkins_server: &str) -> Result<Option<(u64, Vec<Project>)>, BuildMonitorError> {
+    let file = match File::open(path) {
+        Ok(file) => file,
+        Err(error) if error.kind() == std::io::ErrorKind::NotFound => return Ok(None),
+        Err(error) => return Err(error.into()),
+    };
+
+    let mut reader = BufReader::new(file);
+    let header: SnapshotHeader = bincode::deserialize_from(&mut reader)?;
+    if header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION {
+        return Err(BuildMonitorError::SnapshotError());
+    }
+    if header.jenkins_server != jenkins_server {
+        return Ok(None);
+    }
+
+    // A snapshot that was damaged on disk is not served to clients.
+    let mut projects_buffer = Vec::new();
+    reader.read_to_end(&mut projects_buffer)?;
+    if checksum(&projects_buffer) != header.checksum {
+        return Err(BuildMonitorError::SnapshotError());
+    }
+    let projects: Vec<Project> = bincode::deserialize(&projects_buffer)?;
+
+    Ok(Some((Monitor::generate_projects_hash(&projects), projects)))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn checksum_test() {
+        // The checksum of a snapshot must not depend on the build that wrote it.
+        assert_eq!(checksum(b""), 0xcbf29ce484222325);
+        assert_eq!(checksum(b"a"), 0xaf63dc4c8601ec8c);
+        assert_eq!(checksum(b"foobar"), 0x85944171f73967e8);
+    }
+
+    #[test]
+    fn save_and_load_snapshot_test() {
+        let path = std::env::temp_dir().join(format!("build_monitor_snapshot_test_{}.bin", std::process::id()));
+        let projects = vec![Project::new("folder", "https://jenkins/job/folder/job/project/")];
+        let projects_hash = Monitor::generate_projects_hash(&projects);
+        save_snapshot(&path, "https://jenkins", &projects).unwrap();
+
+        let (loaded_hash, loaded_projects) = load_snapshot(&path, "https://jenkins").unwrap().unwrap();
+        assert_eq!(loaded_hash, projects_hash);
+        assert_eq!(loaded_projects.len(), 1);
+        assert_eq!(loaded_projects[0].url(), projects[0].url());
+
+        assert!(load_snapshot(&path, "https://other-jenkins").unwrap().is_none());
+
+        // A damaged snapshot isn't loaded.
+        let mut data = fs::read(&path).unwrap();
+        let last = data.len() - 1;
+        data[last] ^= 1;
+        fs::write(&path, &data).unwrap();
+        assert!(load_snapshot(&path, "https://jenkins").is_err());
+
+        fs::remove_file(&path).unwrap();
+        assert!(load_snapshot(&path, "https://jenkins").unwrap().is_none());
+    }
+}
@@ -7,25 +7,33 @@ use std::io::ErrorKind;
 use std::net::{IpAddr, Ipv4Addr, Ipv6Addr};
 use std::ptr::null_mut;
 
+// The path of an url, like /job/folder/ for https://jenkins:8080/job/folder/.
+pub fn url_path(url: &str) -> &str {
+    let without_scheme = match url.find("://") {
+        Some(index) => &url[index + 3..],
+        None => url,
+    };
+    match without_scheme.find('/') {
+        Some(index) => &without_scheme[index..],
+        None => "/",
+    }
+}
+
 #[cfg(unix)]
 pub fn get_local_addresses() -> Result<Vec<IpAddr>, Error> {
-    use std::mem;
-
     unsafe
     {
-        let mut address_ptr = libc::malloc(mem::size_of::<* mut libc::ifaddrs>()) as *mut libc::ifaddrs;
-        let result = getifaddrs(&mut address_ptr);
-
-        if result != 0 {
-            libc::freeifaddrs(address_ptr);
+        let mut addresses: *mut libc::ifaddrs = null_mut();
+        if getifaddrs(&mut addresses) != 0 {
             return Err(Error::new(ErrorKind::Other, "Failed to get the address."))
         }
 
         let mut result: Vec<IpAddr> = Vec::new();
+        let mut address_ptr = addresses;
         while address_ptr != null_mut() {
             let address = *address_ptr;
+            address_ptr = address.ifa_next;
             if address.ifa_addr == null_mut() {
-                address_ptr = address.ifa_next;
                 continue;
             }
 
@@ -37,6 +45,7 @@ pub fn get_local_addresses() -> Result<Vec<IpAddr>, Error> {
                     result.push(IpAddr::V4(Ipv4Addr::from(*raw_ip)));
             }
         }
+        libc::freeifaddrs(addresses);
 
         Ok(result)
     }
@@ -129,3 +138,25 @@ pub fn get_username() -> String {
     }
 }
 
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn get_local_addresses_test() {
+        // Returns once every interface was visited, without the loopback addresses.
+        let addresses = get_local_addresses().unwrap();
+        assert!(addresses.iter().all(|address| !address.is_loopback()));
+
+        // The address the system sends from to other hosts is one of them, when there is a route to
+        // other hosts at all. Connecting a UDP socket doesn't send anything.
+        let socket = std::net::UdpSocket::bind("0.0.0.0:0").unwrap();
+        match socket.connect("192.0.2.1:9").and_then(|()| socket.local_addr()) {
+            Ok(local_address) if cfg!(unix) && !local_address.ip().is_loopback() => {
+                assert!(addresses.contains(&local_address.ip()), "{} isn't in {:?}", local_address.ip(), addresses);
+            }
+            _ => println!("There is no route to other hosts, only the loopback addresses were checked."),
+        }
+    }
+}
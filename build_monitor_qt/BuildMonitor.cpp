@@ -39,6 +39,9 @@ BuildMonitor::BuildMonitor(QWidget *parent) :
 	QMainWindow(parent),
 	communicationThreadRunning(false),
 	buildMonitorHandle(nullptr),
+	projectsSnapshot(nullptr),
+	lastUpdateTime(0),
+	projectsStale(false),
 	noInformationIcon(":/BuildMonitor/Resources/no_information.png"),
 	successfulBuildIcon(":/BuildMonitor/Resources/successful_build.png"),
 	successfulBuildInProgressIcon(":/BuildMonitor/Resources/successful_build_in-progress.png"),
@@ -213,6 +216,7 @@ void BuildMonitor::exit()
 {
 	exitApplication = true;
 	stopCommunicationThread();
+	releaseProjects();
 	close();
 }
 
@@ -247,6 +251,8 @@ void BuildMonitor::startCommunicationThread()
 	assert(!communicationThreadRunning);
 
 	communicationThreadRunning = true;
+	lastUpdateTime = 0;
+	projectsStale = false;
 	communicationThread = std::thread([&] ()
 	{
 		buildMonitorHandle = bm_create("");
@@ -264,19 +270,32 @@ void BuildMonitor::startCommunicationThread()
 		{
 			if (bm_refresh_projects(buildMonitorHandle) > 0)
 			{
-				const uint32_t numProjects = bm_get_num_projects(buildMonitorHandle);
-				std::vector<ProjectsFFI> myProjects;
-				myProjects.resize(numProjects);
-				bm_acquire_projects(buildMonitorHandle, numProjects, myProjects.data());
+				// NOTE: The snapshot holds all projects in one allocation, and the projects point into it.
+				void* snapshot = bm_acquire_snapshot(buildMonitorHandle);
+				const ProjectsFFI* snapshotProjects = bm_snapshot_projects(snapshot);
+				std::vector<ProjectsFFI> myProjects(snapshotProjects, snapshotProjects + bm_snapshot_num_projects(snapshot));
 
 				projectsMutex.lock();
-				bm_release_projects(static_cast<uint32_t>(projects.size()), projects.data());
+				std::swap(projectsSnapshot, snapshot);
 				projects = std::move(myProjects);
 				projectsMutex.unlock();
 
+				if (snapshot)
+				{
+					bm_release_snapshot(snapshot);
+				}
+
+				lastUpdateTime = std::time(nullptr);
 				emit serverInformationUpdated();
 				emit projectInformationUpdated();
 			}
+
+			const bool stale = bm_is_stale(buildMonitorHandle);
+			if (stale != projectsStale)
+			{
+				projectsStale = stale;
+				emit serverInformationUpdated();
+			}
 			std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 		}
 
@@ -292,17 +311,29 @@ void BuildMonitor::stopCommunicationThread()
 	communicationThread.join();
 }
 
+void BuildMonitor::releaseProjects()
+{
+	projectsMutex.lock();
+	projects.clear();
+	if (projectsSnapshot)
+	{
+		bm_release_snapshot(projectsSnapshot);
+		projectsSnapshot = nullptr;
+	}
+	projectsMutex.unlock();
+}
+
 void BuildMonitor::onSettingsChanged(bool serverSettingsChanged)
 {
 	if (!exitApplication)
 	{
 		if (serverSettingsChanged)
 		{
-			projects.clear();
 			if (communicationThreadRunning)
 			{
 				stopCommunicationThread();
 			}
+			releaseProjects();
 			startCommunicationThread();
 		}
 		emit projectInformationUpdated();
@@ -444,10 +475,19 @@ void BuildMonitor::onProjectInformationUpdated()
 
 void BuildMonitor::onServerInformationUpdated()
 {
-	std::time_t now = std::time(nullptr);
-	std::tm localTime = *std::localtime(&now);
+	const std::time_t updateTime = lastUpdateTime;
+	if (updateTime == 0)
+	{
+		return;
+	}
+
+	std::tm localTime = *std::localtime(&updateTime);
 	std::stringstream statusBarMessage;
 	statusBarMessage << "Last updated: " << std::put_time(&localTime, "%Y-%m-%d %H:%M:%S %Z");
+	if (projectsStale)
+	{
+		statusBarMessage << " - The server hasn't been heard from for a while, the projects may be out of date.";
+	}
 
 	ui.statusBar->showMessage(QString::fromStdString(statusBarMessage.str()));
 }
@@ -22,6 +22,7 @@
 #include "TrayContextAction.h"
 
 #include <atomic>
+#include <ctime>
 #include <map>
 #include <mutex>
 #include <qsystemtrayicon.h>
@@ -56,6 +57,7 @@ private:
 	void setWindowPositionAndSize();
 	void startCommunicationThread();
 	void stopCommunicationThread();
+	void releaseProjects();
 
 	void onSettingsChanged(bool serverSettingsChanged);
 	void onTrayActivated(QSystemTrayIcon::ActivationReason reason);
@@ -69,8 +71,14 @@ private:
 	std::atomic<bool> communicationThreadRunning;
 	std::atomic<void*> buildMonitorHandle;
 	std::vector<ProjectsFFI> projects;
+	// NOTE: Owns the strings of the projects.
+	void* projectsSnapshot;
 	std::map<uint64_t, ProjectStatusFFI> lastProjectStatus;
 	std::mutex projectsMutex;
+	// NOTE: When the projects last changed, 0 before the first projects arrived.
+	std::atomic<std::time_t> lastUpdateTime;
+	// NOTE: Whether the client didn't hear from its server for too long, so the projects may be out of date.
+	std::atomic<bool> projectsStale;
 
 	Ui::BuildMonitorClass ui;
 	QIcon noInformationIcon;